@@ -99,6 +99,12 @@ bool CommandLine::HasSwitch(const char switch_constant[]) const {
   return switches_.find(std::string(switch_constant)) != switches_.end();
 }
 
+CommandLine::StringType CommandLine::GetSwitchValueNative(
+    const char switch_constant[]) const {
+  auto result = switches_.find(std::string(switch_constant));
+  return result == switches_.end() ? StringType() : result->second;
+}
+
 CommandLine::StringVector CommandLine::GetArgs() const {
   // Gather all arguments after the last switch (may include kSwitchTerminator).
   StringVector args(argv_.begin() + begin_args_, argv_.end());
@@ -33,6 +33,11 @@ class CommandLine {
   // StringPiece.
   bool HasSwitch(const char switch_constant[]) const;
 
+  // Returns the value associated with the given switch. If the switch has no
+  // value or isn't present, this method returns the empty string.
+  // Switch names must be lowercase.
+  StringType GetSwitchValueNative(const char switch_constant[]) const;
+
   // Get the remaining arguments to the command.
   StringVector GetArgs() const;
 
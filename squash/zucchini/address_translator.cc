@@ -9,6 +9,55 @@
 
 namespace zucchini {
 
+namespace {
+
+// Page table entries of pages that intersect no Unit, or several Units.
+constexpr uint32_t kNoUnit = static_cast<uint32_t>(-1);
+constexpr uint32_t kManyUnits = static_cast<uint32_t>(-2);
+
+// Returns a page table for the disjoint ranges of |units|, which are given by
+// |get_range| as {begin, size} pairs, in an address space that ends at
+// |bound|. Returns an empty table if there are too many pages.
+template <class GetRange>
+std::vector<uint32_t> MakePageTable(
+    const std::vector<AddressTranslator::Unit>& units,
+    uint32_t bound,
+    GetRange get_range) {
+  constexpr uint32_t kPageBits = AddressTranslator::kPageBits;
+  size_t num_pages = (size_t(bound) + (1U << kPageBits) - 1) >> kPageBits;
+  if (num_pages > AddressTranslator::kMaxPages)
+    return {};
+  std::vector<uint32_t> pages(num_pages, kNoUnit);
+  for (size_t i = 0; i < units.size(); ++i) {
+    std::pair<uint32_t, uint32_t> range = get_range(units[i]);
+    if (range.second == 0)
+      continue;
+    size_t last_page = (range.first + range.second - 1) >> kPageBits;
+    for (size_t page = range.first >> kPageBits; page <= last_page; ++page)
+      pages[page] = pages[page] == kNoUnit ? uint32_t(i) : kManyUnits;
+  }
+  return pages;
+}
+
+// Returns the Unit of |units| found for |address| by |pages|, or null if there
+// is none. Sets |*found| to false if |pages| is not conclusive.
+template <class Covers>
+const AddressTranslator::Unit* LookupPageTable(
+    const std::vector<uint32_t>& pages,
+    const std::vector<AddressTranslator::Unit>& units,
+    uint32_t address,
+    Covers covers,
+    bool* found) {
+  size_t page = address >> AddressTranslator::kPageBits;
+  *found = page < pages.size() && pages[page] != kManyUnits;
+  if (!*found || pages[page] == kNoUnit)
+    return nullptr;
+  const AddressTranslator::Unit& unit = units[pages[page]];
+  return covers(unit, address) ? &unit : nullptr;
+}
+
+}  // namespace
+
 /******** AddressTranslator::OffsetToRvaCache ********/
 
 AddressTranslator::OffsetToRvaCache::OffsetToRvaCache(
@@ -57,6 +106,9 @@ offset_t AddressTranslator::RvaToOffsetCache::Convert(rva_t rva) const {
 
 /******** AddressTranslator ********/
 
+constexpr uint32_t AddressTranslator::kPageBits;
+constexpr size_t AddressTranslator::kMaxPages;
+
 AddressTranslator::AddressTranslator() = default;
 
 AddressTranslator::~AddressTranslator() = default;
@@ -203,6 +255,15 @@ AddressTranslator::Status AddressTranslator::Initialize(
   });
   units_sorted_by_rva_ = std::move(units);
 
+  offset_pages_ = MakePageTable(
+      units_sorted_by_offset_, offset_bound, [](const Unit& unit) {
+        return std::make_pair(unit.offset_begin, unit.offset_size);
+      });
+  rva_pages_ =
+      MakePageTable(units_sorted_by_rva_, rva_bound, [](const Unit& unit) {
+        return std::make_pair(unit.rva_begin, unit.rva_size);
+      });
+
   fake_offset_begin_ = offset_bound;
   return kSuccess;
 }
@@ -230,6 +291,12 @@ offset_t AddressTranslator::RvaToOffset(rva_t rva) const {
 
 const AddressTranslator::Unit* AddressTranslator::OffsetToUnit(
     offset_t offset) const {
+  bool found = false;
+  const Unit* unit = LookupPageTable(
+      offset_pages_, units_sorted_by_offset_, offset,
+      [](const Unit& u, offset_t a) { return u.CoversOffset(a); }, &found);
+  if (found)
+    return unit;
   // Finds first Unit with |offset_begin| > |offset|, rewind by 1 to find the
   // last Unit with |offset_begin| >= |offset| (if it exists).
   auto it = std::upper_bound(
@@ -242,6 +309,12 @@ const AddressTranslator::Unit* AddressTranslator::OffsetToUnit(
 }
 
 const AddressTranslator::Unit* AddressTranslator::RvaToUnit(rva_t rva) const {
+  bool found = false;
+  const Unit* unit = LookupPageTable(
+      rva_pages_, units_sorted_by_rva_, rva,
+      [](const Unit& u, rva_t a) { return u.CoversRva(a); }, &found);
+  if (found)
+    return unit;
   auto it = std::upper_bound(
       units_sorted_by_rva_.begin(), units_sorted_by_rva_.end(), rva,
       [](rva_t a, const Unit& b) { return a < b.rva_begin; });
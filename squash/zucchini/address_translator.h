@@ -5,6 +5,7 @@
 #ifndef CHROME_INSTALLER_ZUCCHINI_ADDRESS_TRANSLATOR_H_
 #define CHROME_INSTALLER_ZUCCHINI_ADDRESS_TRANSLATOR_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include <tuple>
@@ -153,6 +154,13 @@ class AddressTranslator {
   AddressTranslator();
   ~AddressTranslator();
 
+  // Granularity of the page tables that map offsets and RVAs to Units, as a
+  // power of 2.
+  static constexpr uint32_t kPageBits = 12;
+  // Maximum number of pages of a page table. Larger address spaces fall back
+  // to binary search.
+  static constexpr size_t kMaxPages = size_t(1) << 18;
+
   // Consumes |units| to populate data in this class. Performs consistency
   // checks and overlapping Units. Returns Status to indicate success.
   Status Initialize(std::vector<Unit>&& units);
@@ -178,7 +186,8 @@ class AddressTranslator {
 
  private:
   // Helper to find the Unit that contains given |offset| or |rva|. Returns null
-  // if not found.
+  // if not found. Pages that intersect a single Unit are looked up in constant
+  // time, and other pages with a binary search.
   const Unit* OffsetToUnit(offset_t offset) const;
   const Unit* RvaToUnit(rva_t rva) const;
 
@@ -187,6 +196,14 @@ class AddressTranslator {
   std::vector<Unit> units_sorted_by_offset_;
   std::vector<Unit> units_sorted_by_rva_;
 
+  // Page tables: For each page of 2^|kPageBits| offsets (resp. RVAs), the index
+  // in |units_sorted_by_offset_| (resp. |units_sorted_by_rva_|) of the only
+  // Unit whose range intersects the page, or a special value if there are
+  // none or several. Empty if the address space has more than |kMaxPages|
+  // pages.
+  std::vector<uint32_t> offset_pages_;
+  std::vector<uint32_t> rva_pages_;
+
   // Conversion factor to translate between dangling RVAs and fake offsets.
   offset_t fake_offset_begin_;
 
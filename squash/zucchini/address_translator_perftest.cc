@@ -0,0 +1,98 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "squash/zucchini/address_translator.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace zucchini {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kNumQueries = 1 << 22;
+
+// Returns the Units of a typical large PE image: the sections of code, data,
+// exception data, resources and relocations, where data has dangling RVAs.
+std::vector<AddressTranslator::Unit> MakePeUnits() {
+  return {{0x00000400U, +0x05A00000U, 0x00001000U, +0x05A00000U},
+          {0x05A00400U, +0x01200000U, 0x05A01000U, +0x01200000U},
+          {0x06C00400U, +0x00080000U, 0x06C01000U, +0x00200000U},
+          {0x06C80400U, +0x00300000U, 0x06E01000U, +0x00300000U},
+          {0x06F80400U, +0x00001000U, 0x07101000U, +0x00001000U},
+          {0x06F81400U, +0x00040000U, 0x07102000U, +0x00040000U},
+          {0x06FC1400U, +0x00200000U, 0x07142000U, +0x00200000U}};
+}
+
+// Measures translations of |kNumQueries| addresses of |queries|, with
+// |convert|, and returns a checksum of the results.
+template <class Convert>
+uint32_t MeasureTranslations(const std::string& name,
+                             const std::vector<uint32_t>& queries,
+                             Convert convert) {
+  uint32_t checksum = 0;
+  auto start = Clock::now();
+  for (uint32_t query : queries)
+    checksum += convert(query);
+  std::chrono::duration<double> time = Clock::now() - start;
+  std::cout << name << ": " << queries.size() / time.count() / 1e6
+            << " M/s" << std::endl;
+  return checksum;
+}
+
+}  // namespace
+
+// Measures throughput of random translations, like those of rel32 targets
+// scattered across sections, and of clustered translations, like those of
+// rel32 locations.
+TEST(AddressTranslatorPerfTest, Translate) {
+  AddressTranslator translator;
+  ASSERT_EQ(AddressTranslator::kSuccess, translator.Initialize(MakePeUnits()));
+  const AddressTranslator::Unit& last_unit =
+      translator.units_sorted_by_rva().back();
+
+  std::mt19937 rng(0);
+  std::vector<uint32_t> random_rvas(kNumQueries);
+  for (uint32_t& rva : random_rvas)
+    rva = rng() % last_unit.rva_end();
+  std::vector<uint32_t> random_offsets(kNumQueries);
+  for (uint32_t& offset : random_offsets)
+    offset = rng() % translator.fake_offset_begin();
+  std::vector<uint32_t> clustered_offsets(kNumQueries);
+  for (size_t i = 0; i < kNumQueries; ++i)
+    clustered_offsets[i] = 0x400 + static_cast<uint32_t>(i) * 16;
+
+  AddressTranslator::RvaToOffsetCache rva_to_offset(translator);
+  AddressTranslator::OffsetToRvaCache offset_to_rva(translator);
+  uint32_t checksum = 0;
+  checksum += MeasureTranslations(
+      "RvaToOffset, random", random_rvas,
+      [&](rva_t rva) { return translator.RvaToOffset(rva); });
+  checksum += MeasureTranslations(
+      "RvaToOffsetCache, random", random_rvas,
+      [&](rva_t rva) { return rva_to_offset.Convert(rva); });
+  checksum += MeasureTranslations(
+      "OffsetToRva, random", random_offsets,
+      [&](offset_t offset) { return translator.OffsetToRva(offset); });
+  checksum += MeasureTranslations(
+      "OffsetToRvaCache, random", random_offsets,
+      [&](offset_t offset) { return offset_to_rva.Convert(offset); });
+  checksum += MeasureTranslations(
+      "OffsetToRvaCache, clustered", clustered_offsets,
+      [&](offset_t offset) { return offset_to_rva.Convert(offset); });
+  EXPECT_NE(0U, checksum);
+}
+
+}  // namespace zucchini
@@ -553,4 +553,54 @@ TEST(AddressTranslatorTest, Merge) {
   } while (std::next_permutation(test_case2.begin(), test_case2.end()));
 }
 
+// Compares lookups of Units through page tables, which are used for low RVAs,
+// with a linear search.
+TEST(AddressTranslatorTest, PageTable) {
+  using AT = AddressTranslator;
+  // Some Units share pages, and some have dangling RVAs.
+  const AT::Unit kUnits[] = {
+      {0x0000U, +0x0400U, 0x1000U, +0x0400U},
+      {0x0400U, +0x0100U, 0x1400U, +0x0180U},
+      {0x0500U, +0x0080U, 0x1600U, +0x0080U},
+      {0x0580U, +0x3000U, 0x2000U, +0x3000U},
+      {0x3580U, +0x0000U, 0x6000U, +0x1800U},
+      {0x3600U, +0x2345U, 0x7800U, +0x4000U},
+  };
+  constexpr rva_t kEndRva = 0xC000U;
+  for (rva_t rva_base : {0x00000000U, 0x60000000U}) {
+    std::vector<AT::Unit> units;
+    for (AT::Unit unit : kUnits) {
+      unit.rva_begin += rva_base;
+      units.push_back(unit);
+    }
+    AddressTranslator translator;
+    ASSERT_EQ(AT::kSuccess, translator.Initialize(std::move(units)));
+    AT::OffsetToRvaCache offset_to_rva(translator);
+    AT::RvaToOffsetCache rva_to_offset(translator);
+
+    for (offset_t offset = 0; offset < translator.fake_offset_begin();
+         ++offset) {
+      rva_t expected = kInvalidRva;
+      for (const AT::Unit& unit : translator.units_sorted_by_offset()) {
+        if (unit.CoversOffset(offset))
+          expected = unit.OffsetToRvaUnsafe(offset);
+      }
+      EXPECT_EQ(expected, translator.OffsetToRva(offset));
+      EXPECT_EQ(expected, offset_to_rva.Convert(offset));
+    }
+    for (rva_t rva = rva_base; rva < rva_base + kEndRva; ++rva) {
+      offset_t expected = kInvalidOffset;
+      for (const AT::Unit& unit : translator.units_sorted_by_rva()) {
+        if (unit.CoversRva(rva)) {
+          expected =
+              unit.RvaToOffsetUnsafe(rva, translator.fake_offset_begin());
+        }
+      }
+      EXPECT_EQ(expected, translator.RvaToOffset(rva));
+      EXPECT_EQ(expected, rva_to_offset.Convert(rva));
+      EXPECT_EQ(expected != kInvalidOffset, rva_to_offset.IsValid(rva));
+    }
+  }
+}
+
 }  // namespace zucchini
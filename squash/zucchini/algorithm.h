@@ -6,6 +6,7 @@
 #define CHROME_INSTALLER_ZUCCHINI_ALGORITHM_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include <algorithm>
 #include <type_traits>
@@ -53,6 +54,57 @@ constexpr T ceil(T x, T m) {
   return T((x + m - 1) / m) * m;
 }
 
+// Returns the number of bits set in |x|.
+inline uint32_t PopCount(uint64_t x) {
+#if defined(__GNUC__)
+  return static_cast<uint32_t>(__builtin_popcountll(x));
+#else
+  x -= (x >> 1) & 0x5555555555555555ULL;
+  x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+  return static_cast<uint32_t>((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+// Returns the number of trailing 0 bits in |x|, or 64 if |x == 0|.
+inline uint32_t CountTrailingZeros(uint64_t x) {
+  if (x == 0)
+    return 64;
+#if defined(__GNUC__)
+  return static_cast<uint32_t>(__builtin_ctzll(x));
+#else
+  uint32_t count = 0;
+  for (; !(x & 1); x >>= 1)
+    ++count;
+  return count;
+#endif
+}
+
+// Returns the number of leading 0 bits in |x|, or 64 if |x == 0|.
+inline uint32_t CountLeadingZeros(uint64_t x) {
+  if (x == 0)
+    return 64;
+#if defined(__GNUC__)
+  return static_cast<uint32_t>(__builtin_clzll(x));
+#else
+  uint32_t count = 0;
+  for (; !(x >> 63); x <<= 1)
+    ++count;
+  return count;
+#endif
+}
+
+// Returns |x| with its bits mixed by the finalizer of MurmurHash3, so that each
+// bit of the result depends on all bits of |x|. This is a bijection.
+inline uint64_t MixBits(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xFF51AFD7ED558CCDULL;
+  x ^= x >> 33;
+  x *= 0xC4CEB9FE1A85EC53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
 // Sorts values in |container| and removes duplicates.
 template <class T>
 void SortAndUniquify(std::vector<T>* container) {
@@ -131,4 +131,31 @@ TEST(Algorithm, Ceil) {
   EXPECT_EQ(33U, ceil<uint32_t>(23U, 11U));
 }
 
+TEST(Algorithm, PopCount) {
+  EXPECT_EQ(0U, PopCount(0U));
+  EXPECT_EQ(1U, PopCount(1U));
+  EXPECT_EQ(1U, PopCount(0x8000000000000000ULL));
+  EXPECT_EQ(8U, PopCount(0xFFU));
+  EXPECT_EQ(16U, PopCount(0xF0F0F0F0U));
+  EXPECT_EQ(32U, PopCount(0x5555555555555555ULL));
+  EXPECT_EQ(63U, PopCount(0xFFFFFFFFFFFFFFFEULL));
+  EXPECT_EQ(64U, PopCount(0xFFFFFFFFFFFFFFFFULL));
+}
+
+TEST(Algorithm, CountTrailingZeros) {
+  EXPECT_EQ(64U, CountTrailingZeros(0U));
+  EXPECT_EQ(0U, CountTrailingZeros(1U));
+  EXPECT_EQ(0U, CountTrailingZeros(0xFFFFFFFFFFFFFFFFULL));
+  EXPECT_EQ(4U, CountTrailingZeros(0xF0U));
+  EXPECT_EQ(63U, CountTrailingZeros(0x8000000000000000ULL));
+}
+
+TEST(Algorithm, CountLeadingZeros) {
+  EXPECT_EQ(64U, CountLeadingZeros(0U));
+  EXPECT_EQ(63U, CountLeadingZeros(1U));
+  EXPECT_EQ(0U, CountLeadingZeros(0xFFFFFFFFFFFFFFFFULL));
+  EXPECT_EQ(56U, CountLeadingZeros(0xF0U));
+  EXPECT_EQ(0U, CountLeadingZeros(0x8000000000000000ULL));
+}
+
 }  // namespace zucchini
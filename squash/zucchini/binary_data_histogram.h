@@ -24,7 +24,10 @@ class BinaryDataHistogram {
   BinaryDataHistogram();
   ~BinaryDataHistogram();
 
-  // Attempts to compute the histogram, returns true iff successful.
+  // Attempts to compute the histogram, returns true iff successful. Large
+  // regions are counted into several sub-histograms that are summed at the
+  // end, so that runs of the same 2-byte sequence, e.g., padding, don't
+  // serialize increments of a single bin.
   bool Compute(ConstBufferView region);
 
   bool IsValid() const { return static_cast<bool>(histogram_); }
@@ -33,6 +36,7 @@ class BinaryDataHistogram {
   // identical then their histogram distance is 0. However, the converse is not
   // true in general. For example, "aba" and "bab" are different, but their
   // histogram distance is 0 (both histograms are {"ab": 1, "ba": 1}).
+  // Both histograms must be valid.
   double Distance(const BinaryDataHistogram& other) const;
 
  private:
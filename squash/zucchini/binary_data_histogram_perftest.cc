@@ -0,0 +1,77 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "squash/zucchini/binary_data_histogram.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "squash/zucchini/buffer_view.h"
+#include "gtest/gtest.h"
+
+namespace zucchini {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kDataSize = 1 << 26;
+constexpr size_t kNumHistograms = 16;
+
+// Measures computing the histogram of |data|.
+void MeasureCompute(const std::string& name, const std::vector<uint8_t>& data) {
+  BinaryDataHistogram histogram;
+  auto start = Clock::now();
+  EXPECT_TRUE(histogram.Compute({data.data(), data.size()}));
+  std::chrono::duration<double> time = Clock::now() - start;
+  std::cout << "Compute, " << name << ": " << data.size() / time.count() / 1e6
+            << " MB/s" << std::endl;
+}
+
+// Measures computing the distances between all pairs of |histograms|, and
+// returns their sum.
+double MeasureDistance(const std::vector<BinaryDataHistogram>& histograms) {
+  double sum = 0;
+  auto start = Clock::now();
+  for (const BinaryDataHistogram& histogram1 : histograms) {
+    for (const BinaryDataHistogram& histogram2 : histograms)
+      sum += histogram1.Distance(histogram2);
+  }
+  std::chrono::duration<double> time = Clock::now() - start;
+  std::cout << "Distance: "
+            << histograms.size() * histograms.size() / time.count() / 1e3
+            << " K/s" << std::endl;
+  return sum;
+}
+
+}  // namespace
+
+// Measures histogram computation over random data, and over zeros, where all
+// increments hit the same bin, and distances between histograms of slices of
+// random data.
+TEST(BinaryDataHistogramPerfTest, ComputeAndDistance) {
+  std::mt19937 rng(0);
+  std::vector<uint8_t> random_data(kDataSize);
+  for (uint8_t& value : random_data)
+    value = static_cast<uint8_t>(rng());
+  MeasureCompute("random", random_data);
+  MeasureCompute("zeros", std::vector<uint8_t>(kDataSize));
+
+  std::vector<BinaryDataHistogram> histograms(kNumHistograms);
+  const size_t slice_size = kDataSize / kNumHistograms;
+  for (size_t i = 0; i < kNumHistograms; ++i) {
+    ASSERT_TRUE(
+        histograms[i].Compute({random_data.data() + i * slice_size,
+                               slice_size - i}));
+  }
+  EXPECT_LT(0.0, MeasureDistance(histograms));
+}
+
+}  // namespace zucchini
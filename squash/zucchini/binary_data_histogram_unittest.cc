@@ -5,7 +5,10 @@
 #include "squash/zucchini/binary_data_histogram.h"
 
 #include <stddef.h>
+#include <stdint.h>
 
+#include <cstdlib>
+#include <random>
 #include <vector>
 
 #include "squash/zucchini/buffer_view.h"
@@ -13,6 +16,36 @@
 
 namespace zucchini {
 
+namespace {
+
+// Returns the counts of 2-byte sequences of |region|, computed naively.
+std::vector<int32_t> CountNaively(ConstBufferView region) {
+  std::vector<int32_t> counts(1 << 16);
+  for (size_t i = 0; i + 1 < region.size(); ++i)
+    ++counts[region.read<uint16_t>(i)];
+  return counts;
+}
+
+// Returns the distance between |region1| and |region2|, computed naively.
+double DistanceNaively(ConstBufferView region1, ConstBufferView region2) {
+  std::vector<int32_t> counts1 = CountNaively(region1);
+  std::vector<int32_t> counts2 = CountNaively(region2);
+  double total_diff = 0;
+  for (size_t i = 0; i < counts1.size(); ++i)
+    total_diff += std::abs(counts1[i] - counts2[i]);
+  return total_diff / (region1.size() + region2.size());
+}
+
+// Returns |size| bytes made of runs of random bytes and of zeros.
+std::vector<uint8_t> MakeTestData(size_t size, std::mt19937* rng) {
+  std::vector<uint8_t> data(size);
+  for (size_t i = 0; i < size; ++i)
+    data[i] = (i / 4096) % 3 == 0 ? 0 : static_cast<uint8_t>((*rng)());
+  return data;
+}
+
+}  // namespace
+
 TEST(BinaryDataHistogramTest, Basic) {
   constexpr double kUninitScore = -1;
 
@@ -69,4 +102,27 @@ TEST(BinaryDataHistogramTest, Basic) {
   }
 }
 
+TEST(BinaryDataHistogramTest, LargeRegions) {
+  // Regions are large enough for sub-histograms, and of sizes that leave
+  // various remainders.
+  std::mt19937 rng(0);
+  const std::vector<uint8_t> data1 = MakeTestData(1 << 19, &rng);
+  const std::vector<uint8_t> data2 = MakeTestData((1 << 19) + 3, &rng);
+  for (size_t size1 : {size_t(2), size_t(1000), size_t(1 << 18),
+                       size_t((1 << 18) + 2), size_t(1 << 19)}) {
+    for (size_t size2 : {size_t(17), size_t((1 << 18) + 5),
+                         size_t((1 << 19) + 3)}) {
+      ConstBufferView region1(data1.data(), size1);
+      ConstBufferView region2(data2.data(), size2);
+      BinaryDataHistogram histogram1;
+      BinaryDataHistogram histogram2;
+      ASSERT_TRUE(histogram1.Compute(region1));
+      ASSERT_TRUE(histogram2.Compute(region2));
+      EXPECT_EQ(DistanceNaively(region1, region2),
+                histogram1.Distance(histogram2));
+      EXPECT_EQ(0.0, histogram1.Distance(histogram1));
+    }
+  }
+}
+
 }  // namespace zucchini
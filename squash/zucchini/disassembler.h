@@ -113,6 +113,10 @@ class Disassembler {
   ConstBufferView GetImage() const { return image_; }
   size_t size() const { return image_.size(); }
 
+  // Sets the number of threads that may be used to parse references, which is
+  // 1 by default, or one per hardware thread if 0.
+  void set_num_threads(size_t num_threads) { num_threads_ = num_threads; }
+
  protected:
   Disassembler();
 
@@ -123,6 +127,8 @@ class Disassembler {
   // Raw image data. After Parse(), a Disassembler should shrink this to contain
   // only the portion containing the executable file it recognizes.
   ConstBufferView image_;
+
+  size_t num_threads_ = 1;
 };
 
 }  // namespace zucchini
@@ -7,6 +7,8 @@
 #include <stddef.h>
 
 #include <algorithm>
+#include <utility>
+#include <vector>
 
 #include "base/numerics/safe_conversions.h"
 
@@ -18,6 +20,7 @@
 #include "squash/zucchini/rel32_finder.h"
 #include "squash/zucchini/rel32_utils.h"
 #include "squash/zucchini/reloc_utils.h"
+#include "squash/zucchini/thread_pool.h"
 
 namespace zucchini {
 
@@ -63,6 +66,115 @@ bool IsWin32CodeSection(const pe::ImageSectionHeader& section) {
          kCodeCharacteristics;
 }
 
+// Maximum number of bytes read by Rel32Finder beyond the start of a candidate
+// instruction, after its first byte.
+constexpr offset_t kRel32MaxLookahead = 5;
+
+// Part of a code section that is scanned for rel32 references by one thread.
+struct Rel32Chunk {
+  const pe::ImageSectionHeader* section;
+  // Range of offsets of the chunk.
+  offset_t lo;
+  offset_t hi;
+  // End of the gap between abs32 references that starts at |lo|, and end of
+  // the bytes that can be read to scan it. Both are |lo| if there is no such
+  // gap.
+  offset_t first_gap_end;
+  offset_t first_gap_data_end;
+  // Rel32 locations found, in increasing order, if scanning starts at |lo|.
+  std::vector<offset_t> locations;
+  // Number of elements of |locations| found in the first gap.
+  size_t first_gap_count;
+  // Offset where scanning resumes after the chunk. This exceeds |hi| if the
+  // last rel32 reference found crosses it.
+  offset_t resume;
+};
+
+// Validates rel32 references found by a Rel32Finder of type |Traits::RelFinder|
+// in a code section, which must point within the image, and within the section
+// unless the instruction says otherwise.
+template <class Traits>
+class Rel32Scanner {
+ public:
+  Rel32Scanner(ConstBufferView image,
+               const AddressTranslator& translator,
+               const pe::ImageSectionHeader& section)
+      : image_(image),
+        location_offset_to_rva_(translator),
+        target_rva_checker_(translator),
+        start_rva_(section.virtual_address),
+        end_rva_(section.virtual_address + section.virtual_size),
+        finder_(image) {}
+
+  // Scans for rel32 references whose instructions start in [|begin|, |end|),
+  // as if scanning the gap between abs32 references that holds them, which is
+  // known to span at least until |data_end|. Appends their locations to
+  // |locations|. If |sync| is not null, stops after finding a location that is
+  // in |sync|, which is sorted, and sets |*synced| to true. Returns the offset
+  // where scanning resumes, which is |begin| if it is past |end|.
+  offset_t Scan(offset_t begin,
+                offset_t end,
+                offset_t data_end,
+                const std::vector<offset_t>* sync,
+                bool* synced,
+                std::vector<offset_t>* locations) {
+    DCHECK_LE(end, data_end);
+    if (begin >= end)
+      return begin;
+    finder_.Reset(image_[{begin, data_end - begin}]);
+    offset_t resume = end;
+    for (auto rel32 = finder_.GetNext(); rel32.has_value();
+         rel32 = finder_.GetNext()) {
+      // The region of |finder_| starts right after the candidate instruction.
+      if (finder_.region().begin() - 1 >= image_.begin() + end)
+        break;
+      offset_t rel32_offset = offset_t(rel32->location - image_.begin());
+      rva_t rel32_rva = location_offset_to_rva_.Convert(rel32_offset);
+      rva_t target_rva = rel32_rva + 4 + image_.read<uint32_t>(rel32_offset);
+      if (target_rva_checker_.IsValid(target_rva) &&
+          (rel32->can_point_outside_section ||
+           (start_rva_ <= target_rva && target_rva < end_rva_))) {
+        finder_.Accept();
+        locations->push_back(rel32_offset);
+        resume = std::max(end, rel32_offset + 4);
+        if (sync && std::binary_search(sync->begin(), sync->end(),
+                                       rel32_offset)) {
+          *synced = true;
+          break;
+        }
+      }
+    }
+    return resume;
+  }
+
+ private:
+  ConstBufferView image_;
+  AddressTranslator::OffsetToRvaCache location_offset_to_rva_;
+  AddressTranslator::RvaToOffsetCache target_rva_checker_;
+  rva_t start_rva_;
+  rva_t end_rva_;
+  typename Traits::RelFinder finder_;
+};
+
+// Returns the end of the bytes that can be read to scan a gap between abs32
+// references that ends at |end|, of a chunk that ends at |hi|, in a code
+// section that ends at |section_end|. Scanning the gap beyond |hi| is left to
+// the next chunk, but instructions that start before |hi| can be read.
+offset_t GetGapDataEnd(offset_t end,
+                       offset_t hi,
+                       offset_t section_end,
+                       const std::vector<offset_t>& abs32_locations) {
+  if (end < hi)
+    return end;
+  // The gap continues until the next abs32 reference, if any.
+  offset_t data_end = std::min(hi + kRel32MaxLookahead, section_end);
+  auto next_abs32 =
+      std::lower_bound(abs32_locations.begin(), abs32_locations.end(), hi);
+  if (next_abs32 != abs32_locations.end())
+    data_end = std::min(data_end, *next_abs32);
+  return data_end;
+}
+
 }  // namespace
 
 /******** Win32X86Traits ********/
@@ -79,6 +191,113 @@ constexpr Bitness Win32X64Traits::kBitness;
 constexpr ExecutableType Win32X64Traits::kExeType;
 const char Win32X64Traits::kExeTypeString[] = "Windows PE x64";
 
+/******** FindWin32Rel32Locations ********/
+
+template <class Traits>
+std::vector<offset_t> FindWin32Rel32Locations(
+    ConstBufferView image,
+    const AddressTranslator& translator,
+    const std::vector<pe::ImageSectionHeader>& code_sections,
+    const std::vector<offset_t>& abs32_locations,
+    size_t num_threads,
+    offset_t chunk_size) {
+  DCHECK_GT(chunk_size, 0U);
+  // Code sections are split into chunks that are scanned concurrently. Each
+  // chunk is first scanned from its start, then if a rel32 reference of the
+  // previous chunk crosses into it, it is scanned again from the end of that
+  // reference, until both scans find the same reference.
+  std::vector<Rel32Chunk> chunks;
+  for (const pe::ImageSectionHeader& section : code_sections) {
+    offset_t section_end =
+        section.file_offset_of_raw_data + section.size_of_raw_data;
+    for (offset_t lo = section.file_offset_of_raw_data; lo < section_end;
+         lo += chunk_size) {
+      Rel32Chunk chunk = {};
+      chunk.section = &section;
+      chunk.lo = lo;
+      chunk.hi = std::min(lo + chunk_size, section_end);
+      chunks.push_back(std::move(chunk));
+    }
+  }
+
+  ThreadPool thread_pool(num_threads);
+  thread_pool.ParallelFor(chunks.size(), [&](size_t i) {
+    Rel32Chunk& chunk = chunks[i];
+    offset_t section_end = chunk.section->file_offset_of_raw_data +
+                           chunk.section->size_of_raw_data;
+    Rel32Scanner<Traits> scanner(image, translator, *chunk.section);
+    chunk.first_gap_end = chunk.lo;
+    chunk.first_gap_data_end = chunk.lo;
+    chunk.first_gap_count = 0;
+    chunk.resume = chunk.hi;
+    Abs32GapFinder gap_finder(image, image[{chunk.lo, chunk.hi - chunk.lo}],
+                              abs32_locations, Traits::kVAWidth);
+    bool is_first_gap = true;
+    for (auto gap = gap_finder.GetNext(); gap.has_value();
+         gap = gap_finder.GetNext()) {
+      offset_t begin = offset_t(gap->begin() - image.begin());
+      offset_t end = offset_t(gap->end() - image.begin());
+      offset_t data_end =
+          GetGapDataEnd(end, chunk.hi, section_end, abs32_locations);
+      offset_t resume = scanner.Scan(begin, end, data_end, nullptr, nullptr,
+                                     &chunk.locations);
+      if (is_first_gap && begin == chunk.lo) {
+        chunk.first_gap_end = end;
+        chunk.first_gap_data_end = data_end;
+        chunk.first_gap_count = chunk.locations.size();
+      }
+      is_first_gap = false;
+      if (end == chunk.hi)
+        chunk.resume = resume;
+    }
+  });
+
+  std::vector<offset_t> rel32_locations;
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    Rel32Chunk& chunk = chunks[i];
+    if (i > 0 && chunks[i - 1].section == chunk.section &&
+        chunks[i - 1].resume > chunk.lo) {
+      // Only the first gap is affected, since references do not cross abs32
+      // references.
+      Rel32Scanner<Traits> scanner(image, translator, *chunk.section);
+      std::vector<offset_t> locations;
+      bool synced = false;
+      offset_t resume = scanner.Scan(
+          chunks[i - 1].resume, chunk.first_gap_end, chunk.first_gap_data_end,
+          &chunk.locations, &synced, &locations);
+      auto rest = synced ? std::upper_bound(chunk.locations.begin(),
+                                            chunk.locations.end(),
+                                            locations.back())
+                         : chunk.locations.begin() + chunk.first_gap_count;
+      locations.insert(locations.end(), rest, chunk.locations.end());
+      chunk.locations = std::move(locations);
+      if (!synced && chunk.first_gap_end == chunk.hi)
+        chunk.resume = resume;
+    }
+    rel32_locations.insert(rel32_locations.end(), chunk.locations.begin(),
+                           chunk.locations.end());
+  }
+  // |code_sections| entries are usually sorted by offset, but there's no
+  // guarantee. So sort explicitly, to be sure.
+  std::sort(rel32_locations.begin(), rel32_locations.end());
+  return rel32_locations;
+}
+
+template std::vector<offset_t> FindWin32Rel32Locations<Win32X86Traits>(
+    ConstBufferView image,
+    const AddressTranslator& translator,
+    const std::vector<pe::ImageSectionHeader>& code_sections,
+    const std::vector<offset_t>& abs32_locations,
+    size_t num_threads,
+    offset_t chunk_size);
+template std::vector<offset_t> FindWin32Rel32Locations<Win32X64Traits>(
+    ConstBufferView image,
+    const AddressTranslator& translator,
+    const std::vector<pe::ImageSectionHeader>& code_sections,
+    const std::vector<offset_t>& abs32_locations,
+    size_t num_threads,
+    offset_t chunk_size);
+
 /******** DisassemblerWin32 ********/
 
 // static.
@@ -345,45 +564,14 @@ bool DisassemblerWin32<Traits>::ParseAndStoreRel32() {
 
   ParseAndStoreAbs32();
 
-  AddressTranslator::OffsetToRvaCache location_offset_to_rva(translator_);
-  AddressTranslator::RvaToOffsetCache target_rva_checker(translator_);
-
+  std::vector<pe::ImageSectionHeader> code_sections;
   for (const pe::ImageSectionHeader& section : sections_) {
-    if (!IsWin32CodeSection<Traits>(section))
-      continue;
-
-    rva_t start_rva = section.virtual_address;
-    rva_t end_rva = start_rva + section.virtual_size;
-
-    ConstBufferView region =
-        image_[{section.file_offset_of_raw_data, section.size_of_raw_data}];
-    Abs32GapFinder gap_finder(image_, region, abs32_locations_,
-                              Traits::kVAWidth);
-    typename Traits::RelFinder finder(image_);
-    // Iterate over gaps between abs32 references, to avoid collision.
-    for (auto gap = gap_finder.GetNext(); gap.has_value();
-         gap = gap_finder.GetNext()) {
-      finder.Reset(gap.value());
-      // Iterate over heuristically detected rel32 references, validate, and add
-      // to |rel32_locations_|.
-      for (auto rel32 = finder.GetNext(); rel32.has_value();
-           rel32 = finder.GetNext()) {
-        offset_t rel32_offset = offset_t(rel32->location - image_.begin());
-        rva_t rel32_rva = location_offset_to_rva.Convert(rel32_offset);
-        rva_t target_rva = rel32_rva + 4 + image_.read<uint32_t>(rel32_offset);
-        if (target_rva_checker.IsValid(target_rva) &&
-            (rel32->can_point_outside_section ||
-             (start_rva <= target_rva && target_rva < end_rva))) {
-          finder.Accept();
-          rel32_locations_.push_back(rel32_offset);
-        }
-      }
-    }
+    if (IsWin32CodeSection<Traits>(section))
+      code_sections.push_back(section);
   }
+  rel32_locations_ = FindWin32Rel32Locations<Traits>(
+      image_, translator_, code_sections, abs32_locations_, num_threads_);
   rel32_locations_.shrink_to_fit();
-  // |sections_| entries are usually sorted by offset, but there's no guarantee.
-  // So sort explicitly, to be sure.
-  std::sort(rel32_locations_.begin(), rel32_locations_.end());
   return true;
 }
 
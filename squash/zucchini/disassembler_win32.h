@@ -51,6 +51,24 @@ struct Win32X64Traits {
   using Address = uint64_t;
 };
 
+// Size of the chunks of code sections that are scanned concurrently for rel32
+// references.
+constexpr offset_t kRel32ChunkSize = 1 << 16;
+
+// Returns the sorted locations of rel32 references found in |code_sections| of
+// |image|, in gaps between |abs32_locations|, which must be sorted. Sections
+// are split into chunks of |chunk_size| bytes that are scanned on
+// |num_threads| threads (0 for hardware concurrency). The result is identical
+// to scanning each section serially.
+template <class Traits>
+std::vector<offset_t> FindWin32Rel32Locations(
+    ConstBufferView image,
+    const AddressTranslator& translator,
+    const std::vector<pe::ImageSectionHeader>& code_sections,
+    const std::vector<offset_t>& abs32_locations,
+    size_t num_threads,
+    offset_t chunk_size = kRel32ChunkSize);
+
 template <class Traits>
 class DisassemblerWin32 : public Disassembler {
  public:
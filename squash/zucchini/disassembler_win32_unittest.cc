@@ -0,0 +1,199 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "squash/zucchini/disassembler_win32.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "squash/zucchini/address_translator.h"
+#include "squash/zucchini/buffer_view.h"
+#include "squash/zucchini/image_utils.h"
+#include "squash/zucchini/rel32_finder.h"
+#include "squash/zucchini/type_win_pe.h"
+#include "gtest/gtest.h"
+
+namespace zucchini {
+
+namespace {
+
+constexpr offset_t kImageSize = 0x10000;
+constexpr rva_t kImageRva = 0x1000;
+
+// Bytes that make up most of the test images: opcodes of rel32 instructions,
+// and zeros so that displacements are often small, so that rel32 candidates
+// overlap and many are valid.
+constexpr uint8_t kImageBytes[] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+                                   0x05, 0x0F, 0x15, 0x25, 0x85, 0x8B,
+                                   0x8D, 0xE8, 0xE9, 0xFF};
+
+// Returns a code section at [|offset|, |offset| + |size|) of the image.
+pe::ImageSectionHeader MakeCodeSection(offset_t offset, offset_t size) {
+  pe::ImageSectionHeader section = {};
+  section.virtual_size = size;
+  section.virtual_address = kImageRva + offset;
+  section.size_of_raw_data = size;
+  section.file_offset_of_raw_data = offset;
+  return section;
+}
+
+// Returns image data dense in candidate rel32 instructions, with targets inside
+// and outside of |sections| and of the image, and pseudo-random bytes mostly
+// from |kImageBytes| between them, so that candidates often overlap.
+std::vector<uint8_t> MakeImage(
+    const std::vector<pe::ImageSectionHeader>& sections,
+    std::mt19937* rng) {
+  std::vector<uint8_t> image(kImageSize);
+  for (uint8_t& value : image) {
+    value = (*rng)() % 8 == 0
+                ? static_cast<uint8_t>((*rng)())
+                : kImageBytes[(*rng)() % sizeof(kImageBytes)];
+  }
+  for (const pe::ImageSectionHeader& section : sections) {
+    offset_t end = section.file_offset_of_raw_data + section.size_of_raw_data;
+    for (offset_t pos = section.file_offset_of_raw_data; pos + 6 <= end;
+         pos += 1 + (*rng)() % 4) {
+      switch ((*rng)() % 5) {
+        case 0:
+          image[pos++] = 0xE8;  // CALL.
+          break;
+        case 1:
+          image[pos++] = 0xE9;  // JMP.
+          break;
+        case 2:
+          image[pos++] = 0x0F;  // Jcc.
+          image[pos++] = static_cast<uint8_t>(0x80 + (*rng)() % 16);
+          break;
+        case 3:
+          image[pos++] = 0x8B;  // MOV with rip-relative operand on x64.
+          image[pos++] = 0x05;
+          break;
+        default:
+          continue;
+      }
+      uint32_t displacement = (*rng)() % 3 == 0
+                                  ? static_cast<uint32_t>((*rng)())
+                                  : static_cast<uint32_t>((*rng)() % 0x800) -
+                                        0x400;
+      for (int i = 0; i < 4; ++i)
+        image[pos + i] = static_cast<uint8_t>(displacement >> (i * 8));
+    }
+  }
+  return image;
+}
+
+// Returns sorted and non-overlapping abs32 locations of |width| bytes in
+// |sections|.
+std::vector<offset_t> MakeAbs32Locations(
+    const std::vector<pe::ImageSectionHeader>& sections,
+    offset_t width,
+    std::mt19937* rng) {
+  std::vector<offset_t> abs32_locations;
+  for (const pe::ImageSectionHeader& section : sections) {
+    offset_t end = section.file_offset_of_raw_data + section.size_of_raw_data;
+    for (offset_t pos = section.file_offset_of_raw_data + (*rng)() % 64;
+         pos + width <= end; pos += width + (*rng)() % 64) {
+      abs32_locations.push_back(pos);
+    }
+  }
+  return abs32_locations;
+}
+
+// Returns rel32 locations found by scanning each gap between
+// |abs32_locations| in |sections| from start to end.
+template <class Traits>
+std::vector<offset_t> FindRel32LocationsSerially(
+    ConstBufferView image,
+    const AddressTranslator& translator,
+    const std::vector<pe::ImageSectionHeader>& sections,
+    const std::vector<offset_t>& abs32_locations) {
+  AddressTranslator::OffsetToRvaCache location_offset_to_rva(translator);
+  AddressTranslator::RvaToOffsetCache target_rva_checker(translator);
+  std::vector<offset_t> rel32_locations;
+  for (const pe::ImageSectionHeader& section : sections) {
+    rva_t start_rva = section.virtual_address;
+    rva_t end_rva = start_rva + section.virtual_size;
+    ConstBufferView region =
+        image[{section.file_offset_of_raw_data, section.size_of_raw_data}];
+    Abs32GapFinder gap_finder(image, region, abs32_locations,
+                              Traits::kVAWidth);
+    typename Traits::RelFinder finder(image);
+    for (auto gap = gap_finder.GetNext(); gap.has_value();
+         gap = gap_finder.GetNext()) {
+      finder.Reset(gap.value());
+      for (auto rel32 = finder.GetNext(); rel32.has_value();
+           rel32 = finder.GetNext()) {
+        offset_t rel32_offset = offset_t(rel32->location - image.begin());
+        rva_t rel32_rva = location_offset_to_rva.Convert(rel32_offset);
+        rva_t target_rva = rel32_rva + 4 + image.read<uint32_t>(rel32_offset);
+        if (target_rva_checker.IsValid(target_rva) &&
+            (rel32->can_point_outside_section ||
+             (start_rva <= target_rva && target_rva < end_rva))) {
+          finder.Accept();
+          rel32_locations.push_back(rel32_offset);
+        }
+      }
+    }
+  }
+  std::sort(rel32_locations.begin(), rel32_locations.end());
+  return rel32_locations;
+}
+
+template <class Traits>
+void TestFindRel32Locations() {
+  // Adjacent code sections, since rel32 references must not be stitched across
+  // sections.
+  const std::vector<pe::ImageSectionHeader> sections = {
+      MakeCodeSection(0x100, 0x600), MakeCodeSection(0x700, 0x3FF),
+      MakeCodeSection(0xC00, 0x200)};
+  AddressTranslator translator;
+  ASSERT_EQ(AddressTranslator::kSuccess,
+            translator.Initialize({{0, kImageSize, kImageRva, kImageSize}}));
+
+  std::mt19937 rng(0);
+  for (int iteration = 0; iteration < 8; ++iteration) {
+    std::vector<uint8_t> buffer = MakeImage(sections, &rng);
+    ConstBufferView image(buffer.data(), buffer.size());
+    // Without abs32 locations, with dense ones, and with sparse ones.
+    for (offset_t abs32_period : {0U, 1U, 4U}) {
+      std::vector<offset_t> abs32_locations;
+      if (abs32_period) {
+        std::vector<offset_t> all_abs32_locations =
+            MakeAbs32Locations(sections, Traits::kVAWidth, &rng);
+        for (size_t i = 0; i < all_abs32_locations.size(); i += abs32_period)
+          abs32_locations.push_back(all_abs32_locations[i]);
+      }
+      std::vector<offset_t> expected = FindRel32LocationsSerially<Traits>(
+          image, translator, sections, abs32_locations);
+      EXPECT_LT(30U, expected.size());
+
+      for (offset_t chunk_size : {1U, 2U, 3U, 5U, 7U, 16U, 100U,
+                                  static_cast<unsigned>(kRel32ChunkSize)}) {
+        for (size_t num_threads : {1U, 4U}) {
+          EXPECT_EQ(expected, FindWin32Rel32Locations<Traits>(
+                                  image, translator, sections, abs32_locations,
+                                  num_threads, chunk_size))
+              << "iteration " << iteration << ", abs32 period " << abs32_period
+              << ", chunk size " << chunk_size << ", threads " << num_threads;
+        }
+      }
+    }
+  }
+}
+
+}  // namespace
+
+TEST(DisassemblerWin32Test, FindRel32LocationsX86) {
+  TestFindRel32Locations<Win32X86Traits>();
+}
+
+TEST(DisassemblerWin32Test, FindRel32LocationsX64) {
+  TestFindRel32Locations<Win32X64Traits>();
+}
+
+}  // namespace zucchini
@@ -4,12 +4,17 @@
 
 #include "squash/zucchini/element_detection.h"
 
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
 #include <utility>
 
 #include "squash/base/logging.h"
 #include "squash/zucchini/disassembler.h"
 #include "squash/zucchini/disassembler_no_op.h"
 #include "squash/zucchini/disassembler_win32.h"
+#include "squash/zucchini/type_win_pe.h"
 
 namespace zucchini {
 
@@ -18,6 +23,20 @@ namespace {
 // Impose a minimal program size to eliminate pathological cases.
 constexpr size_t kMinProgramSize = 16;
 
+// Returns true if |image| starts with the headers checked by
+// DisassemblerWin32X86::QuickDetect() and DisassemblerWin32X64::QuickDetect(),
+// i.e., "MZ" magic of DOS header, and "PE\0\0" magic of PE header.
+bool HasWin32Signature(ConstBufferView image) {
+  if (image.size() < sizeof(pe::ImageDOSHeader) || image[1] != 'Z')
+    return false;
+  constexpr uint8_t kPeMagic[] = {'P', 'E', 0, 0};
+  uint32_t pe_offset =
+      image.read<uint32_t>(offsetof(pe::ImageDOSHeader, e_lfanew));
+  return (pe_offset & 7) == 0 &&
+         pe_offset <= image.size() - sizeof(kPeMagic) &&
+         memcmp(image.begin() + pe_offset, kPeMagic, sizeof(kPeMagic)) == 0;
+}
+
 }  // namespace
 
 /******** Utility Functions ********/
@@ -60,15 +79,40 @@ base::Optional<Element> DetectElementFromDisassembler(ConstBufferView image) {
   return base::nullopt;
 }
 
+offset_t FindExecutableSignature(ConstBufferView image, offset_t pos) {
+  // All supported executables start with "MZ", and memchr() is vectorized.
+  const uint8_t* it = image.begin() + pos;
+  while (it < image.end()) {
+    it = static_cast<const uint8_t*>(
+        memchr(it, 'M', static_cast<size_t>(image.end() - it)));
+    if (!it)
+      break;
+    offset_t offset = static_cast<offset_t>(it - image.begin());
+    if (HasWin32Signature(image[{offset, image.size() - offset}]))
+      return offset;
+    ++it;
+  }
+  return static_cast<offset_t>(image.size());
+}
+
 /******** ProgramScanner ********/
 
-ElementFinder::ElementFinder(ConstBufferView image, ElementDetector&& detector)
-    : image_(image), detector_(std::move(detector)) {}
+ElementFinder::ElementFinder(ConstBufferView image,
+                             ElementDetector&& detector,
+                             ElementPrefilter&& prefilter)
+    : image_(image),
+      detector_(std::move(detector)),
+      prefilter_(std::move(prefilter)) {}
 
 ElementFinder::~ElementFinder() = default;
 
 base::Optional<Element> ElementFinder::GetNext() {
   for (; pos_ < image_.size(); ++pos_) {
+    if (prefilter_) {
+      pos_ = prefilter_(image_, pos_);
+      if (pos_ >= image_.size())
+        break;
+    }
     ConstBufferView test_image =
         ConstBufferView::FromRange(image_.begin() + pos_, image_.end());
     base::Optional<Element> element = detector_(test_image);
@@ -7,6 +7,7 @@
 
 #include <stddef.h>
 
+#include <functional>
 #include <memory>
 
 #include "squash/base/macros.h"
@@ -36,10 +37,24 @@ using ElementDetector =
 // Implementation of ElementDetector using disassemblers.
 base::Optional<Element> DetectElementFromDisassembler(ConstBufferView image);
 
+// Returns the first offset at or after |pos| in |image| where an associated
+// ElementDetector might detect an element, or |image.size()| if there is none.
+// This is meant to be much cheaper than calling the ElementDetector.
+using ElementPrefilter =
+    std::function<offset_t(ConstBufferView image, offset_t pos)>;
+
+// Implementation of ElementPrefilter for DetectElementFromDisassembler(),
+// which looks for the signatures of headers of all supported executables.
+offset_t FindExecutableSignature(ConstBufferView image, offset_t pos);
+
 // A class to scan through an image and iteratively detect elements.
 class ElementFinder {
  public:
-  ElementFinder(ConstBufferView image, ElementDetector&& detector);
+  // If |prefilter| is not null, |detector| is only called at offsets that it
+  // returns.
+  ElementFinder(ConstBufferView image,
+                ElementDetector&& detector,
+                ElementPrefilter&& prefilter = nullptr);
   ~ElementFinder();
 
   // Scans for the next executable using |detector|. Returns the next element
@@ -49,6 +64,7 @@ class ElementFinder {
  private:
   ConstBufferView image_;
   ElementDetector detector_;
+  ElementPrefilter prefilter_;
   offset_t pos_ = 0;
 
   DISALLOW_COPY_AND_ASSIGN(ElementFinder);
@@ -4,9 +4,13 @@
 
 #include "squash/zucchini/element_detection.h"
 
+#include <stdint.h>
+
+#include <utility>
 #include <vector>
 
 #include "squash/zucchini/buffer_view.h"
+#include "squash/zucchini/disassembler_win32.h"
 #include "gtest/gtest.h"
 
 namespace zucchini {
@@ -27,12 +31,23 @@ TEST(ElementDetectionTest, ElementFinderEmpty) {
   EXPECT_EQ(base::nullopt, finder.GetNext());
 }
 
-ElementVector TestElementFinder(std::vector<uint8_t> buffer) {
+// If |use_prefilter| is true, the detector is only called on nonzero bytes.
+ElementVector TestElementFinder(std::vector<uint8_t> buffer,
+                                bool use_prefilter = false) {
   ConstBufferView image(buffer.data(), buffer.size());
 
+  ElementPrefilter prefilter;
+  if (use_prefilter) {
+    prefilter = [](ConstBufferView image, offset_t pos) {
+      while (pos < image.size() && image[pos] == 0)
+        ++pos;
+      return pos;
+    };
+  }
   ElementFinder finder(
       image,
-      [image](ConstBufferView region) -> base::Optional<Element> {
+      [image,
+       use_prefilter](ConstBufferView region) -> base::Optional<Element> {
         EXPECT_GE(region.begin(), image.begin());
         EXPECT_LE(region.end(), image.end());
         EXPECT_GE(region.size(), 0U);
@@ -44,8 +59,10 @@ ElementVector TestElementFinder(std::vector<uint8_t> buffer) {
           return Element{{0, length},
                          static_cast<ExecutableType>(region[0])};
         }
+        EXPECT_FALSE(use_prefilter);
         return base::nullopt;
-      });
+      },
+      std::move(prefilter));
   std::vector<Element> elements;
   for (auto element = finder.GetNext(); element; element = finder.GetNext()) {
     elements.push_back(*element);
@@ -71,4 +88,54 @@ TEST(ElementDetectionTest, ElementFinder) {
       TestElementFinder({0, 1, 1, 0, 2, 2, 2}));
 }
 
+TEST(ElementDetectionTest, ElementFinderPrefilter) {
+  const std::vector<std::vector<uint8_t>> kBuffers = {
+      {}, {0, 0}, {1, 1}, {1, 1, 2, 2}, {0, 1, 1, 0}, {0, 1, 1, 0, 2, 2, 2}};
+  for (const std::vector<uint8_t>& buffer : kBuffers)
+    EXPECT_EQ(TestElementFinder(buffer), TestElementFinder(buffer, true));
+}
+
+TEST(ElementDetectionTest, FindExecutableSignature) {
+  std::vector<uint8_t> buffer(0x400, 0);
+  auto write_header = [&buffer](size_t pos, uint32_t pe_offset) {
+    buffer[pos] = 'M';
+    buffer[pos + 1] = 'Z';
+    for (int i = 0; i < 4; ++i)
+      buffer[pos + 0x3C + i] = static_cast<uint8_t>(pe_offset >> (8 * i));
+  };
+  auto write_pe_magic = [&buffer](size_t pos) {
+    buffer[pos] = 'P';
+    buffer[pos + 1] = 'E';
+  };
+  buffer[0x08] = 'M';
+  // Valid signature.
+  write_header(0x10, 0x40);
+  write_pe_magic(0x50);
+  // Misaligned PE header.
+  write_header(0x100, 0x44);
+  write_pe_magic(0x144);
+  // Missing PE magic.
+  write_header(0x200, 0x80);
+  // PE header out of bounds.
+  write_header(0x300, 0x100);
+  // Valid signature, with a DOS header that overlaps the previous one.
+  write_header(0x320, 0x40);
+  write_pe_magic(0x360);
+  ConstBufferView image(buffer.data(), buffer.size());
+
+  EXPECT_EQ(0x10U, FindExecutableSignature(image, 0));
+  EXPECT_EQ(0x10U, FindExecutableSignature(image, 0x10));
+  EXPECT_EQ(0x320U, FindExecutableSignature(image, 0x11));
+  EXPECT_EQ(0x400U, FindExecutableSignature(image, 0x321));
+  EXPECT_EQ(0x400U, FindExecutableSignature(image, 0x400));
+
+  // Signatures are found wherever disassemblers might detect an executable.
+  for (offset_t pos = 0; pos < image.size(); ++pos) {
+    ConstBufferView region = image[{pos, image.size() - pos}];
+    bool detected = DisassemblerWin32X86::QuickDetect(region) ||
+                    DisassemblerWin32X64::QuickDetect(region);
+    EXPECT_EQ(detected, FindExecutableSignature(image, pos) == pos);
+  }
+}
+
 }  // namespace zucchini
@@ -0,0 +1,149 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "squash/zucchini/element_sketch.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <limits>
+
+#include "squash/base/logging.h"
+#include "squash/zucchini/algorithm.h"
+
+namespace zucchini {
+
+namespace {
+
+// Number of high bits of hashes used to pick bins.
+constexpr uint32_t kBinBits = 6;
+static_assert(ElementSketch::kNumHashes == size_t(1) << kBinBits,
+              "kBinBits must match kNumHashes.");
+
+// Added to a borrowed hash for each bin it is moved by, so that empty bins
+// don't all hold the same value.
+constexpr uint32_t kBorrowedHashOffset = 0x9E3779B9U;
+
+}  // namespace
+
+/******** ElementSketch ********/
+
+constexpr size_t ElementSketch::kNumHashes;
+
+ElementSketch::ElementSketch() = default;
+
+ElementSketch::~ElementSketch() = default;
+
+bool ElementSketch::Compute(ConstBufferView region) {
+  DCHECK(!is_valid_);
+  if (region.size() < sizeof(uint16_t))
+    return false;
+
+  constexpr uint64_t kEmpty = std::numeric_limits<uint64_t>::max();
+  uint64_t min_hashes[kNumHashes];
+  std::fill(min_hashes, min_hashes + kNumHashes, kEmpty);
+  // Number of occurrences of each 2-byte sequence so far.
+  std::vector<uint32_t> counts(1 << 16);
+  const uint8_t* data = region.begin();
+  size_t bound = region.size() - sizeof(uint16_t) + 1;
+  for (size_t i = 0; i < bound; ++i) {
+    uint16_t sequence;
+    memcpy(&sequence, data + i, sizeof(sequence));
+    uint64_t item = (uint64_t(++counts[sequence]) << 16) | sequence;
+    uint64_t hash = MixBits(item);
+    uint64_t& min_hash = min_hashes[hash >> (64 - kBinBits)];
+    min_hash = std::min(min_hash, hash);
+  }
+
+  // At least one bin is non-empty. Bins are visited backward, twice, so that
+  // each empty bin can borrow from the next non-empty bin, wrapping around.
+  size_t next = kNumHashes;
+  for (size_t j = 2 * kNumHashes; j-- > 0;) {
+    size_t bin = j % kNumHashes;
+    if (min_hashes[bin] != kEmpty) {
+      hashes_[bin] = static_cast<uint32_t>(min_hashes[bin]);
+      next = j;
+    } else if (next != kNumHashes) {
+      hashes_[bin] = hashes_[next % kNumHashes] +
+                     static_cast<uint32_t>(next - j) * kBorrowedHashOffset;
+    }
+  }
+  is_valid_ = true;
+  return true;
+}
+
+double ElementSketch::Similarity(const ElementSketch& other) const {
+  DCHECK(IsValid() && other.IsValid());
+  size_t num_equal = 0;
+  for (size_t i = 0; i < kNumHashes; ++i)
+    num_equal += hashes_[i] == other.hashes_[i];
+  return static_cast<double>(num_equal) / kNumHashes;
+}
+
+/******** ElementSketchIndex ********/
+
+constexpr size_t ElementSketchIndex::kBandSize;
+constexpr size_t ElementSketchIndex::kNumBands;
+
+ElementSketchIndex::ElementSketchIndex(
+    const std::vector<Element>& elements,
+    const std::vector<ElementSketch>& sketches)
+    : elements_(elements), sketches_(sketches) {
+  DCHECK_EQ(elements_.size(), sketches_.size());
+  entries_.reserve(elements_.size() * kNumBands);
+  for (size_t i = 0; i < elements_.size(); ++i) {
+    DCHECK(sketches_[i].IsValid());
+    for (size_t band = 0; band < kNumBands; ++band)
+      entries_.emplace_back(BandKey(elements_[i].exe_type, sketches_[i], band),
+                            i);
+  }
+  std::sort(entries_.begin(), entries_.end());
+}
+
+ElementSketchIndex::~ElementSketchIndex() = default;
+
+std::vector<size_t> ElementSketchIndex::FindCandidates(
+    const Element& element,
+    const ElementSketch& sketch,
+    size_t max_candidates) const {
+  DCHECK(sketch.IsValid());
+  std::vector<size_t> candidates;
+  for (size_t band = 0; band < kNumBands; ++band) {
+    uint64_t key = BandKey(element.exe_type, sketch, band);
+    for (auto it = std::lower_bound(entries_.begin(), entries_.end(),
+                                    std::make_pair(key, size_t(0)));
+         it != entries_.end() && it->first == key; ++it) {
+      // Keys may collide across executable types.
+      if (elements_[it->second].exe_type == element.exe_type)
+        candidates.push_back(it->second);
+    }
+  }
+  SortAndUniquify(&candidates);
+  if (candidates.size() <= max_candidates)
+    return candidates;
+
+  std::vector<std::pair<double, size_t>> ranked(candidates.size());
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    ranked[i] = {-sketch.Similarity(sketches_[candidates[i]]), candidates[i]};
+  }
+  std::partial_sort(ranked.begin(), ranked.begin() + max_candidates,
+                    ranked.end());
+  candidates.resize(max_candidates);
+  for (size_t i = 0; i < max_candidates; ++i)
+    candidates[i] = ranked[i].second;
+  std::sort(candidates.begin(), candidates.end());
+  return candidates;
+}
+
+// static
+uint64_t ElementSketchIndex::BandKey(ExecutableType exe_type,
+                                     const ElementSketch& sketch,
+                                     size_t band) {
+  uint64_t key = MixBits((uint64_t(exe_type) << 32) | band);
+  for (size_t i = band * kBandSize; i < (band + 1) * kBandSize; ++i)
+    key = MixBits(key ^ sketch.hash(i));
+  return key;
+}
+
+}  // namespace zucchini
@@ -0,0 +1,89 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CHROME_INSTALLER_ZUCCHINI_ELEMENT_SKETCH_H_
+#define CHROME_INSTALLER_ZUCCHINI_ELEMENT_SKETCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utility>
+#include <vector>
+
+#include "squash/zucchini/buffer_view.h"
+#include "squash/zucchini/image_utils.h"
+
+namespace zucchini {
+
+// A MinHash sketch of the multiset of 2-byte sequences of a region, i.e., of
+// its BinaryDataHistogram, used to compare elements in time independent of
+// their sizes. The k-th occurrence of each sequence is hashed as a distinct
+// item, so sketches estimate the weighted Jaccard similarity of histograms,
+// which is (1 - d) / (1 + d) for histograms at distance d. A single hash
+// function is used: Its values are spread over |kNumHashes| bins by their high
+// bits, and each bin keeps its minimum ("one permutation hashing"). Empty bins
+// borrow the value of the next non-empty bin.
+class ElementSketch {
+ public:
+  static constexpr size_t kNumHashes = 64;
+
+  ElementSketch();
+  ~ElementSketch();
+
+  // Attempts to compute the sketch, returns true iff successful. Regions with
+  // less than 2 bytes are invalid.
+  bool Compute(ConstBufferView region);
+
+  bool IsValid() const { return is_valid_; }
+
+  // Returns the fraction of hashes that are equal between this sketch and
+  // |other|, which estimates the weighted Jaccard similarity of their
+  // histograms. Both sketches must be valid.
+  double Similarity(const ElementSketch& other) const;
+
+  uint32_t hash(size_t i) const { return hashes_[i]; }
+
+ private:
+  bool is_valid_ = false;
+  uint32_t hashes_[kNumHashes] = {};
+};
+
+// Locality-sensitive hashing index of sketches of "old" elements: The hashes
+// of each sketch are split into bands of |kBandSize| consecutive hashes, and
+// elements that have a band, and the executable type, in common with a "new"
+// element are its candidates. Elements whose sketches have similarity s are
+// candidates with probability 1 - (1 - s^kBandSize)^(kNumHashes / kBandSize).
+class ElementSketchIndex {
+ public:
+  static constexpr size_t kBandSize = 4;
+  static constexpr size_t kNumBands = ElementSketch::kNumHashes / kBandSize;
+
+  // Indexes |elements| with their respective |sketches|, which must be valid.
+  // Both are required to remain valid for the lifetime of the object.
+  ElementSketchIndex(const std::vector<Element>& elements,
+                     const std::vector<ElementSketch>& sketches);
+  ~ElementSketchIndex();
+
+  // Returns the indexes of up to |max_candidates| candidates for |element|
+  // with valid |sketch|, preferring those whose sketches are most similar, and
+  // then those with lower indexes. Indexes are returned in increasing order.
+  std::vector<size_t> FindCandidates(const Element& element,
+                                     const ElementSketch& sketch,
+                                     size_t max_candidates) const;
+
+ private:
+  // Returns the key of band |band| of |sketch| for executable type |exe_type|.
+  static uint64_t BandKey(ExecutableType exe_type,
+                          const ElementSketch& sketch,
+                          size_t band);
+
+  const std::vector<Element>& elements_;
+  const std::vector<ElementSketch>& sketches_;
+  // Band keys of all elements, with their element indexes, sorted.
+  std::vector<std::pair<uint64_t, size_t>> entries_;
+};
+
+}  // namespace zucchini
+
+#endif  // CHROME_INSTALLER_ZUCCHINI_ELEMENT_SKETCH_H_
@@ -0,0 +1,117 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "squash/zucchini/element_sketch.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace zucchini {
+
+namespace {
+
+// Returns |size| pseudo-random bytes in [|base|, |base| + 64), so that data
+// with different |base| have no 2-byte sequence in common.
+std::vector<uint8_t> MakeRandomData(size_t size,
+                                    uint8_t base,
+                                    std::mt19937* rng) {
+  std::vector<uint8_t> data(size);
+  for (uint8_t& value : data)
+    value = static_cast<uint8_t>(base + (*rng)() % 64);
+  return data;
+}
+
+// Returns |data| with about one byte in |period| replaced by a pseudo-random
+// byte of the same range of 64 values.
+std::vector<uint8_t> Mutate(std::vector<uint8_t> data,
+                            size_t period,
+                            std::mt19937* rng) {
+  for (size_t i = (*rng)() % period; i < data.size();
+       i += 1 + (*rng)() % period) {
+    data[i] = static_cast<uint8_t>((data[i] & 0xC0) | (*rng)() % 64);
+  }
+  return data;
+}
+
+ElementSketch MakeSketch(const std::vector<uint8_t>& data) {
+  ElementSketch sketch;
+  EXPECT_TRUE(sketch.Compute({data.data(), data.size()}));
+  return sketch;
+}
+
+}  // namespace
+
+TEST(ElementSketchTest, Compute) {
+  constexpr uint8_t kTestData[] = {'a', 'b', 'a', 'b'};
+  for (size_t size = 0; size <= sizeof(kTestData); ++size) {
+    ElementSketch sketch;
+    EXPECT_EQ(size >= 2, sketch.Compute({kTestData, size}));
+    EXPECT_EQ(size >= 2, sketch.IsValid());
+  }
+}
+
+TEST(ElementSketchTest, Similarity) {
+  // "aba" and "bab" have the same histogram.
+  EXPECT_EQ(1.0, MakeSketch({'a', 'b', 'a'}).Similarity(
+                     MakeSketch({'b', 'a', 'b'})));
+  EXPECT_EQ(0.0, MakeSketch({'a', 'b', 'a', 'b', 'a'})
+                     .Similarity(MakeSketch({'c', 'd', 'c', 'd', 'c'})));
+
+  std::mt19937 rng(0);
+  std::vector<uint8_t> data = MakeRandomData(1 << 16, 0, &rng);
+  ElementSketch sketch = MakeSketch(data);
+  EXPECT_EQ(1.0, sketch.Similarity(sketch));
+  double similarity = sketch.Similarity(MakeSketch(Mutate(data, 100, &rng)));
+  EXPECT_GT(similarity, 0.8);
+  EXPECT_LT(similarity, 1.0);
+  EXPECT_EQ(0.0,
+            sketch.Similarity(MakeSketch(MakeRandomData(1 << 16, 64, &rng))));
+}
+
+TEST(ElementSketchIndexTest, FindCandidates) {
+  std::mt19937 rng(0);
+  std::vector<uint8_t> data1 = MakeRandomData(1 << 16, 0, &rng);
+  std::vector<uint8_t> data2 = MakeRandomData(1 << 16, 64, &rng);
+  const std::vector<Element> old_elements = {
+      Element({0, 100}, kExeTypeWin32X86), Element({0, 100}, kExeTypeWin32X64),
+      Element({0, 100}, kExeTypeWin32X86), Element({0, 100}, kExeTypeWin32X86),
+      Element({0, 100}, kExeTypeWin32X86)};
+  const std::vector<ElementSketch> old_sketches = {
+      MakeSketch(data1), MakeSketch(data1), MakeSketch(data2),
+      MakeSketch(data1), MakeSketch(Mutate(data1, 100, &rng))};
+  ElementSketchIndex index(old_elements, old_sketches);
+
+  const Element new_x86({0, 100}, kExeTypeWin32X86);
+  const Element new_x64({0, 100}, kExeTypeWin32X64);
+  const Element new_elf({0, 100}, kExeTypeElfX86);
+  ElementSketch new_sketch = MakeSketch(Mutate(data1, 100, &rng));
+
+  // Only similar elements of the same type are candidates.
+  EXPECT_EQ(std::vector<size_t>({0, 3, 4}),
+            index.FindCandidates(new_x86, new_sketch, 8));
+  EXPECT_EQ(std::vector<size_t>({1}),
+            index.FindCandidates(new_x64, new_sketch, 8));
+  EXPECT_EQ(std::vector<size_t>({2}),
+            index.FindCandidates(new_x86, MakeSketch(data2), 8));
+  EXPECT_TRUE(index.FindCandidates(new_elf, new_sketch, 8).empty());
+  EXPECT_TRUE(
+      index
+          .FindCandidates(new_x86,
+                          MakeSketch(MakeRandomData(1 << 16, 128, &rng)), 8)
+          .empty());
+
+  // The most similar candidates are kept, then those with lower indexes.
+  EXPECT_EQ(std::vector<size_t>({0, 3}),
+            index.FindCandidates(new_x86, MakeSketch(data1), 2));
+  EXPECT_EQ(std::vector<size_t>({0}),
+            index.FindCandidates(new_x86, MakeSketch(data1), 1));
+  EXPECT_TRUE(index.FindCandidates(new_x86, new_sketch, 0).empty());
+}
+
+}  // namespace zucchini
@@ -5,18 +5,41 @@
 #include "squash/zucchini/encoded_view.h"
 
 #include <algorithm>
+#include <limits>
 #include <utility>
 
 #include "squash/base/logging.h"
+#include "squash/zucchini/target_pool.h"
 
 namespace zucchini {
 
-EncodedView::EncodedView(const ImageIndex& image_index, const TargetPool* target_pool)
+EncodedView::PoolInfo::PoolInfo() = default;
+EncodedView::PoolInfo::PoolInfo(PoolInfo&&) = default;
+EncodedView::PoolInfo::~PoolInfo() = default;
+
+EncodedView::EncodedView(const ImageIndex& image_index, Mode mode)
     : image_index_(image_index),
-      target_pool_(target_pool) {}
+      pool_infos_(image_index.PoolCount()),
+      mode_(mode),
+      num_unlabeled_pools_(image_index.PoolCount()) {
+  if (mode_ != Mode::kMaterialized)
+    return;
+  // Raw bytes are written first, then overwritten by references, whose first
+  // bytes are projected once labels of their pool are set.
+  ConstBufferView image = image_index_.image();
+  projections_.assign(image.begin(), image.end());
+  for (const ReferenceSet& ref_set : image_index_.reference_sets()) {
+    for (offset_t location : ref_set.locations()) {
+      auto it = projections_.begin() + location;
+      std::fill(it, it + ref_set.width(), kReferencePaddingProjection);
+    }
+  }
+  is_materialized_ = num_unlabeled_pools_ == 0;
+}
 EncodedView::~EncodedView() = default;
 
-EncodedView::value_type EncodedView::Projection(offset_t location) const {
+EncodedView::value_type EncodedView::ComputeProjection(
+    offset_t location) const {
   DCHECK_LT(location, image_index_.size());
 
   // Find out what lies at |location|.
@@ -28,25 +51,24 @@ EncodedView::value_type EncodedView::Projection(offset_t location) const {
     return image_index_.GetRawValue(location);
   }
 
-  // |location| points into a Reference.
-  const ReferenceSet& ref_set = image_index_.refs(type);
-  Reference ref = ref_set.at(location);
-  DCHECK_GE(location, ref.location);
-  DCHECK_LT(location, ref.location + ref_set.width());
-
-  // |location| is not the first byte of the reference.
-  if (location != ref.location) {
+  // |location| points into a Reference, but is not its first byte.
+  if (!image_index_.IsToken(location)) {
     // Trailing bytes of a reference are all projected to the same value.
     return kReferencePaddingProjection;
   }
 
-  PoolTag pool_tag = ref_set.pool_tag();
-
-  key_t target_key = target_pool_->KeyForOffset(ref.target);
+  return ReferenceProjection(type, image_index_.refs(type).pool_tag(),
+                             image_index_.LookupTargetKey(location));
+}
 
+EncodedView::value_type EncodedView::ReferenceProjection(
+    TypeTag type,
+    PoolTag pool,
+    key_t target_key) const {
   // Targets with an associated Label will use its Label index in projection.
-  DCHECK_EQ(target_pool_->size(), labels_.size());
-  uint32_t label = labels_[target_key];
+  const PoolInfo& pool_info = pool_infos_[pool.value()];
+  DCHECK_EQ(image_index_.pool(pool).size(), pool_info.labels.size());
+  uint32_t label = pool_info.labels[target_key];
 
   // Projection is done on (|target|, |type|), shifted by a constant value to
   // avoid collisions with raw content.
@@ -57,15 +79,42 @@ EncodedView::value_type EncodedView::Projection(offset_t location) const {
 }
 
 size_t EncodedView::Cardinality() const {
-  return bound_ * image_index_.TypeCount() + kBaseReferenceProjection;
+  size_t max_bound = 0;
+  for (const PoolInfo& pool_info : pool_infos_)
+    max_bound = std::max(max_bound, pool_info.bound);
+  return max_bound * image_index_.TypeCount() + kBaseReferenceProjection;
 }
 
-void EncodedView::SetLabels(std::vector<uint32_t>&& labels,
+void EncodedView::SetLabels(PoolTag pool,
+                            std::vector<uint32_t>&& labels,
                             size_t bound) {
-  DCHECK_EQ(labels.size(), target_pool_->size());
+  DCHECK_LT(pool.value(), pool_infos_.size());
+  DCHECK_EQ(labels.size(), image_index_.pool(pool).size());
+  DCHECK_GE(bound, 1U);
   DCHECK(labels.empty() || *max_element(labels.begin(), labels.end()) < bound);
-  labels_ = std::move(labels);
-  bound_ = bound;
+  PoolInfo& pool_info = pool_infos_[pool.value()];
+  if (pool_info.bound == 0)
+    --num_unlabeled_pools_;
+  pool_info.labels = std::move(labels);
+  pool_info.bound = bound;
+  if (mode_ == Mode::kMaterialized)
+    Materialize(pool);
+}
+
+void EncodedView::Materialize(PoolTag pool) {
+  DCHECK_LE(Cardinality(), std::numeric_limits<uint32_t>::max());
+  // Only first bytes of references change, and other bytes were written by the
+  // constructor.
+  for (const ReferenceSet& ref_set : image_index_.reference_sets()) {
+    if (ref_set.pool_tag() != pool)
+      continue;
+    TypeTag type = ref_set.type_tag();
+    for (size_t i = 0; i < ref_set.size(); ++i) {
+      projections_[ref_set.locations()[i]] = static_cast<uint32_t>(
+          ReferenceProjection(type, pool, ref_set.target_keys()[i]));
+    }
+  }
+  is_materialized_ = num_unlabeled_pools_ == 0;
 }
 
 }  // namespace zucchini
@@ -11,14 +11,13 @@
 #include <iterator>
 #include <vector>
 
+#include "squash/base/logging.h"
 #include "squash/base/macros.h"
 #include "squash/zucchini/image_index.h"
 #include "squash/zucchini/image_utils.h"
 
 namespace zucchini {
 
-class TargetPool;
-
 constexpr size_t kReferencePaddingProjection = 256;
 constexpr size_t kBaseReferenceProjection = 257;
 
@@ -113,19 +112,58 @@ class EncodedView {
     difference_type pos_;
   };
 
+  // A contiguous range over materialized projections.
+  class ProjectionRange {
+   public:
+    using value_type = uint32_t;
+    using size_type = offset_t;
+    using const_iterator = const uint32_t*;
+
+    ProjectionRange(const uint32_t* first, size_type size)
+        : first_(first), size_(size) {}
+
+    value_type operator[](size_type pos) const { return first_[pos]; }
+    size_type size() const { return size_; }
+    const_iterator begin() const { return first_; }
+    const_iterator end() const { return first_ + size_; }
+
+   private:
+    const uint32_t* first_;
+    size_type size_;
+  };
+
+  // Policy to evaluate projections.
+  enum class Mode {
+    // Projection() is computed on each access, which needs binary searches
+    // for reference bytes, but no extra memory.
+    kOnDemand,
+    // Projections of all locations are held in a buffer of 4 bytes per
+    // location, which SetLabels() updates for references of its pool, then
+    // accessed as plain memory.
+    kMaterialized,
+  };
+
   using value_type = size_t;
   using size_type = offset_t;
   using difference_type = ptrdiff_t;
   using const_iterator = Iterator;
 
   // |image_index| is the annotated image being adapted, and is required to
-  // remain valid for the lifetime of the object.
-  explicit EncodedView(const ImageIndex& image_index, const TargetPool* target_pool);
+  // remain valid for the lifetime of the object. |mode| specifies how
+  // projections are evaluated. Labels of each pool must be set with
+  // SetLabels() before projections of its references are used.
+  explicit EncodedView(const ImageIndex& image_index,
+                       Mode mode = Mode::kOnDemand);
   ~EncodedView();
 
   // Projects |location| to a scalar value that describes the content at a
   // higher level of abstraction.
-  value_type Projection(offset_t location) const;
+  value_type Projection(offset_t location) const {
+    DCHECK_LT(location, size());
+    if (is_materialized_)
+      return projections_[location];
+    return ComputeProjection(location);
+  }
 
   bool IsToken(offset_t location) const {
     return image_index_.IsToken(location);
@@ -135,11 +173,24 @@ class EncodedView {
   // values returned by Projection().
   value_type Cardinality() const;
 
-  // Associates |labels| to targets for a given |pool|, replacing previous
-  // association. Values in |labels| must be smaller than |bound|.
-  void SetLabels(std::vector<uint32_t>&& labels, size_t bound);
+  // Associates |labels| to targets of the pool identified by |pool|, replacing
+  // previous association. Values in |labels| must be smaller than |bound|. In
+  // Mode::kMaterialized, this also recomputes projections of references whose
+  // targets belong to |pool|.
+  void SetLabels(PoolTag pool, std::vector<uint32_t>&& labels, size_t bound);
   const ImageIndex& image_index() const { return image_index_; }
 
+  // Returns true if projections are held in memory, in which case
+  // projections() can be used. In Mode::kMaterialized, this is the case once
+  // labels of all pools are set.
+  bool IsMaterialized() const { return is_materialized_; }
+
+  // Returns the range of materialized projections. Requires IsMaterialized().
+  ProjectionRange projections() const {
+    DCHECK(IsMaterialized());
+    return {projections_.data(), size()};
+  }
+
   // Range functions.
   size_type size() const { return size_type(image_index_.size()); }
   const_iterator begin() const {
@@ -150,10 +201,42 @@ class EncodedView {
   }
 
  private:
+  // Computes the projection of |location| from |image_index_|.
+  value_type ComputeProjection(offset_t location) const;
+
+  // Returns the projection of the first byte of a reference of type |type|
+  // pointing to the target identified by |target_key| in the pool |pool|.
+  value_type ReferenceProjection(TypeTag type,
+                                 PoolTag pool,
+                                 key_t target_key) const;
+
+  // Computes projections of references whose targets belong to |pool| into
+  // |projections_|.
+  void Materialize(PoolTag pool);
+
+  struct PoolInfo {
+    PoolInfo();
+    PoolInfo(PoolInfo&&);
+    ~PoolInfo();
+
+    // Translates target keys of the pool to labels.
+    std::vector<uint32_t> labels;
+    // Upper bound on |labels|, or 0 if labels were not set yet.
+    size_t bound = 0;
+  };
+
   const ImageIndex& image_index_;
-  std::vector<uint32_t> labels_;
-  size_t bound_ = 0;
-  const TargetPool* target_pool_;
+  // Labels of each pool, indexed by pool tag value.
+  std::vector<PoolInfo> pool_infos_;
+  const Mode mode_;
+
+  // Projection of each location, only used in Mode::kMaterialized. Reference
+  // bytes are projected to |kReferencePaddingProjection| until labels of
+  // their pool are set.
+  std::vector<uint32_t> projections_;
+  // Number of pools whose labels were not set yet.
+  size_t num_unlabeled_pools_;
+  bool is_materialized_ = false;
 
   DISALLOW_COPY_AND_ASSIGN(EncodedView);
 };
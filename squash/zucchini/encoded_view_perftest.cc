@@ -0,0 +1,145 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "squash/zucchini/encoded_view.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "gtest/gtest.h"
+#include "squash/zucchini/disassembler.h"
+#include "squash/zucchini/element_detection.h"
+#include "squash/zucchini/image_index.h"
+#include "squash/zucchini/mapped_file.h"
+#include "squash/zucchini/suffix_array.h"
+
+namespace zucchini {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+boost::filesystem::path MakeTestPath(const std::string& filename) {
+  return boost::filesystem::path("squash") / "testdata" / filename;
+}
+
+// Holds the data needed to create encoded views of a test file.
+struct TestImage {
+  explicit TestImage(const std::string& filename)
+      : file(MakeTestPath(filename)), image_index(file.region()) {}
+
+  // Returns true on success.
+  bool Initialize() {
+    if (!file.IsValid())
+      return false;
+    std::unique_ptr<Disassembler> disasm =
+        MakeDisassemblerWithoutFallback(file.region());
+    return disasm && image_index.Initialize(disasm.get());
+  }
+
+  MappedFileReader file;
+  ImageIndex image_index;
+};
+
+// Sets labels of the first iteration of CreateEquivalenceMap(), where no
+// target is labeled, for each pool of |view|.
+void SetNoLabels(EncodedView* view) {
+  const ImageIndex& image_index = view->image_index();
+  for (size_t i = 0; i < image_index.PoolCount(); ++i) {
+    PoolTag pool_tag(static_cast<uint8_t>(i));
+    view->SetLabels(
+        pool_tag, std::vector<uint32_t>(image_index.pool(pool_tag).size()), 1);
+  }
+}
+
+// Looks up every token of |new_view| in |old_sa| the way
+// EquivalenceMap::CreateCandidates() does, where |old_str| is the range of
+// projections |old_sa| was built from, and |new_str| is the range of
+// projections of |new_view|. Returns the number of lookups.
+template <class StrRng>
+size_t LookupAllTokens(const std::vector<offset_t>& old_sa,
+                       const StrRng& old_str,
+                       const EncodedView& new_view,
+                       const StrRng& new_str) {
+  size_t count = 0;
+  for (offset_t offset = 0; offset < new_view.size(); ++offset) {
+    if (!new_view.IsToken(offset))
+      continue;
+    SuffixLowerBound(old_sa, std::begin(old_str), std::begin(new_str) + offset,
+                     std::end(new_str));
+    ++count;
+  }
+  return count;
+}
+
+}  // namespace
+
+// Compares the cost of suffix sort and suffix array lookups on encoded views
+// whose projections are computed on demand and on views whose projections are
+// materialized, along with the memory used by the latter.
+TEST(EncodedViewPerfTest, Materialized) {
+  TestImage old_image("chrome64_1.exe");
+  TestImage new_image("chrome64_2.exe");
+  ASSERT_TRUE(old_image.Initialize());
+  ASSERT_TRUE(new_image.Initialize());
+
+  EncodedView old_on_demand_view(old_image.image_index);
+  EncodedView new_on_demand_view(new_image.image_index);
+  SetNoLabels(&old_on_demand_view);
+  SetNoLabels(&new_on_demand_view);
+
+  // Projections are computed by the constructor and by SetLabels().
+  auto start = Clock::now();
+  EncodedView old_materialized_view(old_image.image_index,
+                                    EncodedView::Mode::kMaterialized);
+  EncodedView new_materialized_view(new_image.image_index,
+                                    EncodedView::Mode::kMaterialized);
+  SetNoLabels(&old_materialized_view);
+  SetNoLabels(&new_materialized_view);
+  std::chrono::duration<double> materialize_time = Clock::now() - start;
+  std::cout << "size " << old_on_demand_view.size() << " + "
+            << new_on_demand_view.size() << ", projection buffers "
+            << (old_materialized_view.size() + new_materialized_view.size()) *
+                   sizeof(uint32_t)
+            << " bytes, SetLabels " << materialize_time.count() << " s"
+            << std::endl;
+
+  start = Clock::now();
+  std::vector<offset_t> on_demand_sa = MakeSuffixArray<InducedSuffixSort>(
+      old_on_demand_view, old_on_demand_view.Cardinality());
+  std::chrono::duration<double> on_demand_sort_time = Clock::now() - start;
+
+  start = Clock::now();
+  std::vector<offset_t> materialized_sa = MakeSuffixArray<InducedSuffixSort>(
+      old_materialized_view.projections(),
+      old_materialized_view.Cardinality());
+  std::chrono::duration<double> materialized_sort_time = Clock::now() - start;
+  EXPECT_EQ(on_demand_sa, materialized_sa);
+  std::cout << "InducedSuffixSort: on demand " << on_demand_sort_time.count()
+            << " s, materialized " << materialized_sort_time.count() << " s"
+            << std::endl;
+
+  start = Clock::now();
+  size_t count = LookupAllTokens(on_demand_sa, old_on_demand_view,
+                                 new_on_demand_view, new_on_demand_view);
+  std::chrono::duration<double> on_demand_lookup_time = Clock::now() - start;
+
+  start = Clock::now();
+  LookupAllTokens(materialized_sa, old_materialized_view.projections(),
+                  new_materialized_view,
+                  new_materialized_view.projections());
+  std::chrono::duration<double> materialized_lookup_time =
+      Clock::now() - start;
+  std::cout << count << " x SuffixLowerBound: on demand "
+            << on_demand_lookup_time.count() << " s, materialized "
+            << materialized_lookup_time.count() << " s" << std::endl;
+}
+
+}  // namespace zucchini
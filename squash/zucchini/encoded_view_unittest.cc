@@ -4,6 +4,7 @@
 
 #include "squash/zucchini/encoded_view.h"
 
+#include <algorithm>
 #include <iterator>
 #include <numeric>
 #include <vector>
@@ -199,4 +200,33 @@ TEST_F(EncodedViewTest, Labeled) {
   CheckView(expected, encoded_view);
 }
 
+TEST_F(EncodedViewTest, Materialized) {
+  EncodedView on_demand_view(image_index_);
+  EncodedView materialized_view(image_index_,
+                                EncodedView::Mode::kMaterialized);
+  EXPECT_FALSE(on_demand_view.IsMaterialized());
+  EXPECT_FALSE(materialized_view.IsMaterialized());
+
+  // Projections are refreshed every time labels change, once labels of all
+  // pools are set.
+  materialized_view.SetLabels(PoolTag(1), {0, 0}, 1);
+  on_demand_view.SetLabels(PoolTag(1), {0, 0}, 1);
+  EXPECT_FALSE(materialized_view.IsMaterialized());
+  for (const std::vector<uint32_t>& labels :
+       {std::vector<uint32_t>{0, 0, 0, 0}, std::vector<uint32_t>{0, 2, 1, 2}}) {
+    on_demand_view.SetLabels(PoolTag(0), std::vector<uint32_t>(labels), 3);
+    materialized_view.SetLabels(PoolTag(0), std::vector<uint32_t>(labels), 3);
+    EXPECT_FALSE(on_demand_view.IsMaterialized());
+    ASSERT_TRUE(materialized_view.IsMaterialized());
+
+    std::vector<size_t> expected(on_demand_view.begin(), on_demand_view.end());
+    CheckView(expected, materialized_view);
+
+    EncodedView::ProjectionRange projections = materialized_view.projections();
+    EXPECT_EQ(materialized_view.size(), projections.size());
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(),
+                           projections.begin(), projections.end()));
+  }
+}
+
 }  // namespace zucchini
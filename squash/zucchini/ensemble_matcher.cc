@@ -0,0 +1,158 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "squash/zucchini/ensemble_matcher.h"
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+
+#include "squash/base/logging.h"
+#include "squash/zucchini/binary_data_histogram.h"
+#include "squash/zucchini/element_detection.h"
+#include "squash/zucchini/element_sketch.h"
+#include "squash/zucchini/thread_pool.h"
+
+namespace zucchini {
+
+namespace {
+
+// Maximum number of "old" elements shortlisted by sketches for each "new"
+// element, which are then ranked by histogram distance.
+constexpr size_t kMaxCandidates = 8;
+
+// Returns the sketches of |elements| found in |image|, computed on |pool|.
+std::vector<ElementSketch> ComputeSketches(ConstBufferView image,
+                                           const std::vector<Element>& elements,
+                                           ThreadPool* pool) {
+  std::vector<ElementSketch> sketches(elements.size());
+  pool->ParallelFor(elements.size(), [&](size_t i) {
+    bool computed = sketches[i].Compute(image[elements[i].region()]);
+    DCHECK(computed);
+  });
+  return sketches;
+}
+
+// Returns the histograms of |elements| found in |image| for which |needed| is
+// true, computed on |pool|. Other histograms are left invalid.
+std::unique_ptr<BinaryDataHistogram[]> ComputeHistograms(
+    ConstBufferView image,
+    const std::vector<Element>& elements,
+    const std::vector<bool>& needed,
+    ThreadPool* pool) {
+  std::unique_ptr<BinaryDataHistogram[]> histograms(
+      new BinaryDataHistogram[elements.size()]);
+  pool->ParallelFor(elements.size(), [&](size_t i) {
+    if (!needed[i])
+      return;
+    bool computed = histograms[i].Compute(image[elements[i].region()]);
+    DCHECK(computed);
+  });
+  return histograms;
+}
+
+}  // namespace
+
+std::vector<Element> FindElements(ConstBufferView image) {
+  std::vector<Element> elements;
+  ElementFinder finder(image, DetectElementFromDisassembler,
+                       FindExecutableSignature);
+  for (auto element = finder.GetNext(); element.has_value();
+       element = finder.GetNext()) {
+    elements.push_back(*element);
+  }
+  return elements;
+}
+
+std::vector<ElementMatch> MatchElements(
+    ConstBufferView old_image,
+    const std::vector<Element>& old_elements,
+    ConstBufferView new_image,
+    const std::vector<Element>& new_elements,
+    size_t num_threads) {
+  if (num_threads == 0)
+    num_threads = ThreadPool::HardwareConcurrency();
+  ThreadPool pool(std::max<size_t>(
+      1, std::min(num_threads,
+                  std::max(old_elements.size(), new_elements.size()))));
+
+  // Shortlist candidates of each "new" element by sketches. If there are none,
+  // fall back to all "old" elements of the same type.
+  std::vector<ElementSketch> old_sketches =
+      ComputeSketches(old_image, old_elements, &pool);
+  std::vector<ElementSketch> new_sketches =
+      ComputeSketches(new_image, new_elements, &pool);
+  ElementSketchIndex index(old_elements, old_sketches);
+  std::vector<std::vector<size_t>> candidates(new_elements.size());
+  std::vector<bool> old_needed(old_elements.size());
+  std::vector<bool> new_needed(new_elements.size());
+  for (size_t new_index = 0; new_index < new_elements.size(); ++new_index) {
+    const Element& new_element = new_elements[new_index];
+    candidates[new_index] = index.FindCandidates(
+        new_element, new_sketches[new_index], kMaxCandidates);
+    if (candidates[new_index].empty()) {
+      for (size_t old_index = 0; old_index < old_elements.size();
+           ++old_index) {
+        if (old_elements[old_index].exe_type == new_element.exe_type)
+          candidates[new_index].push_back(old_index);
+      }
+      if (!candidates[new_index].empty()) {
+        LOG(INFO) << "No sketch candidate for element at "
+                  << new_element.offset << " of new image, ranking all "
+                  << candidates[new_index].size()
+                  << " elements of the same type.";
+      }
+    }
+    for (size_t old_index : candidates[new_index])
+      old_needed[old_index] = true;
+    new_needed[new_index] = !candidates[new_index].empty();
+  }
+
+  // Rank candidates by histogram distance, preferring lower indexes on ties.
+  std::unique_ptr<BinaryDataHistogram[]> old_histograms =
+      ComputeHistograms(old_image, old_elements, old_needed, &pool);
+  std::unique_ptr<BinaryDataHistogram[]> new_histograms =
+      ComputeHistograms(new_image, new_elements, new_needed, &pool);
+  std::vector<size_t> best_old_indexes(new_elements.size(),
+                                       old_elements.size());
+  std::vector<double> best_distances(
+      new_elements.size(), std::numeric_limits<double>::infinity());
+  pool.ParallelFor(new_elements.size(), [&](size_t new_index) {
+    for (size_t old_index : candidates[new_index]) {
+      double distance =
+          new_histograms[new_index].Distance(old_histograms[old_index]);
+      if (distance < best_distances[new_index]) {
+        best_old_indexes[new_index] = old_index;
+        best_distances[new_index] = distance;
+      }
+    }
+  });
+
+  std::vector<ElementMatch> matches;
+  for (size_t new_index = 0; new_index < new_elements.size(); ++new_index) {
+    const Element& new_element = new_elements[new_index];
+    size_t best_old_index = best_old_indexes[new_index];
+    if (best_old_index == old_elements.size()) {
+      LOG(INFO) << "No match for element at " << new_element.offset
+                << " of new image.";
+      continue;
+    }
+    const Element& old_element = old_elements[best_old_index];
+    LOG(INFO) << "Match element at " << old_element.offset << " (size "
+              << old_element.size << ") of old image with element at "
+              << new_element.offset << " (size " << new_element.size
+              << ") of new image, distance " << best_distances[new_index]
+              << ", sketch similarity "
+              << new_sketches[new_index].Similarity(
+                     old_sketches[best_old_index])
+              << ", among " << candidates[new_index].size()
+              << " candidate(s).";
+    matches.push_back({old_element, new_element});
+  }
+  return matches;
+}
+
+}  // namespace zucchini
@@ -0,0 +1,44 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CHROME_INSTALLER_ZUCCHINI_ENSEMBLE_MATCHER_H_
+#define CHROME_INSTALLER_ZUCCHINI_ENSEMBLE_MATCHER_H_
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "squash/zucchini/buffer_view.h"
+#include "squash/zucchini/image_utils.h"
+
+namespace zucchini {
+
+// An ensemble is an archive that embeds executables, e.g., an installer. Each
+// executable is an element, which is patched against the most similar element
+// of "old" ensemble, while the rest of "new" ensemble is patched in raw mode.
+
+// Returns all elements detected in |image| by DetectElementFromDisassembler(),
+// in increasing order of offsets.
+std::vector<Element> FindElements(ConstBufferView image);
+
+// Pairs each element of |new_elements|, found in |new_image|, with an element
+// of |old_elements|, found in |old_image|, that has the same executable type:
+// "Old" elements are shortlisted by ElementSketchIndex, or all "old" elements
+// of the same type if none is, and the one with the nearest
+// BinaryDataHistogram is picked. Elements of "new" image without such element
+// of "old" image are left unmatched. Returns matches in the order of
+// |new_elements|, and logs them. Several "new" elements may be matched with
+// the same "old" element. Sketches, histograms and distances are computed
+// using |num_threads| threads, or ThreadPool::HardwareConcurrency() if 0,
+// which doesn't affect the result.
+std::vector<ElementMatch> MatchElements(
+    ConstBufferView old_image,
+    const std::vector<Element>& old_elements,
+    ConstBufferView new_image,
+    const std::vector<Element>& new_elements,
+    size_t num_threads);
+
+}  // namespace zucchini
+
+#endif  // CHROME_INSTALLER_ZUCCHINI_ENSEMBLE_MATCHER_H_
@@ -0,0 +1,90 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "squash/zucchini/ensemble_matcher.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace zucchini {
+
+namespace {
+
+// Returns true if |a| and |b| match the same elements.
+bool ElementMatchesEqual(const std::vector<ElementMatch>& a,
+                         const std::vector<ElementMatch>& b) {
+  if (a.size() != b.size())
+    return false;
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (!(a[i].old_element == b[i].old_element) ||
+        !(a[i].new_element == b[i].new_element)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+TEST(EnsembleMatcherTest, MatchElements) {
+  // Elements are made of repeated patterns, so the nearest histogram is that
+  // of the same pattern.
+  std::vector<uint8_t> old_image;
+  for (int i = 0; i < 16; ++i)
+    old_image.insert(old_image.end(), {1, 2, 3, 4});
+  for (int i = 0; i < 16; ++i)
+    old_image.insert(old_image.end(), {5, 6, 7, 8});
+  for (int i = 0; i < 16; ++i)
+    old_image.insert(old_image.end(), {1, 2, 3, 4});
+  std::vector<uint8_t> new_image;
+  for (int i = 0; i < 20; ++i)
+    new_image.insert(new_image.end(), {5, 6, 7, 8});
+  for (int i = 0; i < 20; ++i)
+    new_image.insert(new_image.end(), {1, 2, 3, 4});
+  for (int i = 0; i < 20; ++i)
+    new_image.insert(new_image.end(), {9, 9, 9, 9});
+
+  const Element old_x86_a({0, 64}, kExeTypeWin32X86);
+  const Element old_x86_b({64, 64}, kExeTypeWin32X86);
+  const Element old_x64_a({128, 64}, kExeTypeWin32X64);
+  const Element new_x86_b({0, 80}, kExeTypeWin32X86);
+  const Element new_x86_a({80, 80}, kExeTypeWin32X86);
+  const Element new_x64_a({80, 80}, kExeTypeWin32X64);
+  const Element new_x64_c({160, 80}, kExeTypeWin32X64);
+  ConstBufferView old_view(old_image.data(), old_image.size());
+  ConstBufferView new_view(new_image.data(), new_image.size());
+
+  // The number of threads doesn't affect the result.
+  for (size_t num_threads : {1, 2, 0}) {
+    EXPECT_TRUE(MatchElements(old_view, {}, new_view, {new_x86_b, new_x86_a},
+                              num_threads)
+                    .empty());
+    EXPECT_TRUE(MatchElements(old_view, {old_x86_a, old_x86_b}, new_view, {},
+                              num_threads)
+                    .empty());
+
+    // Elements are matched by content.
+    EXPECT_TRUE(ElementMatchesEqual(
+        {{old_x86_b, new_x86_b}, {old_x86_a, new_x86_a}},
+        MatchElements(old_view, {old_x86_a, old_x86_b, old_x64_a}, new_view,
+                      {new_x86_b, new_x86_a}, num_threads)));
+
+    // Elements are only matched with elements of the same type, even if they
+    // are less similar, and may share "old" elements.
+    EXPECT_TRUE(ElementMatchesEqual(
+        {{old_x64_a, new_x64_a}, {old_x64_a, new_x64_c}},
+        MatchElements(old_view, {old_x86_a, old_x64_a}, new_view,
+                      {new_x64_a, new_x64_c}, num_threads)));
+    EXPECT_TRUE(ElementMatchesEqual(
+        {{old_x86_b, new_x86_b}},
+        MatchElements(old_view, {old_x86_b}, new_view, {new_x86_b, new_x64_c},
+                      num_threads)));
+  }
+}
+
+}  // namespace zucchini
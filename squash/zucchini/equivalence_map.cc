@@ -4,21 +4,397 @@
 
 #include "squash/zucchini/equivalence_map.h"
 
+#include <stdint.h>
+
 #include <algorithm>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 #include "squash/base/logging.h"
+#include "squash/zucchini/algorithm.h"
 #include "squash/zucchini/encoded_view.h"
 #include "squash/zucchini/patch_reader.h"
+#include "squash/zucchini/seed_index.h"
 #include "squash/zucchini/suffix_array.h"
+#include "squash/zucchini/thread_pool.h"
 
 namespace zucchini {
 
+namespace {
+
+// Maximal number of suffixes visited in each direction from the lower bound of
+// a location in the suffix array, while looking for equivalence candidates.
+// This bounds the work spent on repetitive content.
+constexpr offset_t kMaxSeedNeighbors = 256;
+
+// Number of shards per thread used to find candidates, for load balancing.
+constexpr size_t kShardsPerThread = 4;
+
+// Visitors of seeds used by EquivalenceMap::FindCandidates(). Visit() looks
+// for the best equivalence candidate between |old_view| and the seed at
+// |dst_offset| in |new_view|, appends it to |candidates| if it reaches
+// |min_similarity|, and returns the offset of the next seed to visit. Its
+// result only depends on |dst_offset|. Visitors are copied for each thread.
+
+// Visits suffixes of |old_view| next to the lower bound of each seed found by
+// |search| in |old_sa|, using |old_lcp| to stop where they share no prefix.
+template <class Search>
+class SuffixSeedVisitor {
+ public:
+  SuffixSeedVisitor(const Search& search,
+                    SuffixArrayView old_sa,
+                    const std::vector<offset_t>& old_lcp,
+                    const EncodedView& old_view,
+                    const EncodedView& new_view,
+                    const std::vector<TargetsAffinity>& targets_affinities,
+                    double min_similarity,
+                    size_t seed_neighbor_budget)
+      : search_(search),
+        old_sa_(old_sa),
+        old_lcp_(&old_lcp),
+        old_view_(&old_view),
+        new_view_(&new_view),
+        targets_affinities_(&targets_affinities),
+        min_similarity_(min_similarity),
+        seed_neighbor_budget_(seed_neighbor_budget) {}
+
+  offset_t Visit(offset_t dst_offset,
+                 std::vector<EquivalenceCandidate>* candidates) {
+    if (!new_view_->IsToken(dst_offset))
+      return dst_offset + 1;
+    offset_t match = search_.LowerBound(dst_offset);
+
+    offset_t next_dst_offset = dst_offset + 1;
+    // Suffixes are visited away from |match| until |seed_neighbor_budget_|
+    // suffixes in a row don't improve the best candidate. The walk also stops
+    // at the end of the LCP interval of |dst_offset|, where suffixes share no
+    // prefix with it, and after |kMaxSeedNeighbors| suffixes in each direction.
+    double best_similarity = min_similarity_;
+    EquivalenceCandidate best_candidate = {{0, 0, 0}, 0.0};
+    // Number of suffixes visited since the best candidate last improved.
+    size_t misses = 0;
+    // LCP of |dst_offset| with the suffix at |rank|.
+    offset_t lcp = search_.upper_lcp();
+    for (offset_t rank = match;
+         rank < old_sa_.size() && rank - match < kMaxSeedNeighbors; ++rank) {
+      if (rank > match)
+        lcp = std::min(lcp, (*old_lcp_)[rank]);
+      if (lcp == 0)
+        break;
+      EquivalenceCandidate candidate = VisitEquivalenceSeed(
+          old_view_->image_index(), new_view_->image_index(),
+          *targets_affinities_, old_sa_[rank], dst_offset, min_similarity_);
+      if (candidate.similarity > best_similarity) {
+        best_candidate = candidate;
+        best_similarity = candidate.similarity;
+        next_dst_offset = candidate.eq.dst_end();
+        misses = 0;
+      } else if (++misses >= seed_neighbor_budget_) {
+        break;
+      }
+    }
+    misses = 0;
+    // LCP of |dst_offset| with the suffix at |rank - 1|.
+    lcp = search_.lower_lcp();
+    for (offset_t rank = match; rank > 0 && match - rank < kMaxSeedNeighbors;
+         --rank) {
+      if (rank < match)
+        lcp = std::min(lcp, (*old_lcp_)[rank]);
+      if (lcp == 0)
+        break;
+      EquivalenceCandidate candidate = VisitEquivalenceSeed(
+          old_view_->image_index(), new_view_->image_index(),
+          *targets_affinities_, old_sa_[rank - 1], dst_offset, min_similarity_);
+      if (candidate.similarity > best_similarity) {
+        best_candidate = candidate;
+        best_similarity = candidate.similarity;
+        next_dst_offset = candidate.eq.dst_end();
+        misses = 0;
+      } else if (++misses >= seed_neighbor_budget_) {
+        break;
+      }
+    }
+    if (best_candidate.similarity >= min_similarity_)
+      candidates->push_back(best_candidate);
+    return next_dst_offset;
+  }
+
+ private:
+  Search search_;
+  SuffixArrayView old_sa_;
+  const std::vector<offset_t>* old_lcp_;
+  const EncodedView* old_view_;
+  const EncodedView* new_view_;
+  const std::vector<TargetsAffinity>* targets_affinities_;
+  double min_similarity_;
+  size_t seed_neighbor_budget_;
+};
+
+// Visits windows of |old_view| found in |old_seeds| with the same hash as the
+// window of each seed.
+class HashSeedVisitor {
+ public:
+  HashSeedVisitor(const SeedIndex& old_seeds,
+                  const EncodedView& old_view,
+                  const EncodedView& new_view,
+                  const std::vector<TargetsAffinity>& targets_affinities,
+                  double min_similarity)
+      : old_seeds_(&old_seeds),
+        old_view_(&old_view),
+        new_view_(&new_view),
+        targets_affinities_(&targets_affinities),
+        min_similarity_(min_similarity),
+        window_hash_(new_view) {}
+
+  offset_t Visit(offset_t dst_offset,
+                 std::vector<EquivalenceCandidate>* candidates) {
+    if (!new_view_->IsToken(dst_offset) ||
+        new_view_->size() - dst_offset < WindowHash::kSize) {
+      return dst_offset + 1;
+    }
+    src_offsets_.clear();
+    old_seeds_->Find(window_hash_.MoveTo(dst_offset), &src_offsets_);
+
+    offset_t next_dst_offset = dst_offset + 1;
+    double best_similarity = min_similarity_;
+    EquivalenceCandidate best_candidate = {{0, 0, 0}, 0.0};
+    for (offset_t src_offset : src_offsets_) {
+      EquivalenceCandidate candidate = VisitEquivalenceSeed(
+          old_view_->image_index(), new_view_->image_index(),
+          *targets_affinities_, src_offset, dst_offset, min_similarity_);
+      if (candidate.similarity > best_similarity) {
+        best_candidate = candidate;
+        best_similarity = candidate.similarity;
+        next_dst_offset = candidate.eq.dst_end();
+      }
+    }
+    if (best_candidate.similarity >= min_similarity_)
+      candidates->push_back(best_candidate);
+    return next_dst_offset;
+  }
+
+ private:
+  const SeedIndex* old_seeds_;
+  const EncodedView* old_view_;
+  const EncodedView* new_view_;
+  const std::vector<TargetsAffinity>* targets_affinities_;
+  double min_similarity_;
+  // Hash of the last window visited in |new_view|, moved forward to the next
+  // seed.
+  WindowHash window_hash_;
+  // Buffer for offsets found in |old_seeds_|.
+  std::vector<offset_t> src_offsets_;
+};
+
+// Candidates found by scanning a shard of "new" image, see
+// EquivalenceMap::FindCandidates().
+struct ShardCandidates {
+  std::vector<EquivalenceCandidate> candidates;
+  // Offset of the seed of each candidate, and of the seed visited next.
+  std::vector<offset_t> seeds;
+  std::vector<offset_t> next_seeds;
+  // Offset where the scan stopped, at or after the end of the shard.
+  offset_t end = 0;
+};
+
+// Similarity of two identical raw values, see GetTokenSimilarity().
+constexpr double kRawMatchSimilarity = 1.0;
+
+// Number of bytes compared at once while looking for runs of identical raw
+// values. This bounds the work wasted when a run is cut short by a reference.
+constexpr offset_t kRawRunChunkSize = 64;
+
+// Returns the length of the common prefix of |a| and |b|, up to |max_length|.
+offset_t CommonPrefixLength(const uint8_t* a,
+                            const uint8_t* b,
+                            offset_t max_length) {
+  offset_t length = 0;
+#if defined(__AVX2__)
+  for (; length + 32 <= max_length; length += 32) {
+    __m256i va =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + length));
+    __m256i vb =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + length));
+    uint32_t mismatch =
+        ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)));
+    if (mismatch)
+      return length + CountTrailingZeros(mismatch);
+  }
+#endif
+#if defined(__SSE2__)
+  for (; length + 16 <= max_length; length += 16) {
+    __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + length));
+    __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + length));
+    uint32_t mismatch = ~_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) & 0xFFFF;
+    if (mismatch)
+      return length + CountTrailingZeros(mismatch);
+  }
+#endif
+  while (length < max_length && a[length] == b[length])
+    ++length;
+  return length;
+}
+
+// Returns the length of the common suffix of the ranges that end right before
+// |a_end| and |b_end|, up to |max_length|.
+offset_t CommonSuffixLength(const uint8_t* a_end,
+                            const uint8_t* b_end,
+                            offset_t max_length) {
+  offset_t length = 0;
+#if defined(__AVX2__)
+  for (; length + 32 <= max_length; length += 32) {
+    __m256i va = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(a_end - length - 32));
+    __m256i vb = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(b_end - length - 32));
+    uint32_t mismatch =
+        ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)));
+    if (mismatch)
+      return length + CountLeadingZeros(mismatch) - 32;
+  }
+#endif
+#if defined(__SSE2__)
+  for (; length + 16 <= max_length; length += 16) {
+    __m128i va =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(a_end - length - 16));
+    __m128i vb =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(b_end - length - 16));
+    uint32_t mismatch = ~_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) & 0xFFFF;
+    if (mismatch)
+      return length + CountLeadingZeros(mismatch) - 48;
+  }
+#endif
+  while (length < max_length && *(a_end - length - 1) == *(b_end - length - 1))
+    ++length;
+  return length;
+}
+
+// Returns the number of consecutive raw values that are identical in
+// |old_image_index| and |new_image_index|, starting at |src| and |dst|
+// respectively, up to |max_length|.
+offset_t MatchingRawRunLength(const ImageIndex& old_image_index,
+                              const ImageIndex& new_image_index,
+                              offset_t src,
+                              offset_t dst,
+                              offset_t max_length) {
+  const uint8_t* old_bytes = old_image_index.image().begin();
+  const uint8_t* new_bytes = new_image_index.image().begin();
+  offset_t length = 0;
+  while (length < max_length) {
+    offset_t chunk_size = std::min(kRawRunChunkSize, max_length - length);
+    offset_t raw_length = new_image_index.RawRunLength(
+        dst + length,
+        old_image_index.RawRunLength(src + length, chunk_size));
+    offset_t match_length =
+        CommonPrefixLength(old_bytes + src + length, new_bytes + dst + length,
+                           raw_length);
+    length += match_length;
+    if (match_length < chunk_size)
+      break;
+  }
+  return length;
+}
+
+// Returns the number of consecutive raw values that are identical in
+// |old_image_index| and |new_image_index|, ending right before |src_end| and
+// |dst_end| respectively, up to |max_length|.
+offset_t MatchingRawRunLengthBefore(const ImageIndex& old_image_index,
+                                    const ImageIndex& new_image_index,
+                                    offset_t src_end,
+                                    offset_t dst_end,
+                                    offset_t max_length) {
+  const uint8_t* old_bytes = old_image_index.image().begin();
+  const uint8_t* new_bytes = new_image_index.image().begin();
+  offset_t length = 0;
+  while (length < max_length) {
+    offset_t chunk_size = std::min(kRawRunChunkSize, max_length - length);
+    offset_t raw_length = new_image_index.RawRunLengthBefore(
+        dst_end - length,
+        old_image_index.RawRunLengthBefore(src_end - length, chunk_size));
+    offset_t match_length =
+        CommonSuffixLength(old_bytes + src_end - length,
+                           new_bytes + dst_end - length, raw_length);
+    length += match_length;
+    if (match_length < chunk_size)
+      break;
+  }
+  return length;
+}
+
+// Updates |*similarity| and |*penalty| the way ExtendEquivalenceForward() and
+// ExtendEquivalenceBackward() do while visiting |length| identical raw values
+// one at a time, and returns true. If visiting them would stop the extension,
+// returns false and leaves both unchanged. Scores are sums of multiples of 0.5,
+// so they are exact and the result is the same as visiting values one at a
+// time.
+bool ScoreMatchingRawRun(offset_t length,
+                         double min_similarity,
+                         double* similarity,
+                         double* penalty) {
+  // The extension can only stop on the first value: |*similarity| then
+  // increases and |*penalty| decreases, down to -|kRawMatchSimilarity|.
+  if (*similarity + kRawMatchSimilarity < 0.0 ||
+      std::max(0.0, *penalty) - kRawMatchSimilarity >= min_similarity) {
+    return false;
+  }
+  *similarity += length * kRawMatchSimilarity;
+  *penalty = std::max(std::max(0.0, *penalty) - length * kRawMatchSimilarity,
+                      -kRawMatchSimilarity);
+  return true;
+}
+
+// Returns the similarity of |candidate| once its first |head_length| and last
+// |tail_length| bytes are trimmed. Only the shorter of the trimmed and the
+// remaining parts is scored, so that trimming a candidate many times costs time
+// proportional to its length overall, rather than to its length on each trim.
+// Similarities are sums of multiples of 0.5, so subtracting the similarity of
+// the trimmed part is exact.
+double GetTrimmedSimilarity(
+    const ImageIndex& old_image_index,
+    const ImageIndex& new_image_index,
+    const std::vector<TargetsAffinity>& targets_affinities,
+    const EquivalenceCandidate& candidate,
+    offset_t head_length,
+    offset_t tail_length) {
+  const Equivalence& equivalence = candidate.eq;
+  DCHECK_LE(head_length, equivalence.length);
+  DCHECK_LE(tail_length, equivalence.length - head_length);
+  Equivalence remaining = {equivalence.src_offset + head_length,
+                           equivalence.dst_offset + head_length,
+                           equivalence.length - head_length - tail_length};
+  if (remaining.length <= head_length + tail_length ||
+      candidate.similarity == kMismatchFatal) {
+    return GetEquivalenceSimilarity(old_image_index, new_image_index,
+                                    targets_affinities, remaining);
+  }
+  double trimmed_similarity =
+      GetEquivalenceSimilarity(
+          old_image_index, new_image_index, targets_affinities,
+          {equivalence.src_offset, equivalence.dst_offset, head_length}) +
+      GetEquivalenceSimilarity(
+          old_image_index, new_image_index, targets_affinities,
+          {remaining.src_offset + remaining.length,
+           remaining.dst_offset + remaining.length, tail_length});
+  if (trimmed_similarity == kMismatchFatal) {
+    return GetEquivalenceSimilarity(old_image_index, new_image_index,
+                                    targets_affinities, remaining);
+  }
+  return candidate.similarity - trimmed_similarity;
+}
+
+}  // namespace
+
 /******** Utility Functions ********/
 
 double GetTokenSimilarity(
     const ImageIndex& old_image_index,
     const ImageIndex& new_image_index,
-    const TargetsAffinity& targets_affinity,
+    const std::vector<TargetsAffinity>& targets_affinities,
     offset_t src,
     offset_t dst) {
   DCHECK(old_image_index.IsToken(src));
@@ -36,25 +412,23 @@ double GetTokenSimilarity(
                : -1.5;
   }
 
-  Reference old_reference = old_image_index.refs(old_type).at(src);
-  Reference new_reference = new_image_index.refs(new_type).at(dst);
-  PoolTag pool = old_image_index.refs(old_type).pool_tag();
-
-  double affinity = targets_affinity.AffinityBetween(old_reference.target,
-                                                     new_reference.target);
+  const ReferenceSet& old_ref_set = old_image_index.refs(old_type);
+  double affinity = targets_affinities[old_ref_set.pool_tag().value()]
+                        .AffinityBetween(old_image_index.LookupTargetKey(src),
+                                         new_image_index.LookupTargetKey(dst));
 
   // Both targets are not associated, which implies a weak match.
   if (affinity == 0.0)
-    return 0.5 * old_image_index.refs(old_type).width();
+    return 0.5 * old_ref_set.width();
 
   // At least one target is associated, so values are compared.
-  return affinity > 0.0 ? old_image_index.refs(old_type).width() : -2.0;
+  return affinity > 0.0 ? old_ref_set.width() : -2.0;
 }
 
 double GetEquivalenceSimilarity(
     const ImageIndex& old_image_index,
     const ImageIndex& new_image_index,
-    const TargetsAffinity& targets_affinity,
+    const std::vector<TargetsAffinity>& targets_affinities,
     const Equivalence& equivalence) {
   double similarity = 0.0;
   for (offset_t k = 0; k < equivalence.length; ++k) {
@@ -64,7 +438,7 @@ double GetEquivalenceSimilarity(
       continue;
 
     similarity += GetTokenSimilarity(
-        old_image_index, new_image_index, targets_affinity,
+        old_image_index, new_image_index, targets_affinities,
         equivalence.src_offset + k, equivalence.dst_offset + k);
     if (similarity == kMismatchFatal)
       return kMismatchFatal;
@@ -75,7 +449,7 @@ double GetEquivalenceSimilarity(
 EquivalenceCandidate ExtendEquivalenceForward(
     const ImageIndex& old_image_index,
     const ImageIndex& new_image_index,
-    const TargetsAffinity& targets_affinity,
+    const std::vector<TargetsAffinity>& targets_affinities,
     const EquivalenceCandidate& candidate,
     double min_similarity) {
   Equivalence equivalence = candidate.eq;
@@ -83,10 +457,34 @@ EquivalenceCandidate ExtendEquivalenceForward(
   double current_similarity = candidate.similarity;
   double best_similarity = current_similarity;
   double current_penalty = min_similarity;
+  const uint8_t* old_bytes = old_image_index.image().begin();
+  const uint8_t* new_bytes = new_image_index.image().begin();
   for (offset_t k = best_k;
        equivalence.src_offset + k < old_image_index.size() &&
        equivalence.dst_offset + k < new_image_index.size();
        ++k) {
+    // Fast path for runs of identical raw values, which are scored at once.
+    offset_t run_length =
+        old_bytes[equivalence.src_offset + k] !=
+                new_bytes[equivalence.dst_offset + k]
+            ? 0
+            : MatchingRawRunLength(
+                  old_image_index, new_image_index, equivalence.src_offset + k,
+                  equivalence.dst_offset + k,
+                  std::min(old_image_index.size() - equivalence.src_offset,
+                           new_image_index.size() - equivalence.dst_offset) -
+                      k);
+    if (run_length > 1 &&
+        ScoreMatchingRawRun(run_length, min_similarity, &current_similarity,
+                            &current_penalty)) {
+      k += run_length - 1;
+      if (current_similarity >= best_similarity) {
+        best_similarity = current_similarity;
+        best_k = k + 1;
+      }
+      continue;
+    }
+
     // Mismatch in type, |candidate| cannot be extended further.
     if (old_image_index.LookupType(equivalence.src_offset + k) !=
         new_image_index.LookupType(equivalence.dst_offset + k)) {
@@ -102,7 +500,7 @@ EquivalenceCandidate ExtendEquivalenceForward(
     }
 
     double similarity = GetTokenSimilarity(
-        old_image_index, new_image_index, targets_affinity,
+        old_image_index, new_image_index, targets_affinities,
         equivalence.src_offset + k, equivalence.dst_offset + k);
     current_similarity += similarity;
     current_penalty = std::max(0.0, current_penalty) - similarity;
@@ -121,7 +519,7 @@ EquivalenceCandidate ExtendEquivalenceForward(
 EquivalenceCandidate ExtendEquivalenceBackward(
     const ImageIndex& old_image_index,
     const ImageIndex& new_image_index,
-    const TargetsAffinity& targets_affinity,
+    const std::vector<TargetsAffinity>& targets_affinities,
     const EquivalenceCandidate& candidate,
     double min_similarity) {
   Equivalence equivalence = candidate.eq;
@@ -129,8 +527,32 @@ EquivalenceCandidate ExtendEquivalenceBackward(
   double current_similarity = candidate.similarity;
   double best_similarity = current_similarity;
   double current_penalty = 0.0;
+  const uint8_t* old_bytes = old_image_index.image().begin();
+  const uint8_t* new_bytes = new_image_index.image().begin();
   for (offset_t k = 1;
        k <= equivalence.dst_offset && k <= equivalence.src_offset; ++k) {
+    // Fast path for runs of identical raw values, which are scored at once.
+    offset_t run_length =
+        old_bytes[equivalence.src_offset - k] !=
+                new_bytes[equivalence.dst_offset - k]
+            ? 0
+            : MatchingRawRunLengthBefore(
+                  old_image_index, new_image_index,
+                  equivalence.src_offset - k + 1,
+                  equivalence.dst_offset - k + 1,
+                  std::min(equivalence.src_offset, equivalence.dst_offset) -
+                      k + 1);
+    if (run_length > 1 &&
+        ScoreMatchingRawRun(run_length, min_similarity, &current_similarity,
+                            &current_penalty)) {
+      k += run_length - 1;
+      if (current_similarity >= best_similarity) {
+        best_similarity = current_similarity;
+        best_k = k;
+      }
+      continue;
+    }
+
     // Mismatch in type, |candidate| cannot be extended further.
     if (old_image_index.LookupType(equivalence.src_offset - k) !=
         new_image_index.LookupType(equivalence.dst_offset - k)) {
@@ -146,7 +568,7 @@ EquivalenceCandidate ExtendEquivalenceBackward(
               new_image_index.LookupType(equivalence.dst_offset -
                                          k));  // Sanity check.
     double similarity = GetTokenSimilarity(
-        old_image_index, new_image_index, targets_affinity,
+        old_image_index, new_image_index, targets_affinities,
         equivalence.src_offset - k, equivalence.dst_offset - k);
 
     current_similarity += similarity;
@@ -169,7 +591,7 @@ EquivalenceCandidate ExtendEquivalenceBackward(
 EquivalenceCandidate VisitEquivalenceSeed(
     const ImageIndex& old_image_index,
     const ImageIndex& new_image_index,
-    const TargetsAffinity& targets_affinity,
+    const std::vector<TargetsAffinity>& targets_affinities,
     offset_t src,
     offset_t dst,
     double min_similarity) {
@@ -178,11 +600,11 @@ EquivalenceCandidate VisitEquivalenceSeed(
     return candidate;
   candidate =
       ExtendEquivalenceForward(old_image_index, new_image_index,
-                               targets_affinity, candidate, min_similarity);
+                               targets_affinities, candidate, min_similarity);
   if (candidate.similarity < min_similarity)
     return candidate;  // Not worth exploring any more.
   return ExtendEquivalenceBackward(old_image_index, new_image_index,
-                                   targets_affinity, candidate,
+                                   targets_affinities, candidate,
                                    min_similarity);
 }
 
@@ -197,90 +619,193 @@ EquivalenceMap::EquivalenceMap(std::vector<EquivalenceCandidate>&& equivalences)
 
 EquivalenceMap::EquivalenceMap(EquivalenceMap&&) = default;
 
+EquivalenceMap& EquivalenceMap::operator=(EquivalenceMap&&) = default;
+
 EquivalenceMap::~EquivalenceMap() = default;
 
 void EquivalenceMap::Build(
-    const std::vector<offset_t>& old_sa,
+    SuffixArrayView old_sa,
     const EncodedView& old_view,
     const EncodedView& new_view,
-    const TargetsAffinity& targets_affinity,
-    double min_similarity) {
+    const std::vector<TargetsAffinity>& targets_affinities,
+    double min_similarity,
+    size_t num_threads,
+    size_t seed_neighbor_budget) {
   DCHECK_EQ(old_sa.size(), old_view.size());
+  DCHECK_GE(seed_neighbor_budget, 1U);
 
-  CreateCandidates(old_sa, old_view, new_view, targets_affinity,
-                   min_similarity);
+  CreateCandidates(old_sa, old_view, new_view, targets_affinities,
+                   min_similarity, num_threads, seed_neighbor_budget);
+  Finalize(old_view, new_view, targets_affinities, min_similarity);
+}
+
+void EquivalenceMap::Build(
+    const SeedIndex& old_seeds,
+    const EncodedView& old_view,
+    const EncodedView& new_view,
+    const std::vector<TargetsAffinity>& targets_affinities,
+    double min_similarity,
+    size_t num_threads) {
+  CreateCandidates(old_seeds, old_view, new_view, targets_affinities,
+                   min_similarity, num_threads);
+  Finalize(old_view, new_view, targets_affinities, min_similarity);
+}
+
+void EquivalenceMap::Finalize(
+    const EncodedView& old_view,
+    const EncodedView& new_view,
+    const std::vector<TargetsAffinity>& targets_affinities,
+    double min_similarity) {
   SortByDestination();
-  Prune(old_view, new_view, targets_affinity, min_similarity);
+  Prune(old_view, new_view, targets_affinities, min_similarity);
 
+  offset_t coverage = GetCoverage();
+  LOG(INFO) << "Equivalence Count: " << size();
+  LOG(INFO) << "Coverage / Extra / Total: " << coverage << " / "
+            << new_view.size() - coverage << " / " << new_view.size();
+}
+
+offset_t EquivalenceMap::GetCoverage() const {
   offset_t coverage = 0;
   offset_t current_offset = 0;
-  for (auto candidate : candidates_) {
+  for (const EquivalenceCandidate& candidate : candidates_) {
     DCHECK_GE(candidate.eq.dst_offset, current_offset);
     coverage += candidate.eq.length;
     current_offset = candidate.eq.dst_end();
   }
-  LOG(INFO) << "Equivalence Count: " << size();
-  LOG(INFO) << "Coverage / Extra / Total: " << coverage << " / "
-            << new_view.size() - coverage << " / " << new_view.size();
+  return coverage;
 }
 
-void EquivalenceMap::CreateCandidates(
-    const std::vector<offset_t>& old_sa,
-    const EncodedView& old_view,
-    const EncodedView& new_view,
-    const TargetsAffinity& targets_affinity,
-    double min_similarity) {
-  candidates_.clear();
-
+template <class SeedVisitor>
+void EquivalenceMap::FindCandidates(const SeedVisitor& visitor,
+                                    const EncodedView& new_view,
+                                    size_t num_threads) {
   // This is an heuristic to find 'good' equivalences on encoded views.
-  // Equivalences are found in ascending order of |new_image|.
-  offset_t dst_offset = 0;
-
-  while (dst_offset < new_view.size()) {
-    if (!new_view.IsToken(dst_offset)) {
-      ++dst_offset;
-      continue;
-    }
-    auto match =
-        SuffixLowerBound(old_sa, old_view.begin(),
-                         new_view.begin() + dst_offset, new_view.end());
-
-    offset_t next_dst_offset = dst_offset + 1;
-    // TODO(huangs): Clean up.
-    double best_similarity = min_similarity;
-    EquivalenceCandidate best_candidate = {{0, 0, 0}, 0.0};
-    for (auto it = match; it != old_sa.end(); ++it) {
-      EquivalenceCandidate candidate = VisitEquivalenceSeed(
-          old_view.image_index(), new_view.image_index(), targets_affinity,
-          static_cast<offset_t>(*it), dst_offset, min_similarity);
-      if (candidate.similarity > best_similarity) {
-        best_candidate = candidate;
-        best_similarity = candidate.similarity;
-        next_dst_offset = candidate.eq.dst_end();
-      } else {
-        break;
+  // Equivalences are found in ascending order of |new_image|, and each seed
+  // follows the candidate found at the previous one, so the scan is sequential.
+  // To run it on many threads, |new_image| is split into shards that are
+  // scanned independently, each from its first offset. Scans are then stitched
+  // in order: When the sequential scan enters a shard at an offset that the
+  // scan of the shard skipped over, seeds are visited again until both scans
+  // meet, after which they find the same candidates. The result is the same as
+  // with a single thread.
+  ThreadPool pool(num_threads);
+  offset_t new_size = new_view.size();
+  size_t num_shards =
+      pool.num_threads() == 1
+          ? 1
+          : std::min<size_t>(pool.num_threads() * kShardsPerThread, new_size);
+  auto shard_begin = [new_size, num_shards](size_t shard_index) {
+    return static_cast<offset_t>(uint64_t{new_size} * shard_index /
+                                 num_shards);
+  };
+
+  std::vector<ShardCandidates> shards(num_shards);
+  pool.ParallelFor(num_shards, [&](size_t shard_index) {
+    ShardCandidates& shard = shards[shard_index];
+    SeedVisitor shard_visitor = visitor;
+    offset_t dst_offset = shard_begin(shard_index);
+    offset_t shard_end = shard_begin(shard_index + 1);
+    while (dst_offset < shard_end) {
+      size_t num_candidates = shard.candidates.size();
+      offset_t next_dst_offset =
+          shard_visitor.Visit(dst_offset, &shard.candidates);
+      if (shard.candidates.size() > num_candidates) {
+        shard.seeds.push_back(dst_offset);
+        shard.next_seeds.push_back(next_dst_offset);
       }
+      dst_offset = next_dst_offset;
     }
-    for (auto it = match; it != old_sa.begin(); --it) {
-      EquivalenceCandidate candidate = VisitEquivalenceSeed(
-          old_view.image_index(), new_view.image_index(), targets_affinity,
-          static_cast<offset_t>(it[-1]), dst_offset, min_similarity);
-      if (candidate.similarity > best_similarity) {
-        best_candidate = candidate;
-        best_similarity = candidate.similarity;
-        next_dst_offset = candidate.eq.dst_end();
-      } else {
+    shard.end = dst_offset;
+  });
+
+  SeedVisitor serial_visitor = visitor;
+  offset_t dst_offset = 0;
+  for (size_t shard_index = 0; shard_index < num_shards; ++shard_index) {
+    const ShardCandidates& shard = shards[shard_index];
+    offset_t shard_end = shard_begin(shard_index + 1);
+    // Index of the first candidate of |shard| with a seed at or after
+    // |dst_offset|.
+    size_t index = 0;
+    while (dst_offset < shard_end) {
+      while (index < shard.seeds.size() && shard.seeds[index] < dst_offset)
+        ++index;
+      // |dst_offset| was visited by the scan of |shard|, unless the previous
+      // candidate skipped over it.
+      if (index == 0 || shard.next_seeds[index - 1] <= dst_offset) {
+        candidates_.insert(candidates_.end(), shard.candidates.begin() + index,
+                           shard.candidates.end());
+        dst_offset = shard.end;
         break;
       }
+      dst_offset = serial_visitor.Visit(dst_offset, &candidates_);
     }
-    if (best_candidate.similarity >= min_similarity) {
-      candidates_.push_back(best_candidate);
-    }
+  }
+}
+
+void EquivalenceMap::CreateCandidates(
+    SuffixArrayView old_sa,
+    const EncodedView& old_view,
+    const EncodedView& new_view,
+    const std::vector<TargetsAffinity>& targets_affinities,
+    double min_similarity,
+    size_t num_threads,
+    size_t seed_neighbor_budget) {
+  candidates_.clear();
 
-    dst_offset = next_dst_offset;
+  // Projections of images without references are their raw content, and
+  // materialized projections are also compared as plain memory.
+  if (old_view.image_index().TypeCount() == 0 &&
+      new_view.image_index().TypeCount() == 0) {
+    ConstBufferView old_image = old_view.image_index().image();
+    ConstBufferView new_image = new_view.image_index().image();
+    using StrIt = ConstBufferView::const_iterator;
+    using Search = SuffixSearch<StrIt, StrIt, offset_t>;
+    FindCandidates(
+        SuffixSeedVisitor<Search>(
+            Search(old_sa.begin(), old_image.begin(), old_image.end(),
+                   new_image.begin(), new_image.end()),
+            old_sa, MakeLcpArray(old_image, old_sa), old_view, new_view,
+            targets_affinities, min_similarity, seed_neighbor_budget),
+        new_view, num_threads);
+  } else if (old_view.IsMaterialized() && new_view.IsMaterialized()) {
+    using StrIt = EncodedView::ProjectionRange::const_iterator;
+    using Search = SuffixSearch<StrIt, StrIt, offset_t>;
+    FindCandidates(
+        SuffixSeedVisitor<Search>(
+            Search(old_sa.begin(), old_view.projections().begin(),
+                   old_view.projections().end(),
+                   new_view.projections().begin(),
+                   new_view.projections().end()),
+            old_sa, MakeLcpArray(old_view.projections(), old_sa), old_view,
+            new_view, targets_affinities, min_similarity, seed_neighbor_budget),
+        new_view, num_threads);
+  } else {
+    using StrIt = EncodedView::const_iterator;
+    using Search = SuffixSearch<StrIt, StrIt, offset_t>;
+    FindCandidates(
+        SuffixSeedVisitor<Search>(
+            Search(old_sa.begin(), old_view.begin(), old_view.end(),
+                   new_view.begin(), new_view.end()),
+            old_sa, MakeLcpArray(old_view, old_sa), old_view, new_view,
+            targets_affinities, min_similarity, seed_neighbor_budget),
+        new_view, num_threads);
   }
 }
 
+void EquivalenceMap::CreateCandidates(
+    const SeedIndex& old_seeds,
+    const EncodedView& old_view,
+    const EncodedView& new_view,
+    const std::vector<TargetsAffinity>& targets_affinities,
+    double min_similarity,
+    size_t num_threads) {
+  candidates_.clear();
+  FindCandidates(HashSeedVisitor(old_seeds, old_view, new_view,
+                                 targets_affinities, min_similarity),
+                 new_view, num_threads);
+}
+
 void EquivalenceMap::SortByDestination() {
   std::sort(candidates_.begin(), candidates_.end(),
             [](const EquivalenceCandidate& a, const EquivalenceCandidate& b) {
@@ -291,7 +816,7 @@ void EquivalenceMap::SortByDestination() {
 void EquivalenceMap::Prune(
     const EncodedView& old_view,
     const EncodedView& new_view,
-    const TargetsAffinity& target_affinities,
+    const std::vector<TargetsAffinity>& target_affinities,
     double min_similarity) {
   for (auto current = candidates_.begin(); current != candidates_.end();
        ++current) {
@@ -308,10 +833,10 @@ void EquivalenceMap::Prune(
 
       // |next| is better, so |current| shrinks.
       if (current->similarity < next->similarity) {
-        current->eq.length -= delta;
-        current->similarity = GetEquivalenceSimilarity(
+        current->similarity = GetTrimmedSimilarity(
             old_view.image_index(), new_view.image_index(), target_affinities,
-            current->eq);
+            *current, 0, delta);
+        current->eq.length -= delta;
         break;
       }
     }
@@ -322,12 +847,12 @@ void EquivalenceMap::Prune(
         break;  // No more overlap.
 
       offset_t delta = current->eq.dst_end() - next->eq.dst_offset;
+      next->similarity = GetTrimmedSimilarity(
+          old_view.image_index(), new_view.image_index(), target_affinities,
+          *next, std::min(delta, next->eq.length), 0);
       next->eq.length = next->eq.length > delta ? next->eq.length - delta : 0;
       next->eq.src_offset += delta;
       next->eq.dst_offset += delta;
-      next->similarity = GetEquivalenceSimilarity(old_view.image_index(),
-                                                  new_view.image_index(),
-                                                  target_affinities, next->eq);
       DCHECK_EQ(next->eq.dst_offset, current->eq.dst_end());
     }
   }
@@ -19,6 +19,7 @@ namespace zucchini {
 class EncodedView;
 class ImageIndex;
 class EquivalenceSource;
+class SeedIndex;
 
 // Returns a similarity score between content in |old_image_index| and
 // |new_image_index| at offsets |src| and |dst|, respectively.
@@ -29,7 +30,7 @@ class EquivalenceSource;
 double GetTokenSimilarity(
     const ImageIndex& old_image_index,
     const ImageIndex& new_image_index,
-    const TargetsAffinity& targets_affinities,
+    const std::vector<TargetsAffinity>& targets_affinities,
     offset_t src,
     offset_t dst);
 
@@ -39,7 +40,7 @@ double GetTokenSimilarity(
 double GetEquivalenceSimilarity(
     const ImageIndex& old_image_index,
     const ImageIndex& new_image_index,
-    const TargetsAffinity& targets_affinities,
+    const std::vector<TargetsAffinity>& targets_affinities,
     const Equivalence& equivalence);
 
 // Extends |equivalence| forward and returns the result. This is related to
@@ -47,7 +48,7 @@ double GetEquivalenceSimilarity(
 EquivalenceCandidate ExtendEquivalenceForward(
     const ImageIndex& old_image_index,
     const ImageIndex& new_image_index,
-    const TargetsAffinity& targets_affinities,
+    const std::vector<TargetsAffinity>& targets_affinities,
     const EquivalenceCandidate& equivalence,
     double min_similarity);
 
@@ -56,7 +57,7 @@ EquivalenceCandidate ExtendEquivalenceForward(
 EquivalenceCandidate ExtendEquivalenceBackward(
     const ImageIndex& old_image_index,
     const ImageIndex& new_image_index,
-    const TargetsAffinity& targets_affinities,
+    const std::vector<TargetsAffinity>& targets_affinities,
     const EquivalenceCandidate& equivalence,
     double min_similarity);
 
@@ -69,7 +70,7 @@ EquivalenceCandidate ExtendEquivalenceBackward(
 EquivalenceCandidate VisitEquivalenceSeed(
     const ImageIndex& old_image_index,
     const ImageIndex& new_image_index,
-    const TargetsAffinity& targets_affinities,
+    const std::vector<TargetsAffinity>& targets_affinities,
     offset_t src,
     offset_t dst,
     double min_similarity);
@@ -121,32 +122,73 @@ class EquivalenceMap {
   EquivalenceMap(const EquivalenceMap&) = delete;
   ~EquivalenceMap();
 
+  EquivalenceMap& operator=(EquivalenceMap&&);
+
   // Finds relevant equivalences between |old_view| and |new_view|, using
   // suffix array |old_sa| computed from |old_view| and using
   // |targets_affinities| to evaluate similarity between references. This
   // function is not symmetric. Equivalences might overlap in |old_view|, but
   // not in |new_view|. It tries to maximize accumulated similarity within each
   // equivalence, while maximizing |new_view| coverage. The minimum similarity
-  // of an equivalence is given by |min_similarity|.
-  void Build(const std::vector<offset_t>& old_sa,
+  // of an equivalence is given by |min_similarity|. Candidates are searched
+  // using |num_threads| threads, or ThreadPool::HardwareConcurrency() if 0,
+  // which doesn't affect the result. Around each seed, suffixes are visited
+  // until |seed_neighbor_budget| of them in a row don't improve the best
+  // candidate: Larger budgets find better candidates, but take longer.
+  void Build(SuffixArrayView old_sa,
              const EncodedView& old_view,
              const EncodedView& new_view,
-             const TargetsAffinity& targets_affinities,
-             double min_similarity);
+             const std::vector<TargetsAffinity>& targets_affinities,
+             double min_similarity,
+             size_t num_threads = 0,
+             size_t seed_neighbor_budget = 1);
+
+  // Same as above, but finds seeds of equivalences using |old_seeds| computed
+  // from |old_view| instead of a suffix array. This is faster and uses less
+  // memory, but misses equivalences shorter than about
+  // WindowHash::kSize + SeedIndex::kStride.
+  void Build(const SeedIndex& old_seeds,
+             const EncodedView& old_view,
+             const EncodedView& new_view,
+             const std::vector<TargetsAffinity>& targets_affinities,
+             double min_similarity,
+             size_t num_threads = 0);
 
   size_t size() const { return candidates_.size(); }
   const_iterator begin() const { return candidates_.begin(); }
   const_iterator end() const { return candidates_.end(); }
 
+  // Returns the number of bytes of new image covered by equivalences.
+  offset_t GetCoverage() const;
+
  private:
   // Discovers equivalence candidates between |old_view| and |new_view| and
   // stores them in the object. Note that resulting candidates are not sorted
   // and might be overlapping in new image.
-  void CreateCandidates(const std::vector<offset_t>& old_sa,
+  void CreateCandidates(SuffixArrayView old_sa,
+                        const EncodedView& old_view,
+                        const EncodedView& new_view,
+                        const std::vector<TargetsAffinity>& targets_affinities,
+                        double min_similarity,
+                        size_t num_threads,
+                        size_t seed_neighbor_budget);
+  void CreateCandidates(const SeedIndex& old_seeds,
                         const EncodedView& old_view,
                         const EncodedView& new_view,
-                        const TargetsAffinity& targets_affinities,
-                        double min_similarity);
+                        const std::vector<TargetsAffinity>& targets_affinities,
+                        double min_similarity,
+                        size_t num_threads);
+  // Implementation of CreateCandidates(), which scans seeds of |new_view| with
+  // |visitor|. |visitor| is copied for each thread.
+  template <class SeedVisitor>
+  void FindCandidates(const SeedVisitor& visitor,
+                      const EncodedView& new_view,
+                      size_t num_threads);
+  // Sorts and prunes candidates found by CreateCandidates().
+  void Finalize(const EncodedView& old_view,
+                const EncodedView& new_view,
+                const std::vector<TargetsAffinity>& targets_affinities,
+                double min_similarity);
   // Sorts candidates by their offset in new image.
   void SortByDestination();
   // Visits |candidates_| (sorted by |dst_offset|) and remove all destination
@@ -154,7 +196,7 @@ class EquivalenceMap {
   // shrunken. Unfit candidates may be removed.
   void Prune(const EncodedView& old_view,
              const EncodedView& new_view,
-             const TargetsAffinity& targets_affinities,
+             const std::vector<TargetsAffinity>& targets_affinities,
              double min_similarity);
 
   std::vector<EquivalenceCandidate> candidates_;
@@ -0,0 +1,270 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "squash/zucchini/equivalence_map.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "gtest/gtest.h"
+#include "squash/zucchini/disassembler.h"
+#include "squash/zucchini/element_detection.h"
+#include "squash/zucchini/encoded_view.h"
+#include "squash/zucchini/image_index.h"
+#include "squash/zucchini/mapped_file.h"
+#include "squash/zucchini/patch_writer.h"
+#include "squash/zucchini/seed_index.h"
+#include "squash/zucchini/targets_affinity.h"
+#include "squash/zucchini/zucchini.h"
+#include "squash/zucchini/zucchini_gen.h"
+
+namespace zucchini {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Same as in zucchini_gen.cc.
+constexpr double kMinEquivalenceSimilarity = 12.0;
+
+constexpr size_t kThreadCounts[] = {1, 2, 4, 8, 16};
+
+boost::filesystem::path MakeTestPath(const std::string& filename) {
+  return boost::filesystem::path("squash") / "testdata" / filename;
+}
+
+// Holds the index of a test file.
+struct TestImage {
+  explicit TestImage(const std::string& filename)
+      : file(MakeTestPath(filename)), image_index(file.region()) {}
+
+  // Returns true on success.
+  bool Initialize() {
+    if (!file.IsValid())
+      return false;
+    std::unique_ptr<Disassembler> disasm =
+        MakeDisassemblerWithoutFallback(file.region());
+    return disasm && image_index.Initialize(disasm.get());
+  }
+
+  MappedFileReader file;
+  ImageIndex image_index;
+};
+
+// Appends |count| random bytes from |rng| to |image|.
+void AppendRandomBytes(size_t count,
+                       std::mt19937* rng,
+                       std::vector<uint8_t>* image) {
+  for (size_t i = 0; i < count; ++i)
+    image->push_back(static_cast<uint8_t>((*rng)()));
+}
+
+}  // namespace
+
+// Measures the cost of extending equivalences, by visiting again the seeds of
+// all equivalences found between two test files, and by evaluating their
+// similarity.
+TEST(EquivalenceMapPerfTest, Extend) {
+  TestImage old_image("chrome64_1.exe");
+  TestImage new_image("chrome64_2.exe");
+  ASSERT_TRUE(old_image.Initialize());
+  ASSERT_TRUE(new_image.Initialize());
+
+  auto start = Clock::now();
+  EquivalenceMap equivalence_map =
+      CreateEquivalenceMap(old_image.image_index, new_image.image_index);
+  std::chrono::duration<double> create_time = Clock::now() - start;
+  std::cout << equivalence_map.size() << " equivalences, CreateEquivalenceMap "
+            << create_time.count() << " s" << std::endl;
+
+  std::vector<TargetsAffinity> targets_affinities(
+      old_image.image_index.PoolCount());
+  start = Clock::now();
+  for (size_t i = 0; i < targets_affinities.size(); ++i) {
+    PoolTag pool_tag(static_cast<uint8_t>(i));
+    targets_affinities[i].InferFromSimilarities(
+        equivalence_map, old_image.image_index.pool(pool_tag).targets(),
+        new_image.image_index.pool(pool_tag).targets());
+  }
+  std::chrono::duration<double> infer_time = Clock::now() - start;
+  std::cout << "InferFromSimilarities " << infer_time.count() << " s"
+            << std::endl;
+
+  constexpr int kRepeats = 5;
+  size_t visited_length = 0;
+  start = Clock::now();
+  for (int i = 0; i < kRepeats; ++i) {
+    for (const EquivalenceCandidate& candidate : equivalence_map) {
+      visited_length +=
+          VisitEquivalenceSeed(old_image.image_index, new_image.image_index,
+                               targets_affinities, candidate.eq.src_offset,
+                               candidate.eq.dst_offset,
+                               kMinEquivalenceSimilarity)
+              .eq.length;
+    }
+  }
+  std::chrono::duration<double> visit_time = Clock::now() - start;
+
+  double similarity = 0.0;
+  start = Clock::now();
+  for (int i = 0; i < kRepeats; ++i) {
+    for (const EquivalenceCandidate& candidate : equivalence_map) {
+      similarity += GetEquivalenceSimilarity(
+          old_image.image_index, new_image.image_index, targets_affinities,
+          candidate.eq);
+    }
+  }
+  std::chrono::duration<double> similarity_time = Clock::now() - start;
+  EXPECT_GT(similarity, 0.0);
+  std::cout << kRepeats << " x " << visited_length / kRepeats
+            << " bytes: VisitEquivalenceSeed " << visit_time.count()
+            << " s, GetEquivalenceSimilarity " << similarity_time.count()
+            << " s" << std::endl;
+}
+
+// Measures how the search for equivalences between two test files scales with
+// the number of threads, starting from a precomputed suffix array.
+TEST(EquivalenceMapPerfTest, CreateScaling) {
+  TestImage old_image("chrome64_1.exe");
+  TestImage new_image("chrome64_2.exe");
+  ASSERT_TRUE(old_image.Initialize());
+  ASSERT_TRUE(new_image.Initialize());
+  std::vector<offset_t> old_sa = MakeInitialSuffixArray(old_image.image_index);
+
+  std::vector<Equivalence> expected;
+  double serial_time = 0.0;
+  for (size_t num_threads : kThreadCounts) {
+    GenerateOptions options;
+    options.num_threads = num_threads;
+    auto start = Clock::now();
+    EquivalenceMap equivalence_map = CreateEquivalenceMap(
+        old_image.image_index, new_image.image_index,
+        {old_sa.data(), old_sa.size()}, options);
+    std::chrono::duration<double> time = Clock::now() - start;
+    if (num_threads == 1)
+      serial_time = time.count();
+    std::cout << num_threads << " threads: CreateEquivalenceMap "
+              << time.count() << " s, speedup " << serial_time / time.count()
+              << std::endl;
+
+    std::vector<Equivalence> equivalences;
+    for (const EquivalenceCandidate& candidate : equivalence_map)
+      equivalences.push_back(candidate.eq);
+    if (num_threads == 1)
+      expected = std::move(equivalences);
+    else
+      EXPECT_EQ(expected, equivalences);
+  }
+}
+
+// Compares seed matchers on two test files: time to generate a patch, memory
+// used to index "old" image, and patch size.
+TEST(EquivalenceMapPerfTest, SeedMatchers) {
+  TestImage old_image("chrome64_1.exe");
+  TestImage new_image("chrome64_2.exe");
+  ASSERT_TRUE(old_image.Initialize());
+  ASSERT_TRUE(new_image.Initialize());
+
+  // Both matchers first index the view without labels. The suffix array is
+  // used along with its LCP array, of the same size.
+  EncodedView old_view(old_image.image_index,
+                       EncodedView::Mode::kMaterialized);
+  for (size_t i = 0; i < old_image.image_index.PoolCount(); ++i) {
+    PoolTag pool_tag(static_cast<uint8_t>(i));
+    old_view.SetLabels(
+        pool_tag,
+        std::vector<uint32_t>(old_image.image_index.pool(pool_tag).size(), 0),
+        1);
+  }
+  std::cout << "Index of old image: suffix array "
+            << 2 * old_view.size() * sizeof(offset_t) << " bytes, hash table "
+            << SeedIndex(old_view).SizeInBytes() << " bytes" << std::endl;
+
+  const std::pair<SeedMatcher, const char*> kMatchers[] = {
+      {SeedMatcher::kSuffixArray, "suffix array"},
+      {SeedMatcher::kHash, "hash"}};
+  for (const auto& matcher : kMatchers) {
+    GenerateOptions options;
+    options.matcher = matcher.first;
+    EnsemblePatchWriter patch_writer(old_image.file.region(),
+                                     new_image.file.region());
+    auto start = Clock::now();
+    ASSERT_EQ(status::kStatusSuccess,
+              GenerateEnsemble(old_image.file.region(),
+                               new_image.file.region(), &patch_writer,
+                               options));
+    std::chrono::duration<double> time = Clock::now() - start;
+    std::cout << matcher.second << ": GenerateEnsemble " << time.count()
+              << " s, patch " << patch_writer.SerializedSize() << " bytes"
+              << std::endl;
+  }
+}
+
+// Compares presets of GenerateOptions on two test files: time to generate a
+// patch, and patch size. Peak memory of each preset is logged by
+// "zucchini -gen -level=<level>".
+TEST(EquivalenceMapPerfTest, GenerateLevels) {
+  TestImage old_image("chrome64_1.exe");
+  TestImage new_image("chrome64_2.exe");
+  ASSERT_TRUE(old_image.file.IsValid());
+  ASSERT_TRUE(new_image.file.IsValid());
+
+  const std::pair<GenerateLevel, const char*> kLevels[] = {
+      {GenerateLevel::kFast, "fast"},
+      {GenerateLevel::kDefault, "default"},
+      {GenerateLevel::kMax, "max"}};
+  for (const auto& level : kLevels) {
+    EnsemblePatchWriter patch_writer(old_image.file.region(),
+                                     new_image.file.region());
+    auto start = Clock::now();
+    ASSERT_EQ(status::kStatusSuccess,
+              GenerateEnsemble(old_image.file.region(),
+                               new_image.file.region(), &patch_writer,
+                               GenerateOptions(level.first)));
+    std::chrono::duration<double> time = Clock::now() - start;
+    std::cout << level.second << ": GenerateEnsemble " << time.count()
+              << " s, patch " << patch_writer.SerializedSize() << " bytes"
+              << std::endl;
+  }
+}
+
+// Measures the cost of finding equivalences between images made of small
+// sections separated by zero padding of random lengths. Padding yields many
+// overlapping candidates, which are trimmed by EquivalenceMap::Prune().
+TEST(EquivalenceMapPerfTest, PaddedSections) {
+  constexpr size_t kNumSections = 256;
+  constexpr size_t kSectionSize = 64;
+  std::mt19937 rng(0);
+  std::vector<uint8_t> old_image;
+  std::vector<uint8_t> new_image;
+  for (size_t i = 0; i < kNumSections; ++i) {
+    AppendRandomBytes(kSectionSize, &rng, &old_image);
+    new_image.insert(new_image.end(), old_image.end() - kSectionSize,
+                     old_image.end());
+    old_image.resize(old_image.size() + rng() % 65536, 0);
+    new_image.resize(new_image.size() + rng() % 8192, 0);
+  }
+  ImageIndex old_image_index({old_image.data(), old_image.size()});
+  ImageIndex new_image_index({new_image.data(), new_image.size()});
+
+  auto start = Clock::now();
+  EquivalenceMap equivalence_map =
+      CreateEquivalenceMap(old_image_index, new_image_index);
+  std::chrono::duration<double> create_time = Clock::now() - start;
+  EXPECT_GT(equivalence_map.size(), 0U);
+  std::cout << old_image.size() << " -> " << new_image.size() << " bytes, "
+            << equivalence_map.size() << " equivalences, CreateEquivalenceMap "
+            << create_time.count() << " s" << std::endl;
+}
+
+}  // namespace zucchini
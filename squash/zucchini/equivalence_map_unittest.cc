@@ -42,15 +42,16 @@ ImageIndex MakeImageIndexForTesting(const char* a,
   return image_index;
 }
 
-TargetsAffinity MakeTargetsAffinitiesForTesting(
+std::vector<TargetsAffinity> MakeTargetsAffinitiesForTesting(
     const ImageIndex& old_image_index,
     const ImageIndex& new_image_index,
     const EquivalenceMap& equivalence_map) {
   std::vector<TargetsAffinity> target_affinities(old_image_index.PoolCount());
-  for (const auto& old_target_pool : old_image_index.target_pools()) {
-    target_affinities[old_target_pool.first.value()].InferFromSimilarities(
-        equivalence_map, old_target_pool.second.targets(),
-        new_image_index.pool(old_target_pool.first).targets());
+  for (size_t i = 0; i < old_image_index.PoolCount(); ++i) {
+    PoolTag pool_tag(static_cast<uint8_t>(i));
+    target_affinities[i].InferFromSimilarities(
+        equivalence_map, old_image_index.pool(pool_tag).targets(),
+        new_image_index.pool(pool_tag).targets());
   }
   return target_affinities;
 }
@@ -253,24 +254,22 @@ TEST(EquivalenceMapTest, Build) {
     EncodedView old_view(old_index);
     EncodedView new_view(new_index);
 
-    for (const auto& old_target_pool : old_index.target_pools()) {
+    for (size_t i = 0; i < old_index.PoolCount(); ++i) {
+      PoolTag pool_tag(static_cast<uint8_t>(i));
       std::vector<uint32_t> old_labels;
       std::vector<uint32_t> new_labels;
       size_t label_bound =
-          affinities[old_target_pool.first.value()].AssignLabels(
-              1.0, &old_labels, &new_labels);
-      old_view.SetLabels(old_target_pool.first, std::move(old_labels),
-                         label_bound);
-      new_view.SetLabels(old_target_pool.first, std::move(new_labels),
-                         label_bound);
+          affinities[i].AssignLabels(1.0, &old_labels, &new_labels);
+      old_view.SetLabels(pool_tag, std::move(old_labels), label_bound);
+      new_view.SetLabels(pool_tag, std::move(new_labels), label_bound);
     }
 
     std::vector<offset_t> old_sa =
         MakeSuffixArray<InducedSuffixSort>(old_view, old_view.Cardinality());
 
     EquivalenceMap equivalence_map;
-    equivalence_map.Build(old_sa, old_view, new_view, affinities,
-                          minimum_similarity);
+    equivalence_map.Build({old_sa.data(), old_sa.size()}, old_view, new_view,
+                          affinities, minimum_similarity);
 
     offset_t current_dst_offset = 0;
     offset_t coverage = 0;
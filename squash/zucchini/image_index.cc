@@ -5,73 +5,172 @@
 #include "squash/zucchini/image_index.h"
 
 #include <algorithm>
+#include <memory>
 #include <utility>
 
 #include "squash/base/macros.h"
 #include "squash/zucchini/algorithm.h"
 #include "squash/zucchini/disassembler.h"
+#include "squash/zucchini/io_utils.h"
+#include "squash/zucchini/thread_pool.h"
 
 namespace zucchini {
 
-ImageIndex::ImageIndex(ConstBufferView image)
-    : image_(image), type_tags_(image.size(), kNoTypeTag) {}
+constexpr offset_t ImageIndex::kBitsPerWord;
+
+ImageIndex::ImageIndex(ConstBufferView image, TypeMap type_map)
+    : image_(image),
+      type_map_(type_map),
+      type_tags_(type_map == TypeMap::kDense ? image.size() : 0, kNoTypeTag),
+      token_bits_(ceil<size_t>(image.size(), kBitsPerWord) / kBitsPerWord,
+                  ~uint64_t(0)),
+      reference_bits_(token_bits_.size(), 0),
+      reference_ranks_(token_bits_.size(), 0) {}
 ImageIndex::ImageIndex(ImageIndex&&) = default;
 ImageIndex::~ImageIndex() = default;
 
-bool ImageIndex::Initialize(Disassembler* disasm) {
+bool ImageIndex::Initialize(Disassembler* disasm, size_t num_threads) {
   std::vector<ReferenceGroup> ref_groups = disasm->MakeReferenceGroups();
+  // Disassemblers parse the image lazily as readers are made, so this is done
+  // serially. Readers then only read parsed data, and run concurrently.
+  std::vector<std::unique_ptr<ReferenceReader>> readers;
+  readers.reserve(ref_groups.size());
   for (const auto& group : ref_groups) {
     // Build pool-to-type mapping.
     DCHECK_NE(kNoPoolTag, group.pool_tag());
-    TargetPool& target_pool = target_pools_[group.pool_tag()];
-    target_pool.AddType(group.type_tag());
-    target_pool.InsertTargets(std::move(*group.GetReader(disasm)));
+    DCHECK_EQ(group.type_tag().value(), readers.size());
+    if (group.pool_tag().value() >= target_pools_.size())
+      target_pools_.resize(group.pool_tag().value() + 1);
+    target_pools_[group.pool_tag().value()].AddType(group.type_tag());
+    readers.push_back(group.GetReader(disasm));
   }
-  for (const auto& group : ref_groups) {
-    // Find and store all references for current type, returns false on finding
-    // any overlap, to signal error.
-    if (!InsertReferences(group.traits(),
-                          std::move(*group.GetReader(disasm)))) {
-      return false;
+
+  ThreadPool thread_pool(num_threads);
+  // References of each type, indexed by type tag.
+  std::vector<std::vector<Reference>> refs(ref_groups.size());
+  thread_pool.ParallelFor(ref_groups.size(), [&](size_t i) {
+    for (auto ref = readers[i]->GetNext(); ref.has_value();
+         ref = readers[i]->GetNext()) {
+      refs[i].push_back(*ref);
     }
+  });
+  thread_pool.ParallelFor(target_pools_.size(), [&](size_t i) {
+    for (TypeTag type_tag : target_pools_[i].types())
+      target_pools_[i].InsertTargets(refs[type_tag.value()]);
+  });
+
+  // Pools are complete, so keys of targets can be found.
+  for (const auto& group : ref_groups)
+    reference_sets_.emplace_back(group.traits(), pool(group.pool_tag()));
+  thread_pool.ParallelFor(ref_groups.size(), [&](size_t i) {
+    reference_sets_[i].InitReferences(refs[i]);
+    std::vector<Reference>().swap(refs[i]);
+  });
+
+  for (const ReferenceSet& ref_set : reference_sets_) {
+    if (!MarkReferences(ref_set))
+      return false;
   }
+  UpdateReferenceKeys();
   return true;
 }
 
-bool ImageIndex::IsToken(offset_t location) const {
-  TypeTag type = LookupType(location);
+void ImageIndex::InsertTargetPool(PoolTag pool_tag, TargetPool&& target_pool) {
+  DCHECK_EQ(pool_tag.value(), PoolCount());
+  DCHECK_EQ(0U, TypeCount());
+  target_pools_.push_back(std::move(target_pool));
+}
 
-  // |location| points into raw data.
-  if (type == kNoTypeTag)
-    return true;
+offset_t ImageIndex::RawRunLength(offset_t location,
+                                  offset_t max_length) const {
+  DCHECK_LE(max_length, size() - location);
+  offset_t length = 0;
+  while (length < max_length) {
+    offset_t bit = (location + length) % kBitsPerWord;
+    // Counts raw values from |bit| to the end of the word.
+    offset_t count = CountTrailingZeros(~(RawBits(location + length) >> bit));
+    length += std::min(count, kBitsPerWord - bit);
+    if (count < kBitsPerWord - bit)
+      break;
+  }
+  return std::min(length, max_length);
+}
 
-  // |location| points into a Reference.
-  Reference reference = refs(type).at(location);
-  // Only the first byte of a reference is a token.
-  return location == reference.location;
+offset_t ImageIndex::RawRunLengthBefore(offset_t location,
+                                        offset_t max_length) const {
+  DCHECK_LE(max_length, location);
+  offset_t length = 0;
+  while (length < max_length) {
+    offset_t bit = (location - length - 1) % kBitsPerWord;
+    // Counts raw values from |bit| down to the start of the word.
+    offset_t count = CountLeadingZeros(
+        ~(RawBits(location - length - 1) << (kBitsPerWord - 1 - bit)));
+    length += std::min(count, bit + 1);
+    if (count < bit + 1)
+      break;
+  }
+  return std::min(length, max_length);
 }
 
 bool ImageIndex::InsertReferences(const ReferenceTypeTraits& traits,
                                   ReferenceReader&& ref_reader) {
   // Store ReferenceSet for current type (of |group|).
-  DCHECK_NE(kNoTypeTag, traits.type_tag);
-  auto result = reference_sets_.emplace(
-      traits.type_tag, ReferenceSet(traits, pool(traits.pool_tag)));
-  DCHECK(result.second);
+  DCHECK_EQ(traits.type_tag.value(), TypeCount());
+  reference_sets_.emplace_back(traits, pool(traits.pool_tag));
 
-  result.first->second.InitReferences(std::move(ref_reader));
-  for (auto ref : reference_sets_.at(traits.type_tag)) {
-    DCHECK(RangeIsBounded(ref.location, traits.width, size()));
-    auto cur_type_tag = type_tags_.begin() + ref.location;
+  ReferenceSet& ref_set = reference_sets_.back();
+  ref_set.InitReferences(std::move(ref_reader));
+  if (!MarkReferences(ref_set))
+    return false;
+  UpdateReferenceKeys();
+  return true;
+}
+
+bool ImageIndex::MarkReferences(const ReferenceSet& ref_set) {
+  const offset_t width = ref_set.width();
+  for (offset_t location : ref_set.locations()) {
+    DCHECK(RangeIsBounded(location, width, size()));
 
     // Check for overlap with existing reference. If found, then invalidate.
-    if (std::any_of(cur_type_tag, cur_type_tag + traits.width,
-                    [](TypeTag type) { return type != kNoTypeTag; })) {
-      return false;
+    for (offset_t i = location; i < location + width; ++i) {
+      if (IsReference(i)) {
+        LOG(ERROR) << "Reference of type "
+                   << static_cast<int>(ref_set.type_tag().value()) << " at "
+                   << AsHex<8>(location) << " overlaps another reference.";
+        return false;
+      }
     }
-    std::fill(cur_type_tag, cur_type_tag + traits.width, traits.type_tag);
+    if (type_map_ == TypeMap::kDense) {
+      std::fill(type_tags_.begin() + location,
+                type_tags_.begin() + location + width, ref_set.type_tag());
+    }
+
+    reference_bits_[location / kBitsPerWord] |=
+        uint64_t(1) << (location % kBitsPerWord);
+    for (offset_t i = location + 1; i < location + width; ++i)
+      token_bits_[i / kBitsPerWord] &= ~(uint64_t(1) << (i % kBitsPerWord));
   }
   return true;
 }
 
+void ImageIndex::UpdateReferenceKeys() {
+  uint32_t rank = 0;
+  for (size_t word = 0; word < reference_bits_.size(); ++word) {
+    reference_ranks_[word] = rank;
+    rank += PopCount(reference_bits_[word]);
+  }
+  reference_keys_.resize(rank);
+  if (type_map_ == TypeMap::kIntervals)
+    reference_types_.resize(rank);
+
+  for (const ReferenceSet& ref_set : reference_sets_) {
+    for (size_t i = 0; i < ref_set.size(); ++i) {
+      uint32_t ref_rank = ReferenceRank(ref_set.locations()[i]);
+      reference_keys_[ref_rank] = ref_set.target_keys()[i];
+      if (type_map_ == TypeMap::kIntervals)
+        reference_types_[ref_rank] = ref_set.type_tag();
+    }
+  }
+}
+
 }  // namespace zucchini
@@ -8,10 +8,10 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#include <map>
 #include <vector>
 
 #include "squash/base/logging.h"
+#include "squash/zucchini/algorithm.h"
 #include "squash/zucchini/buffer_view.h"
 #include "squash/zucchini/image_utils.h"
 #include "squash/zucchini/reference_set.h"
@@ -26,18 +26,49 @@ class Disassembler;
 // relatively high, so this is only used during patch generation.
 class ImageIndex {
  public:
-  explicit ImageIndex(ConstBufferView image);
+  // Representation of the type of each byte of the image, used by
+  // LookupType().
+  enum class TypeMap {
+    // A TypeTag for each byte of the image, which is read directly.
+    kDense,
+    // A TypeTag for each reference. References are intervals of bytes, whose
+    // bounds are found in the bitmaps of tokens and first bytes of references,
+    // which are held anyway. This saves a byte per byte of the image, at the
+    // cost of slower lookups. These are hardly noticed on executables, whose
+    // references are sparse enough.
+    kIntervals,
+  };
+
+  explicit ImageIndex(ConstBufferView image,
+                      TypeMap type_map = TypeMap::kIntervals);
   ImageIndex(const ImageIndex&) = delete;
   ImageIndex(ImageIndex&& that);
   ~ImageIndex();
 
   // Inserts all references read from |disassembler|. This should be called
-  // exactly once. If overlap between any two references of any type is
-  // encountered, returns false and leaves the object in an invalid state.
-  // Otherwise, returns true.
+  // exactly once. References of different types are read and sorted on up to
+  // |num_threads| threads (one per hardware thread if 0), then checked for
+  // overlaps in order of types, so that the same overlap is found regardless
+  // of |num_threads|. If overlap between any two references of any type is
+  // encountered, logs it, returns false and leaves the object in an invalid
+  // state. Otherwise, returns true.
   // TODO(huangs): Refactor ReaderFactory and WriterFactory so
   // |const Disassembler&| can be used here.
-  bool Initialize(Disassembler* disassembler);
+  bool Initialize(Disassembler* disassembler, size_t num_threads = 1);
+
+  // Alternative to Initialize(), for references that were extracted
+  // beforehand, e.g., by OldImageIndex: Inserts |target_pool| as the pool
+  // identified by |pool_tag|, which must be PoolCount(). This should be called
+  // once for each pool, before inserting any reference.
+  void InsertTargetPool(PoolTag pool_tag, TargetPool&& target_pool);
+
+  // Inserts to |*this| index, all references described by |traits| read from
+  // |ref_reader|, which gets consumed. This should be called exactly once for
+  // each reference type, in increasing order of type tags, starting from 0. If
+  // overlap between any two references of any type is encountered, returns
+  // false and leaves the object in an invalid state. Otherwise, returns true.
+  bool InsertReferences(const ReferenceTypeTraits& traits,
+                        ReferenceReader&& ref_reader);
 
   // Returns the number of reference type the index holds.
   size_t TypeCount() const { return reference_sets_.size(); }
@@ -48,18 +79,62 @@ class ImageIndex {
   // Returns true if |image_[location]| is either:
   // - A raw value.
   // - The first byte of a reference.
-  bool IsToken(offset_t location) const;
+  bool IsToken(offset_t location) const {
+    DCHECK_LT(location, size());
+    return (token_bits_[location / kBitsPerWord] >>
+            (location % kBitsPerWord)) & 1;
+  }
 
   // Returns true if |image_[location]| is part of a reference.
   bool IsReference(offset_t location) const {
-    return LookupType(location) != kNoTypeTag;
+    DCHECK_LT(location, size());
+    size_t word = location / kBitsPerWord;
+    return ((~token_bits_[word] | reference_bits_[word]) >>
+            (location % kBitsPerWord)) & 1;
   }
 
+  // Returns the number of consecutive raw values in |image_| that start at
+  // |location|, up to |max_length|, which must not go past the end of
+  // |image_|.
+  offset_t RawRunLength(offset_t location, offset_t max_length) const;
+
+  // Returns the number of consecutive raw values in |image_| that end right
+  // before |location|, up to |max_length|, which must not exceed |location|.
+  offset_t RawRunLengthBefore(offset_t location, offset_t max_length) const;
+
   // Returns the type tag of the reference covering |location|, or kNoTypeTag if
   // |location| is not part of a reference.
   TypeTag LookupType(offset_t location) const {
     DCHECK_LT(location, size());
-    return type_tags_[location];
+    if (type_map_ == TypeMap::kDense)
+      return type_tags_[location];
+    if (!IsReference(location))
+      return kNoTypeTag;
+    // Walks back to the first byte of the reference, which takes at most a few
+    // steps since references are small.
+    while (!IsToken(location))
+      --location;
+    return reference_types_[ReferenceRank(location)];
+  }
+
+  // Returns the reference covering |location|, which must be part of a
+  // reference.
+  Reference LookupReference(offset_t location) const {
+    DCHECK(IsReference(location));
+    // Walks back to the first byte of the reference, which takes at most a few
+    // steps since references are small.
+    while (!IsToken(location))
+      --location;
+    const TargetPool& target_pool = pool(refs(LookupType(location)).pool_tag());
+    return {location, target_pool.OffsetForKey(LookupTargetKey(location))};
+  }
+
+  // Returns the key of the target of the reference that starts at |location|,
+  // in the pool of its type.
+  key_t LookupTargetKey(offset_t location) const {
+    DCHECK(IsReference(location));
+    DCHECK(IsToken(location));
+    return reference_keys_[ReferenceRank(location)];
   }
 
   // Returns the raw value at |location|.
@@ -68,39 +143,81 @@ class ImageIndex {
     return image_[location];
   }
 
-  const std::map<PoolTag, TargetPool>& target_pools() const {
-    return target_pools_;
-  }
-  const std::map<TypeTag, ReferenceSet>& reference_sets() const {
+  // Returns all pools, indexed by pool tag value.
+  const std::vector<TargetPool>& target_pools() const { return target_pools_; }
+  // Returns all reference sets, indexed by type tag value.
+  const std::vector<ReferenceSet>& reference_sets() const {
     return reference_sets_;
   }
 
   const TargetPool& pool(PoolTag pool_tag) const {
-    return target_pools_.at(pool_tag);
+    DCHECK_LT(pool_tag.value(), target_pools_.size());
+    return target_pools_[pool_tag.value()];
   }
   const ReferenceSet& refs(TypeTag type_tag) const {
-    return reference_sets_.at(type_tag);
+    DCHECK_LT(type_tag.value(), reference_sets_.size());
+    return reference_sets_[type_tag.value()];
   }
 
   // Returns the size of the image.
   size_t size() const { return image_.size(); }
 
+  // Returns the image being indexed.
+  ConstBufferView image() const { return image_; }
+
  private:
-  // Inserts to |*this| index, all references described by |traits| read from
-  // |ref_reader|, which gets consumed. This should be called exactly once for
-  // each reference type. If overlap between any two references of any type is
-  // encountered, returns false and leaves the object in an invalid state.
-  // Otherwise, returns true.
-  bool InsertReferences(const ReferenceTypeTraits& traits,
-                        ReferenceReader&& ref_reader);
+  static constexpr offset_t kBitsPerWord = 64;
+
+  // Returns the word of the bitmap of raw values that holds |location|, which
+  // has a bit set for each raw value.
+  uint64_t RawBits(offset_t location) const {
+    size_t word = location / kBitsPerWord;
+    return token_bits_[word] & ~reference_bits_[word];
+  }
+
+  // Returns the number of references that start before |location|.
+  uint32_t ReferenceRank(offset_t location) const {
+    size_t word = location / kBitsPerWord;
+    uint64_t mask = (uint64_t(1) << (location % kBitsPerWord)) - 1;
+    return reference_ranks_[word] + PopCount(reference_bits_[word] & mask);
+  }
+
+  // Marks bytes spanned by references of |ref_set| in bitmaps and in the type
+  // map. Returns false if any of them overlaps a reference already marked.
+  bool MarkReferences(const ReferenceSet& ref_set);
+
+  // Updates |reference_ranks_|, |reference_keys_| and |reference_types_| once
+  // references are inserted.
+  void UpdateReferenceKeys();
 
   const ConstBufferView image_;
+  const TypeMap type_map_;
 
-  // Used for random access lookup of reference type, for each byte in |image_|.
+  // Used for random access lookup of reference type, for each byte in
+  // |image_|, only with TypeMap::kDense.
   std::vector<TypeTag> type_tags_;
 
-  std::map<PoolTag, TargetPool> target_pools_;
-  std::map<TypeTag, ReferenceSet> reference_sets_;
+  // Bitmap with a bit for each byte in |image_|, which is set if the byte is a
+  // token.
+  std::vector<uint64_t> token_bits_;
+  // Bitmap with a bit for each byte in |image_|, which is set if the byte is
+  // the first byte of a reference.
+  std::vector<uint64_t> reference_bits_;
+  // For each word of |reference_bits_|, the number of bits set in all previous
+  // words.
+  std::vector<uint32_t> reference_ranks_;
+  // For each reference, in order of location across all types, the key of its
+  // target in its pool.
+  std::vector<key_t> reference_keys_;
+  // For each reference, in the same order, its type, only with
+  // TypeMap::kIntervals.
+  std::vector<TypeTag> reference_types_;
+
+  // Indexed by pool tag value. ReferenceSet instances refer to pools, so no
+  // pool is inserted once references are.
+  std::vector<TargetPool> target_pools_;
+  // Indexed by type tag value.
+  std::vector<ReferenceSet> reference_sets_;
 };
 
 }  // namespace zucchini
@@ -6,6 +6,7 @@
 
 #include <stddef.h>
 
+#include <algorithm>
 #include <numeric>
 #include <vector>
 
@@ -129,4 +130,190 @@ TEST_F(ImageIndexTest, IsReference) {
     EXPECT_EQ(expected[i], image_index_.IsReference(i));
 }
 
+TEST_F(ImageIndexTest, LookupReference) {
+  InitializeWithDefaultTestData();
+
+  std::vector<Reference> expected = {{1, 0},  {3, 3},  {8, 1},
+                                     {10, 2}, {12, 4}, {17, 5}};
+  for (const Reference& ref : expected) {
+    TypeTag type = image_index_.LookupType(ref.location);
+    for (offset_t i = 0; i < image_index_.refs(type).width(); ++i)
+      EXPECT_EQ(ref, image_index_.LookupReference(ref.location + i));
+  }
+}
+
+TEST_F(ImageIndexTest, LookupTargetKey) {
+  // Pools share target 1.
+  TestDisassembler disasm({2, TypeTag(0), PoolTag(0)}, {{1, 5}, {8, 1}},
+                          {4, TypeTag(1), PoolTag(1)}, {{3, 1}},
+                          {3, TypeTag(2), PoolTag(1)}, {{12, 9}});
+  ASSERT_TRUE(image_index_.Initialize(&disasm));
+
+  // Keys are the same as with a lookup in the pool of each type.
+  EXPECT_EQ(std::vector<offset_t>({1, 5}),
+            image_index_.pool(PoolTag(0)).targets());
+  EXPECT_EQ(std::vector<offset_t>({1, 9}),
+            image_index_.pool(PoolTag(1)).targets());
+  for (const Reference& ref :
+       std::vector<Reference>({{1, 5}, {3, 1}, {8, 1}, {12, 9}})) {
+    PoolTag pool_tag =
+        image_index_.refs(image_index_.LookupType(ref.location)).pool_tag();
+    EXPECT_EQ(image_index_.pool(pool_tag).KeyForOffset(ref.target),
+              image_index_.LookupTargetKey(ref.location));
+    EXPECT_EQ(ref, image_index_.LookupReference(ref.location + 1));
+  }
+}
+
+TEST(ImageIndexLargeTest, LookupReference) {
+  // References that span several bitmap words, inserted out of order of
+  // location across types.
+  std::vector<uint8_t> buffer(1000);
+  ImageIndex image_index(ConstBufferView(buffer.data(), buffer.size()));
+  std::vector<Reference> refs0;
+  std::vector<Reference> refs1;
+  for (offset_t i = 0; i + 4 <= buffer.size(); i += 7) {
+    if (i % 3)
+      refs0.push_back({i, i / 7});
+    else
+      refs1.push_back({i, i / 7});
+  }
+  TestDisassembler disasm({4, TypeTag(0), PoolTag(0)}, refs0,
+                          {3, TypeTag(1), PoolTag(0)}, refs1,
+                          {2, TypeTag(2), PoolTag(1)}, {});
+  ASSERT_TRUE(image_index.Initialize(&disasm));
+
+  for (const auto& refs : {refs0, refs1}) {
+    for (const Reference& ref : refs) {
+      EXPECT_TRUE(image_index.IsToken(ref.location));
+      EXPECT_FALSE(image_index.IsToken(ref.location + 1));
+      EXPECT_EQ(ref, image_index.LookupReference(ref.location));
+      EXPECT_EQ(ref, image_index.LookupReference(ref.location + 2));
+    }
+  }
+}
+
+TEST(ImageIndexLargeTest, RawRunLength) {
+  // Runs of raw values that span several bitmap words.
+  std::vector<uint8_t> buffer(1000);
+  ImageIndex image_index(ConstBufferView(buffer.data(), buffer.size()));
+  TestDisassembler disasm({4, TypeTag(0), PoolTag(0)},
+                          {{10, 0}, {14, 0}, {100, 0}, {300, 0}},
+                          {2, TypeTag(1), PoolTag(0)}, {{127, 0}, {998, 0}},
+                          {3, TypeTag(2), PoolTag(1)}, {{200, 0}});
+  ASSERT_TRUE(image_index.Initialize(&disasm));
+
+  for (offset_t location = 0; location <= buffer.size(); ++location) {
+    offset_t expected_length = 0;
+    while (location + expected_length < buffer.size() &&
+           !image_index.IsReference(location + expected_length)) {
+      ++expected_length;
+    }
+    offset_t expected_length_before = 0;
+    while (expected_length_before < location &&
+           !image_index.IsReference(location - expected_length_before - 1)) {
+      ++expected_length_before;
+    }
+    for (offset_t max_length : {0U, 1U, 70U, 1000U}) {
+      offset_t max_length_after =
+          std::min<offset_t>(max_length, buffer.size() - location);
+      EXPECT_EQ(std::min(expected_length, max_length_after),
+                image_index.RawRunLength(location, max_length_after));
+      offset_t max_length_before = std::min(max_length, location);
+      EXPECT_EQ(std::min(expected_length_before, max_length_before),
+                image_index.RawRunLengthBefore(location, max_length_before));
+    }
+  }
+}
+
+TEST(ImageIndexTypeMapTest, Intervals) {
+  // References that span several bitmap words, with sparse and dense regions.
+  std::vector<uint8_t> buffer(1000);
+  std::vector<Reference> refs0;
+  std::vector<Reference> refs1;
+  for (offset_t i = 0; i + 4 <= buffer.size(); i += i < 500 ? 41 : 5) {
+    if (i % 3)
+      refs0.push_back({i, i / 5});
+    else
+      refs1.push_back({i, i / 5});
+  }
+  TestDisassembler disasm({4, TypeTag(0), PoolTag(0)}, refs0,
+                          {2, TypeTag(1), PoolTag(1)}, refs1,
+                          {3, TypeTag(2), PoolTag(1)}, {{997, 0}});
+  ImageIndex dense_index(ConstBufferView(buffer.data(), buffer.size()),
+                         ImageIndex::TypeMap::kDense);
+  ImageIndex intervals_index(ConstBufferView(buffer.data(), buffer.size()),
+                             ImageIndex::TypeMap::kIntervals);
+  ASSERT_TRUE(dense_index.Initialize(&disasm));
+  ASSERT_TRUE(intervals_index.Initialize(&disasm));
+
+  // Both type maps describe the same content.
+  for (offset_t location = 0; location < buffer.size(); ++location) {
+    EXPECT_EQ(dense_index.LookupType(location),
+              intervals_index.LookupType(location));
+    EXPECT_EQ(dense_index.IsReference(location),
+              intervals_index.IsReference(location));
+    if (dense_index.IsReference(location)) {
+      EXPECT_EQ(dense_index.LookupReference(location),
+                intervals_index.LookupReference(location));
+    }
+  }
+  EXPECT_EQ(TypeTag(2), intervals_index.LookupType(999));
+  EXPECT_EQ(kNoTypeTag, intervals_index.LookupType(996));
+
+  // Overlaps are also detected.
+  TestDisassembler overlap_disasm({2, TypeTag(0), PoolTag(0)}, {{1, 0}},
+                                  {4, TypeTag(1), PoolTag(0)}, {{3, 3}},
+                                  {3, TypeTag(2), PoolTag(1)}, {{5, 0}});
+  ImageIndex overlap_index(ConstBufferView(buffer.data(), buffer.size()),
+                           ImageIndex::TypeMap::kIntervals);
+  EXPECT_FALSE(overlap_index.Initialize(&overlap_disasm));
+}
+
+TEST(ImageIndexThreadsTest, Initialize) {
+  std::vector<uint8_t> buffer(1000);
+  std::vector<Reference> refs0;
+  std::vector<Reference> refs1;
+  for (offset_t i = 0; i < 990; i += 7) {
+    if (i % 3)
+      refs0.push_back({i, i / 3});
+    else
+      refs1.push_back({i, i / 5});
+  }
+  TestDisassembler disasm({4, TypeTag(0), PoolTag(0)}, refs0,
+                          {2, TypeTag(1), PoolTag(1)}, refs1,
+                          {3, TypeTag(2), PoolTag(0)}, {{997, 3}});
+  ImageIndex serial_index(ConstBufferView(buffer.data(), buffer.size()));
+  ImageIndex parallel_index(ConstBufferView(buffer.data(), buffer.size()));
+  ASSERT_TRUE(serial_index.Initialize(&disasm, 1));
+  ASSERT_TRUE(parallel_index.Initialize(&disasm, 4));
+
+  ASSERT_EQ(serial_index.PoolCount(), parallel_index.PoolCount());
+  for (uint8_t pool = 0; pool < serial_index.PoolCount(); ++pool) {
+    EXPECT_EQ(serial_index.pool(PoolTag(pool)).targets(),
+              parallel_index.pool(PoolTag(pool)).targets());
+    EXPECT_EQ(serial_index.pool(PoolTag(pool)).types(),
+              parallel_index.pool(PoolTag(pool)).types());
+  }
+  ASSERT_EQ(serial_index.TypeCount(), parallel_index.TypeCount());
+  for (uint8_t type = 0; type < serial_index.TypeCount(); ++type) {
+    EXPECT_EQ(serial_index.refs(TypeTag(type)).GetReferences(),
+              parallel_index.refs(TypeTag(type)).GetReferences());
+  }
+  for (offset_t location = 0; location < buffer.size(); ++location) {
+    EXPECT_EQ(serial_index.LookupType(location),
+              parallel_index.LookupType(location));
+    if (serial_index.IsReference(location) && serial_index.IsToken(location)) {
+      EXPECT_EQ(serial_index.LookupTargetKey(location),
+                parallel_index.LookupTargetKey(location));
+    }
+  }
+
+  // Overlaps across types are found as well.
+  TestDisassembler overlap_disasm({4, TypeTag(0), PoolTag(0)}, refs0,
+                                  {2, TypeTag(1), PoolTag(1)}, refs1,
+                                  {3, TypeTag(2), PoolTag(0)}, {{988, 3}});
+  ImageIndex overlap_index(ConstBufferView(buffer.data(), buffer.size()));
+  EXPECT_FALSE(overlap_index.Initialize(&overlap_disasm, 4));
+}
+
 }  // namespace zucchini
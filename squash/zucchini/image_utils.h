@@ -28,6 +28,10 @@ constexpr offset_t kInvalidOffset = static_cast<offset_t>(-1);
 // key_t is used to identify an offset in a table.
 using key_t = uint32_t;
 
+// Read-only view of a suffix array of an image (or of its projections), which
+// may be owned elsewhere, e.g., by a mapped index file.
+using SuffixArrayView = internal::BufferViewBase<const offset_t>;
+
 enum Bitness : uint8_t {
   // The numerical values are intended to simplify WidthOf() below.
   kBit32 = 4,
@@ -2,18 +2,24 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include <algorithm>
+#include <memory>
+#include <random>
 #include <string>
 #include <vector>
 
 #include "boost/filesystem.hpp"
 #include "gtest/gtest.h"
+#include "squash/base/memory/ptr_util.h"
 #include "squash/base/optional.h"
 #include "squash/zucchini/buffer_view.h"
 #include "squash/zucchini/mapped_file.h"
+#include "squash/zucchini/old_image_index.h"
 #include "squash/zucchini/patch_reader.h"
+#include "squash/zucchini/patch_utils.h"
 #include "squash/zucchini/patch_writer.h"
 #include "squash/zucchini/zucchini.h"
 
@@ -23,17 +29,11 @@ boost::filesystem::path MakeTestPath(const std::string& filename) {
   return boost::filesystem::path("squash") / "testdata" / filename;
 }
 
-void TestGenApply(const std::string& old_filename,
-                  const std::string& new_filename,
-                  bool raw) {
-  boost::filesystem::path old_path = MakeTestPath(old_filename);
-  boost::filesystem::path new_path = MakeTestPath(new_filename);
-
-  MappedFileReader old_file(old_path);
-  MappedFileReader new_file(new_path);
-  ConstBufferView old_region = old_file.region();
-  ConstBufferView new_region = new_file.region();
-
+// Generates a patch from |old_region| to |new_region|, applies it, and checks
+// that the result is identical to |new_region|.
+void TestGenApplyRegions(ConstBufferView old_region,
+                         ConstBufferView new_region,
+                         bool raw) {
   EnsemblePatchWriter patch_writer(old_region, new_region);
 
   // Generate patch from "old" to "new".
@@ -56,9 +56,9 @@ void TestGenApply(const std::string& old_filename,
   // Check basic properties.
   EXPECT_TRUE(patch_reader->CheckOldFile(old_region));
   EXPECT_TRUE(patch_reader->CheckNewFile(new_region));
-  EXPECT_EQ(old_file.length(), patch_reader->header().old_size);
+  EXPECT_EQ(old_region.size(), patch_reader->header().old_size);
   // If new_size doesn't match expectation, the function is aborted.
-  ASSERT_EQ(new_file.length(), patch_reader->header().new_size);
+  ASSERT_EQ(new_region.size(), patch_reader->header().new_size);
 
   // Apply patch to "old" to get "patched new", ensure it's identical to "new".
   std::vector<uint8_t> patched_new_buffer(new_region.size());
@@ -71,6 +71,122 @@ void TestGenApply(const std::string& old_filename,
                          patched_new_buffer.begin()));
 }
 
+void TestGenApply(const std::string& old_filename,
+                  const std::string& new_filename,
+                  bool raw) {
+  MappedFileReader old_file(MakeTestPath(old_filename));
+  MappedFileReader new_file(MakeTestPath(new_filename));
+  TestGenApplyRegions(old_file.region(), new_file.region(), raw);
+}
+
+// Returns an ensemble made of test files |filenames|, each preceded by
+// |padding_size| random bytes drawn from |rng|.
+std::vector<uint8_t> MakeEnsemble(const std::vector<std::string>& filenames,
+                                  size_t padding_size,
+                                  std::mt19937* rng) {
+  std::vector<uint8_t> ensemble;
+  for (const std::string& filename : filenames) {
+    for (size_t i = 0; i < padding_size; ++i)
+      ensemble.push_back(static_cast<uint8_t>((*rng)()));
+    MappedFileReader file(MakeTestPath(filename));
+    EXPECT_TRUE(file.IsValid());
+    ensemble.insert(ensemble.end(), file.region().begin(),
+                    file.region().end());
+  }
+  return ensemble;
+}
+
+// Generates patches from |old_region| to |new_region| with and without an
+// index of |old_region|, and checks that they're identical.
+void TestGenWithIndexRegions(ConstBufferView old_region,
+                             ConstBufferView new_region,
+                             bool raw) {
+  EnsemblePatchWriter patch_writer(old_region, new_region);
+  ASSERT_EQ(status::kStatusSuccess,
+            raw ? GenerateRaw(old_region, new_region, &patch_writer)
+                : GenerateEnsemble(old_region, new_region, &patch_writer));
+  std::vector<uint8_t> patch_buffer(patch_writer.SerializedSize());
+  patch_writer.SerializeInto({patch_buffer.data(), patch_buffer.size()});
+
+  // Round trip the index through its serialized form, as done by "-index".
+  base::Optional<OldImageIndex> old_index = OldImageIndex::Create(
+      old_region, raw ? PatchType::kRawPatch : PatchType::kEnsemblePatch);
+  ASSERT_TRUE(old_index.has_value());
+  std::vector<uint8_t> index_buffer(old_index->SerializedSize());
+  ASSERT_TRUE(
+      old_index->SerializeInto({index_buffer.data(), index_buffer.size()}));
+  base::Optional<OldImageIndex> loaded_index = OldImageIndex::Load(
+      old_region, {index_buffer.data(), index_buffer.size()});
+  ASSERT_TRUE(loaded_index.has_value());
+
+  EnsemblePatchWriter index_patch_writer(old_region, new_region);
+  ASSERT_EQ(status::kStatusSuccess,
+            raw ? GenerateRaw(*loaded_index, new_region, &index_patch_writer)
+                : GenerateEnsemble(*loaded_index, new_region,
+                                   &index_patch_writer));
+  std::vector<uint8_t> index_patch_buffer(
+      index_patch_writer.SerializedSize());
+  index_patch_writer.SerializeInto(
+      {index_patch_buffer.data(), index_patch_buffer.size()});
+  EXPECT_EQ(patch_buffer, index_patch_buffer);
+}
+
+void TestGenWithIndex(const std::string& old_filename,
+                      const std::string& new_filename,
+                      bool raw) {
+  MappedFileReader old_file(MakeTestPath(old_filename));
+  MappedFileReader new_file(MakeTestPath(new_filename));
+  TestGenWithIndexRegions(old_file.region(), new_file.region(), raw);
+}
+
+// Generates patches from |old_region| to each of |new_regions| in a batch, and
+// checks that they're identical to patches generated one by one.
+void TestGenBatchRegions(ConstBufferView old_region,
+                         const std::vector<ConstBufferView>& new_regions,
+                         const GenerateOptions& options) {
+  base::Optional<OldImageIndex> old_index =
+      OldImageIndex::Create(old_region, PatchType::kEnsemblePatch);
+  ASSERT_TRUE(old_index.has_value());
+
+  std::vector<std::vector<uint8_t>> patch_buffers(new_regions.size());
+  ASSERT_EQ(status::kStatusSuccess,
+            GenerateBatch(*old_index, new_regions, options,
+                          [&patch_buffers](
+                              size_t index,
+                              const EnsemblePatchWriter& patch_writer) {
+                            std::vector<uint8_t>& buffer =
+                                patch_buffers[index];
+                            buffer.resize(patch_writer.SerializedSize());
+                            patch_writer.SerializeInto(
+                                {buffer.data(), buffer.size()});
+                            return status::kStatusSuccess;
+                          }));
+
+  for (size_t i = 0; i < new_regions.size(); ++i) {
+    EnsemblePatchWriter patch_writer(old_region, new_regions[i]);
+    ASSERT_EQ(status::kStatusSuccess,
+              GenerateEnsemble(old_region, new_regions[i], &patch_writer,
+                               options));
+    std::vector<uint8_t> patch_buffer(patch_writer.SerializedSize());
+    patch_writer.SerializeInto({patch_buffer.data(), patch_buffer.size()});
+    EXPECT_EQ(patch_buffer, patch_buffers[i]);
+  }
+}
+
+void TestGenBatch(const std::string& old_filename,
+                  const std::vector<std::string>& new_filenames,
+                  const GenerateOptions& options) {
+  MappedFileReader old_file(MakeTestPath(old_filename));
+  std::vector<std::unique_ptr<MappedFileReader>> new_files;
+  std::vector<ConstBufferView> new_regions;
+  for (const std::string& new_filename : new_filenames) {
+    new_files.push_back(
+        base::MakeUnique<MappedFileReader>(MakeTestPath(new_filename)));
+    new_regions.push_back(new_files.back()->region());
+  }
+  TestGenBatchRegions(old_file.region(), new_regions, options);
+}
+
 TEST(EndToEndTest, GenApplyRaw) {
   TestGenApply("setup1.exe", "setup2.exe", true);
   TestGenApply("chrome64_1.exe", "chrome64_2.exe", true);
@@ -90,4 +206,76 @@ TEST(EndToEndTest, GenApplyCross) {
   TestGenApply("setup1.exe", "chrome64_1.exe", false);
 }
 
+TEST(EndToEndTest, GenApplyEnsemble) {
+  std::mt19937 rng(0);
+  std::vector<uint8_t> old_image =
+      MakeEnsemble({"setup1.exe", "chrome64_1.exe"}, 1000, &rng);
+  std::vector<uint8_t> new_image =
+      MakeEnsemble({"chrome64_2.exe", "setup2.exe"}, 3000, &rng);
+  ConstBufferView old_region(old_image.data(), old_image.size());
+  ConstBufferView new_region(new_image.data(), new_image.size());
+  TestGenApplyRegions(old_region, new_region, false);
+
+  // Each executable gets an element, and paddings get raw elements.
+  EnsemblePatchWriter patch_writer(old_region, new_region);
+  ASSERT_EQ(status::kStatusSuccess,
+            GenerateEnsemble(old_region, new_region, &patch_writer));
+  std::vector<uint8_t> patch_buffer(patch_writer.SerializedSize());
+  patch_writer.SerializeInto({patch_buffer.data(), patch_buffer.size()});
+  base::Optional<EnsemblePatchReader> patch_reader =
+      EnsemblePatchReader::Create({patch_buffer.data(), patch_buffer.size()});
+  ASSERT_TRUE(patch_reader.has_value());
+  size_t num_executables = 0;
+  for (const PatchElementReader& element : patch_reader->elements())
+    num_executables += element.new_element().exe_type != kExeTypeNoOp;
+  EXPECT_EQ(2U, num_executables);
+  EXPECT_EQ(kExeTypeNoOp, patch_reader->elements()[0].new_element().exe_type);
+  EXPECT_LE(4U, patch_reader->elements().size());
+}
+
+TEST(EndToEndTest, GenWithIndex) {
+  TestGenWithIndex("setup1.exe", "setup2.exe", true);
+  TestGenWithIndex("setup1.exe", "setup2.exe", false);
+  TestGenWithIndex("chrome64_1.exe", "chrome64_2.exe", false);
+}
+
+TEST(EndToEndTest, GenWithIndexEnsemble) {
+  std::mt19937 rng(0);
+  std::vector<uint8_t> old_image =
+      MakeEnsemble({"setup1.exe", "chrome64_1.exe"}, 1000, &rng);
+  std::vector<uint8_t> new_image =
+      MakeEnsemble({"chrome64_2.exe", "setup2.exe"}, 3000, &rng);
+  ConstBufferView old_region(old_image.data(), old_image.size());
+  ConstBufferView new_region(new_image.data(), new_image.size());
+
+  // Each executable of "old" is indexed.
+  base::Optional<OldImageIndex> old_index =
+      OldImageIndex::Create(old_region, PatchType::kEnsemblePatch);
+  ASSERT_TRUE(old_index.has_value());
+  ASSERT_EQ(2U, old_index->elements().size());
+  EXPECT_EQ(1000U, old_index->elements()[0].offset);
+  for (size_t i = 0; i < old_index->elements().size(); ++i) {
+    EXPECT_TRUE(old_index->element_image_index(i));
+    EXPECT_EQ(old_index->elements()[i].size,
+              old_index->element_suffix_array(i).size());
+  }
+
+  TestGenWithIndexRegions(old_region, new_region, false);
+  TestGenBatchRegions(old_region, {new_region, old_region}, GenerateOptions());
+}
+
+TEST(EndToEndTest, GenBatch) {
+  const std::vector<std::string> new_filenames = {"setup2.exe", "setup1.exe",
+                                                  "chrome64_1.exe"};
+  for (size_t num_threads : {1, 2, 0}) {
+    GenerateOptions options;
+    options.num_threads = num_threads;
+    TestGenBatch("setup1.exe", new_filenames, options);
+  }
+  // Options other than threads apply to each patch.
+  GenerateOptions options(GenerateLevel::kFast);
+  options.num_threads = 2;
+  TestGenBatch("setup1.exe", new_filenames, options);
+}
+
 }  // namespace zucchini
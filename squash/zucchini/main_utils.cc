@@ -6,6 +6,10 @@
 
 #include <stddef.h>
 
+#if defined(__linux__)
+#include <sys/resource.h>
+#endif  // defined(__linux__)
+
 #include <chrono>
 #include <memory>
 #include <ostream>
@@ -27,11 +31,13 @@ struct Command {
   constexpr Command(const char* name_in,
                     const char* usage_in,
                     int num_args_in,
-                    CommandFunction command_function_in)
+                    CommandFunction command_function_in,
+                    int num_repeated_args_in = 0)
       : name(name_in),
         usage(usage_in),
         num_args(num_args_in),
-        command_function(command_function_in) {}
+        command_function(command_function_in),
+        num_repeated_args(num_repeated_args_in) {}
   Command(const Command&) = default;
   ~Command() = default;
 
@@ -46,12 +52,26 @@ struct Command {
 
   // Main function to run for the command.
   const CommandFunction command_function;
+
+  // Number of trailing arguments among |num_args| that can be repeated any
+  // number of times, e.g., to process many files at once.
+  const int num_repeated_args;
 };
 
 /******** List of Zucchini commands ********/
 
 constexpr Command kCommands[] = {
-    {"gen", "-gen <old_file> <new_file> <patch_file> [-raw]", 3, &MainGen},
+    {"gen",
+     "-gen <old_file> <new_file> <patch_file> [-raw] "
+     "[-old-index=<index_file>] [-level=fast|default|max] [-matcher=sa|hash] "
+     "[-threads=<count>]",
+     3, &MainGen},
+    {"gen-batch",
+     "-gen-batch <old_file> <new_file> <patch_file> "
+     "[<new_file> <patch_file> ...] [-raw] [-old-index=<index_file>] "
+     "[-level=fast|default|max] [-matcher=sa|hash] [-threads=<count>]",
+     3, &MainGenBatch, 2},
+    {"index", "-index <old_file> <index_file> [-raw]", 2, &MainIndex},
     {"apply", "-apply <old_file> <patch_file> <new_file>", 3, &MainApply},
     {"read", "-read <exe> [-dump]", 1, &MainRead},
     {"detect", "-detect <archive_file>", 1, &MainDetect},
@@ -100,6 +120,15 @@ class ScopedResourceUsageTracker {
               << " KiB";
 #endif  // !defined(OS_MACOSX)*/
 
+#if defined(__linux__)
+    // |ru_maxrss| is the peak resident set size of the process, in KiB.
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+      LOG(INFO) << "Zucchini.PeakWorkingSetSize " << usage.ru_maxrss
+                << " KiB";
+    }
+#endif  // defined(__linux__)
+
     std::chrono::duration<double> diff = end_time - start_time_;
     LOG(INFO) << "Zucchini.TotalTime " << diff.count() << " s";
   }
@@ -115,14 +144,21 @@ class ScopedResourceUsageTracker {
 /******** Helper functions ********/
 
 // Translates |command_line| arguments to a vector of base::FilePath (expecting
-// exactly |expected_count|). On success, writes the results to |paths| and
-// returns true. Otherwise returns false.
+// exactly |expected_count|, followed by any multiple of |repeated_count|
+// additional arguments if |repeated_count| is not 0). On success, writes the
+// results to |paths| and returns true. Otherwise returns false.
 bool CheckAndGetFilePathParams(const base::CommandLine& command_line,
                                size_t expected_count,
+                               size_t repeated_count,
                                std::vector<boost::filesystem::path>* paths) {
   const base::CommandLine::StringVector& args = command_line.GetArgs();
-  if (args.size() != expected_count)
+  if (args.size() < expected_count)
+    return false;
+  size_t extra_count = args.size() - expected_count;
+  if (repeated_count == 0 ? extra_count != 0
+                          : extra_count % repeated_count != 0) {
     return false;
+  }
 
   paths->clear();
   paths->reserve(args.size());
@@ -171,7 +207,8 @@ zucchini::status::Code RunZucchiniCommand(const base::CommandLine& command_line,
 
   // Try to parse filename arguments. On failure, print usage and quit.
   std::vector<boost::filesystem::path> paths;
-  if (!CheckAndGetFilePathParams(command_line, command_use->num_args, &paths)) {
+  if (!CheckAndGetFilePathParams(command_line, command_use->num_args,
+                                 command_use->num_repeated_args, &paths)) {
     err << command_use->usage << std::endl;
     PrintUsage(err);
     return zucchini::status::kStatusInvalidParam;
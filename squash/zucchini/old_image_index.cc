@@ -0,0 +1,432 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "squash/zucchini/old_image_index.h"
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <memory>
+#include <utility>
+
+#include "base/numerics/safe_conversions.h"
+#include "squash/base/logging.h"
+#include "squash/base/memory/ptr_util.h"
+#include "squash/zucchini/algorithm.h"
+#include "squash/zucchini/buffer_source.h"
+#include "squash/zucchini/crc32.h"
+#include "squash/zucchini/disassembler.h"
+#include "squash/zucchini/element_detection.h"
+#include "squash/zucchini/ensemble_matcher.h"
+#include "squash/zucchini/reference_set.h"
+#include "squash/zucchini/zucchini_gen.h"
+
+namespace zucchini {
+
+namespace {
+
+// Reads References from an array, e.g., found in an index file.
+class ReferenceArrayReader : public ReferenceReader {
+ public:
+  ReferenceArrayReader(const Reference* first, const Reference* last)
+      : current_(first), last_(last) {}
+
+  // ReferenceReader:
+  base::Optional<Reference> GetNext() override {
+    if (current_ == last_)
+      return base::nullopt;
+    return *current_++;
+  }
+
+ private:
+  const Reference* current_;
+  const Reference* last_;
+};
+
+// If sufficient space is available, writes the binary representation of
+// |count| values starting at |first| into |sink| and returns true. Otherwise
+// returns false.
+template <class T>
+bool PutArray(const T* first, size_t count, BufferSink* sink) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(first);
+  return sink->PutRange(bytes, bytes + count * sizeof(T));
+}
+
+// Returns true if |suffix_array| is a permutation of [0, |suffix_array.size()|).
+bool IsPermutation(SuffixArrayView suffix_array) {
+  std::vector<bool> seen(suffix_array.size(), false);
+  for (offset_t suffix : suffix_array) {
+    if (suffix >= suffix_array.size() || seen[suffix])
+      return false;
+    seen[suffix] = true;
+  }
+  return true;
+}
+
+// Reads |pool_count| target pools and |type_count| reference types from
+// |source| into |image_index|, which is empty. Returns false if they are
+// invalid.
+bool ReadImageIndex(uint32_t pool_count,
+                    uint32_t type_count,
+                    BufferSource* source,
+                    ImageIndex* image_index) {
+  // Pool associated with each type listed by pools.
+  std::map<TypeTag, PoolTag> type_pools;
+  for (uint32_t i = 0; i < pool_count; ++i) {
+    OldImageIndexPoolHeader pool_header;
+    const uint32_t* types = nullptr;
+    const offset_t* targets = nullptr;
+    if (!source->GetValue(&pool_header) ||
+        !(types = source->GetArray<uint32_t>(pool_header.type_count)) ||
+        !(targets = source->GetArray<offset_t>(pool_header.target_count))) {
+      LOG(ERROR) << "Impossible to read target pool from index.";
+      return false;
+    }
+    PoolTag pool_tag(static_cast<uint8_t>(pool_header.pool_tag));
+    // Pools are listed in order of tags, which are consecutive.
+    if (pool_header.pool_tag >= kNoPoolTag.value() ||
+        pool_header.pool_tag != image_index->PoolCount()) {
+      LOG(ERROR) << "Invalid pool_tag encountered.";
+      return false;
+    }
+    // Targets must be sorted and unique.
+    if (std::adjacent_find(targets, targets + pool_header.target_count,
+                           std::greater_equal<offset_t>()) !=
+        targets + pool_header.target_count) {
+      LOG(ERROR) << "Unsorted targets encountered.";
+      return false;
+    }
+    TargetPool target_pool(
+        std::vector<offset_t>(targets, targets + pool_header.target_count));
+    for (uint32_t j = 0; j < pool_header.type_count; ++j) {
+      TypeTag type_tag(static_cast<uint8_t>(types[j]));
+      if (types[j] >= kNoTypeTag.value() ||
+          !type_pools.emplace(type_tag, pool_tag).second) {
+        LOG(ERROR) << "Invalid type_tag encountered.";
+        return false;
+      }
+      target_pool.AddType(type_tag);
+    }
+    image_index->InsertTargetPool(pool_tag, std::move(target_pool));
+  }
+
+  if (type_count != type_pools.size()) {
+    LOG(ERROR) << "Unexpected number of reference types.";
+    return false;
+  }
+  size_t image_size = image_index->size();
+  for (uint32_t i = 0; i < type_count; ++i) {
+    OldImageIndexTypeHeader type_header;
+    const Reference* refs = nullptr;
+    if (!source->GetValue(&type_header) ||
+        !(refs = source->GetArray<Reference>(type_header.reference_count))) {
+      LOG(ERROR) << "Impossible to read references from index.";
+      return false;
+    }
+    auto type_pool =
+        type_pools.find(TypeTag(static_cast<uint8_t>(type_header.type_tag)));
+    if (type_header.type_tag >= kNoTypeTag.value() ||
+        type_pool == type_pools.end() ||
+        type_header.pool_tag != type_pool->second.value() ||
+        type_header.type_tag != image_index->TypeCount() ||
+        type_header.width == 0) {
+      LOG(ERROR) << "Invalid reference type encountered.";
+      return false;
+    }
+    // References must be sorted, within the image and point to targets in
+    // their pool. Overlaps are detected by InsertReferences().
+    const TargetPool& target_pool = image_index->pool(type_pool->second);
+    offset_t next_location = 0;
+    for (const Reference* ref = refs; ref != refs + type_header.reference_count;
+         ++ref) {
+      if (ref->location < next_location ||
+          !RangeIsBounded<offset_t>(ref->location, type_header.width,
+                                    image_size) ||
+          !std::binary_search(target_pool.begin(), target_pool.end(),
+                              ref->target)) {
+        LOG(ERROR) << "Invalid reference encountered.";
+        return false;
+      }
+      next_location = ref->location + type_header.width;
+    }
+    ReferenceTypeTraits traits(type_header.width, type_pool->first,
+                               type_pool->second);
+    if (!image_index->InsertReferences(
+            traits, ReferenceArrayReader(
+                        refs, refs + type_header.reference_count))) {
+      LOG(ERROR) << "Overlapping references encountered.";
+      return false;
+    }
+  }
+  return true;
+}
+
+// Reads a suffix array of |size| suffixes from |source| into |suffix_array|,
+// which refers to |source| in place. Returns false if it is invalid.
+bool ReadSuffixArray(size_t size,
+                     BufferSource* source,
+                     SuffixArrayView* suffix_array) {
+  uint32_t suffix_array_size = 0;
+  const offset_t* suffixes = nullptr;
+  if (!source->GetValue(&suffix_array_size) ||
+      !(suffixes = source->GetArray<offset_t>(suffix_array_size))) {
+    LOG(ERROR) << "Impossible to read suffix array from index.";
+    return false;
+  }
+  *suffix_array = {suffixes, suffix_array_size};
+  if (suffix_array_size != size || !IsPermutation(*suffix_array)) {
+    LOG(ERROR) << "Index contains invalid suffix array.";
+    return false;
+  }
+  return true;
+}
+
+// Returns the serialized size of the target pools and reference types of
+// |image_index|.
+size_t ImageIndexSerializedSize(const ImageIndex& image_index) {
+  size_t serialized_size = 0;
+  for (const TargetPool& target_pool : image_index.target_pools()) {
+    serialized_size += sizeof(OldImageIndexPoolHeader) +
+                       target_pool.types().size() * sizeof(uint32_t) +
+                       target_pool.size() * sizeof(offset_t);
+  }
+  for (const ReferenceSet& references : image_index.reference_sets()) {
+    serialized_size += sizeof(OldImageIndexTypeHeader) +
+                       references.size() * sizeof(Reference);
+  }
+  return serialized_size;
+}
+
+// If sufficient space is available, writes the target pools and reference
+// types of |image_index| into |sink| and returns true. Otherwise returns false.
+bool PutImageIndex(const ImageIndex& image_index, BufferSink* sink) {
+  for (size_t pool_index = 0; pool_index < image_index.PoolCount();
+       ++pool_index) {
+    const TargetPool& target_pool = image_index.target_pools()[pool_index];
+    const std::vector<TypeTag>& types = target_pool.types();
+    const std::vector<offset_t>& targets = target_pool.targets();
+    OldImageIndexPoolHeader pool_header = {
+        base::checked_cast<uint32_t>(pool_index),
+        base::checked_cast<uint32_t>(types.size()),
+        base::checked_cast<uint32_t>(targets.size())};
+    if (!sink->PutValue<OldImageIndexPoolHeader>(pool_header))
+      return false;
+    for (TypeTag type_tag : types) {
+      if (!sink->PutValue<uint32_t>(type_tag.value()))
+        return false;
+    }
+    if (!PutArray(targets.data(), targets.size(), sink))
+      return false;
+  }
+
+  for (const ReferenceSet& references : image_index.reference_sets()) {
+    OldImageIndexTypeHeader type_header = {
+        references.type_tag().value(), references.pool_tag().value(),
+        references.width(), base::checked_cast<uint32_t>(references.size())};
+    if (!sink->PutValue<OldImageIndexTypeHeader>(type_header))
+      return false;
+    for (size_t i = 0; i < references.size(); ++i) {
+      if (!sink->PutValue<Reference>(references.GetReference(i)))
+        return false;
+    }
+  }
+  return true;
+}
+
+// If sufficient space is available, writes the size of |suffix_array| followed
+// by |suffix_array| into |sink| and returns true. Otherwise returns false.
+bool PutSuffixArray(SuffixArrayView suffix_array, BufferSink* sink) {
+  return sink->PutValue<uint32_t>(
+             base::checked_cast<uint32_t>(suffix_array.size())) &&
+         PutArray(suffix_array.begin(), suffix_array.size(), sink);
+}
+
+}  // namespace
+
+/******** OldImageIndex::ElementIndex ********/
+
+OldImageIndex::ElementIndex::ElementIndex() = default;
+
+OldImageIndex::ElementIndex::ElementIndex(ElementIndex&&) = default;
+
+OldImageIndex::ElementIndex::~ElementIndex() = default;
+
+/******** OldImageIndex ********/
+
+// static
+base::Optional<OldImageIndex> OldImageIndex::Create(ConstBufferView old_image,
+                                                    PatchType patch_type) {
+  DCHECK(patch_type == PatchType::kEnsemblePatch ||
+         patch_type == PatchType::kRawPatch);
+
+  OldImageIndex old_index(patch_type, old_image);
+  old_index.suffix_array_storage_ = MakeRawSuffixArray(old_image);
+  old_index.suffix_array_ = {old_index.suffix_array_storage_.data(),
+                             old_index.suffix_array_storage_.size()};
+  if (patch_type == PatchType::kRawPatch)
+    return std::move(old_index);
+
+  old_index.elements_ = FindElements(old_image);
+  for (const Element& element : old_index.elements_) {
+    ConstBufferView sub_image = old_image[element.region()];
+    ElementIndex element_index;
+    std::unique_ptr<Disassembler> disasm =
+        MakeDisassemblerOfType(sub_image, element.exe_type);
+    auto image_index = base::MakeUnique<ImageIndex>(sub_image);
+    // Such an element is patched in raw mode, see GenerateEnsemble().
+    if (!disasm || !image_index->Initialize(disasm.get())) {
+      LOG(WARNING) << "Failed to index element at " << element.offset
+                   << " of old image.";
+    } else {
+      element_index.suffix_array_storage = MakeInitialSuffixArray(*image_index);
+      element_index.suffix_array = {element_index.suffix_array_storage.data(),
+                                    element_index.suffix_array_storage.size()};
+      element_index.image_index = std::move(image_index);
+    }
+    old_index.element_indexes_.push_back(std::move(element_index));
+  }
+  return std::move(old_index);
+}
+
+// static
+base::Optional<OldImageIndex> OldImageIndex::Load(ConstBufferView old_image,
+                                                  ConstBufferView buffer) {
+  BufferSource source(buffer);
+  OldImageIndexHeader header;
+  if (!source.GetValue(&header)) {
+    LOG(ERROR) << "Impossible to read header from index.";
+    return base::nullopt;
+  }
+  if (header.magic != OldImageIndexHeader::kMagic) {
+    LOG(ERROR) << "Index contains invalid magic.";
+    return base::nullopt;
+  }
+  if (header.version != OldImageIndexHeader::kVersion) {
+    LOG(ERROR) << "Index version " << header.version << " is unsupported.";
+    return base::nullopt;
+  }
+  if (header.old_size != old_image.size() ||
+      header.old_crc != CalculateCrc32(old_image.begin(), old_image.end())) {
+    LOG(ERROR) << "Index was created from a different old image.";
+    return base::nullopt;
+  }
+  PatchType patch_type = static_cast<PatchType>(header.patch_type);
+  if (patch_type != PatchType::kEnsemblePatch &&
+      patch_type != PatchType::kRawPatch) {
+    LOG(ERROR) << "Invalid patch_type encountered.";
+    return base::nullopt;
+  }
+  // Only ensemble patches have elements.
+  if (patch_type == PatchType::kRawPatch && header.element_count != 0) {
+    LOG(ERROR) << "Unexpected elements in raw index.";
+    return base::nullopt;
+  }
+
+  OldImageIndex old_index(patch_type, old_image);
+  if (!ReadSuffixArray(old_image.size(), &source, &old_index.suffix_array_))
+    return base::nullopt;
+
+  offset_t next_offset = 0;
+  for (uint32_t i = 0; i < header.element_count; ++i) {
+    OldImageIndexElementHeader element_header;
+    if (!source.GetValue(&element_header)) {
+      LOG(ERROR) << "Impossible to read element from index.";
+      return base::nullopt;
+    }
+    ExecutableType exe_type =
+        static_cast<ExecutableType>(element_header.exe_type);
+    // Elements are sorted and don't overlap.
+    if (exe_type >= kNumExeType || exe_type == kExeTypeNoOp ||
+        element_header.offset < next_offset || element_header.size == 0 ||
+        !RangeIsBounded<offset_t>(element_header.offset, element_header.size,
+                                  old_image.size()) ||
+        element_header.is_indexed > 1) {
+      LOG(ERROR) << "Invalid element encountered.";
+      return base::nullopt;
+    }
+    next_offset = element_header.offset + element_header.size;
+    Element element({element_header.offset, element_header.size}, exe_type);
+
+    ElementIndex element_index;
+    if (element_header.is_indexed) {
+      auto image_index =
+          base::MakeUnique<ImageIndex>(old_image[element.region()]);
+      if (!ReadImageIndex(element_header.pool_count, element_header.type_count,
+                          &source, image_index.get()) ||
+          !ReadSuffixArray(element.size, &source,
+                           &element_index.suffix_array)) {
+        return base::nullopt;
+      }
+      element_index.image_index = std::move(image_index);
+    } else if (element_header.pool_count != 0 ||
+               element_header.type_count != 0 ||
+               !ReadSuffixArray(0, &source, &element_index.suffix_array)) {
+      LOG(ERROR) << "Unexpected data for element without index.";
+      return base::nullopt;
+    }
+    old_index.elements_.push_back(element);
+    old_index.element_indexes_.push_back(std::move(element_index));
+  }
+
+  if (source.Remaining() != 0) {
+    LOG(ERROR) << "Index contains trailing data.";
+    return base::nullopt;
+  }
+  return std::move(old_index);
+}
+
+OldImageIndex::OldImageIndex(PatchType patch_type, ConstBufferView image)
+    : patch_type_(patch_type), image_(image) {}
+
+OldImageIndex::OldImageIndex(OldImageIndex&&) = default;
+
+OldImageIndex::~OldImageIndex() = default;
+
+size_t OldImageIndex::SerializedSize() const {
+  size_t serialized_size = sizeof(OldImageIndexHeader) + sizeof(uint32_t) +
+                           suffix_array_.size() * sizeof(offset_t);
+  for (const ElementIndex& element_index : element_indexes_) {
+    serialized_size += sizeof(OldImageIndexElementHeader) + sizeof(uint32_t) +
+                       element_index.suffix_array.size() * sizeof(offset_t);
+    if (element_index.image_index)
+      serialized_size += ImageIndexSerializedSize(*element_index.image_index);
+  }
+  return serialized_size;
+}
+
+bool OldImageIndex::SerializeInto(BufferSink* sink) const {
+  OldImageIndexHeader header;
+  header.magic = OldImageIndexHeader::kMagic;
+  header.version = OldImageIndexHeader::kVersion;
+  header.old_size = base::checked_cast<uint32_t>(image_.size());
+  header.old_crc = CalculateCrc32(image_.begin(), image_.end());
+  header.patch_type = static_cast<uint32_t>(patch_type_);
+  header.element_count = base::checked_cast<uint32_t>(elements_.size());
+  if (!sink->PutValue<OldImageIndexHeader>(header) ||
+      !PutSuffixArray(suffix_array_, sink)) {
+    return false;
+  }
+
+  for (size_t i = 0; i < elements_.size(); ++i) {
+    const Element& element = elements_[i];
+    const ImageIndex* image_index = element_indexes_[i].image_index.get();
+    OldImageIndexElementHeader element_header = {
+        base::checked_cast<uint32_t>(element.offset),
+        base::checked_cast<uint32_t>(element.size),
+        static_cast<uint32_t>(element.exe_type),
+        image_index ? 1U : 0U,
+        image_index ? base::checked_cast<uint32_t>(image_index->PoolCount())
+                    : 0U,
+        image_index ? base::checked_cast<uint32_t>(image_index->TypeCount())
+                    : 0U};
+    if (!sink->PutValue<OldImageIndexElementHeader>(element_header) ||
+        (image_index && !PutImageIndex(*image_index, sink)) ||
+        !PutSuffixArray(element_indexes_[i].suffix_array, sink)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace zucchini
@@ -0,0 +1,180 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CHROME_INSTALLER_ZUCCHINI_OLD_IMAGE_INDEX_H_
+#define CHROME_INSTALLER_ZUCCHINI_OLD_IMAGE_INDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "squash/base/optional.h"
+#include "squash/zucchini/buffer_sink.h"
+#include "squash/zucchini/buffer_view.h"
+#include "squash/zucchini/image_index.h"
+#include "squash/zucchini/image_utils.h"
+#include "squash/zucchini/patch_utils.h"
+
+namespace zucchini {
+
+// An index file holds all data computed from an "old" image before it gets
+// matched with a "new" image, so that many patches can be generated against the
+// same "old" image without computing it again. It is the concatenation of:
+// - OldImageIndexHeader.
+// - The size of the raw suffix array of the image (as uint32_t), followed by
+//   the suffix array.
+// - For each executable element: OldImageIndexElementHeader, followed by:
+//   - For each target pool: OldImageIndexPoolHeader, followed by |type_count|
+//     type tags (as uint32_t) and |target_count| targets.
+//   - For each reference type: OldImageIndexTypeHeader, followed by
+//     |reference_count| references.
+//   - The size of the suffix array of the element (as uint32_t), followed by
+//     the suffix array.
+// Offsets of references and suffix arrays of elements are relative to their
+// element. All values are 4 bytes wide, so that arrays are aligned when the
+// file is mapped in memory and can be used in place.
+
+// Supported by MSVC, g++, and clang++. Ensures no gaps in packing.
+#pragma pack(push, 1)
+
+// Header found at the beginning of an index file.
+struct OldImageIndexHeader {
+  // Magic signature at the beginning of an index file.
+  enum : uint32_t { kMagic = 'Z' | ('u' << 8) | ('i' << 16) };
+  // Version of the index format. This must be incremented whenever the format
+  // or the way its content is computed changes.
+  enum : uint32_t { kVersion = 2 };
+
+  uint32_t magic = 0;
+  uint32_t version = 0;
+  uint32_t old_size = 0;
+  uint32_t old_crc = 0;
+  uint32_t patch_type = 0;
+  uint32_t element_count = 0;
+};
+
+// Sanity check.
+static_assert(sizeof(OldImageIndexHeader) == 24,
+              "OldImageIndexHeader is 24 bytes");
+
+// Header for an executable element in an index file. An element that could
+// not be indexed has |is_indexed == 0|, no pool, no type and an empty suffix
+// array.
+struct OldImageIndexElementHeader {
+  uint32_t offset;
+  uint32_t size;
+  uint32_t exe_type;
+  uint32_t is_indexed;
+  uint32_t pool_count;
+  uint32_t type_count;
+};
+
+// Header for a target pool in an index file.
+struct OldImageIndexPoolHeader {
+  uint32_t pool_tag;
+  uint32_t type_count;
+  uint32_t target_count;
+};
+
+// Header for a reference type in an index file.
+struct OldImageIndexTypeHeader {
+  uint32_t type_tag;
+  uint32_t pool_tag;
+  uint32_t width;
+  uint32_t reference_count;
+};
+
+#pragma pack(pop)
+
+// Data computed from an "old" image ahead of patch generation: Its raw suffix
+// array, and for ensemble patches, its executable elements, with their
+// ImageIndex and the suffix arrays used to find equivalences. This is either
+// computed from the image, or loaded from an index file.
+class OldImageIndex {
+ public:
+  // Indexes |old_image| the way GenerateEnsemble() or GenerateRaw() would,
+  // depending on |patch_type|, which must be either PatchType::kEnsemblePatch
+  // or PatchType::kRawPatch. Returns nullopt on failure.
+  static base::Optional<OldImageIndex> Create(ConstBufferView old_image,
+                                              PatchType patch_type);
+
+  // Reads an index of |old_image| written by SerializeInto() from |buffer|.
+  // Suffix arrays are used in place, so |buffer| must outlive the returned
+  // object. Returns nullopt if |buffer| is invalid, or if it was created from
+  // another image than |old_image|.
+  static base::Optional<OldImageIndex> Load(ConstBufferView old_image,
+                                            ConstBufferView buffer);
+
+  OldImageIndex(OldImageIndex&&);
+  OldImageIndex(const OldImageIndex&) = delete;
+  ~OldImageIndex();
+
+  // Returns the size of the index, once serialized.
+  size_t SerializedSize() const;
+
+  // If sufficient space is available, serializes the index into |sink| and
+  // returns true. Otherwise returns false.
+  bool SerializeInto(BufferSink* sink) const;
+  bool SerializeInto(MutableBufferView buffer) const {
+    BufferSink sink(buffer);
+    return SerializeInto(&sink);
+  }
+
+  PatchType patch_type() const { return patch_type_; }
+
+  // Returns the "old" image being indexed.
+  ConstBufferView image() const { return image_; }
+
+  // Returns the suffix array of image(), computed by MakeRawSuffixArray(), which
+  // is used for raw patches, and for raw elements of ensemble patches.
+  SuffixArrayView suffix_array() const { return suffix_array_; }
+
+  // Returns the executable elements found in image() by FindElements(), in
+  // increasing order of offsets. This is empty if patch_type() is
+  // PatchType::kRawPatch.
+  const std::vector<Element>& elements() const { return elements_; }
+
+  // Returns the ImageIndex of the sub-image of image() covered by
+  // |elements()[i]|, or null if it could not be created, e.g., because of
+  // overlapping references.
+  const ImageIndex* element_image_index(size_t i) const {
+    return element_indexes_[i].image_index.get();
+  }
+
+  // Returns the suffix array of |elements()[i]| computed by
+  // MakeInitialSuffixArray(), or an empty one if element_image_index(i) is null.
+  SuffixArrayView element_suffix_array(size_t i) const {
+    return element_indexes_[i].suffix_array;
+  }
+
+ private:
+  // Index of an executable element.
+  struct ElementIndex {
+    ElementIndex();
+    ElementIndex(ElementIndex&&);
+    ~ElementIndex();
+
+    std::unique_ptr<ImageIndex> image_index;
+    // Holds the suffix array if it was computed rather than loaded.
+    std::vector<offset_t> suffix_array_storage;
+    SuffixArrayView suffix_array;
+  };
+
+  OldImageIndex(PatchType patch_type, ConstBufferView image);
+
+  PatchType patch_type_;
+  ConstBufferView image_;
+  // Holds the suffix array if it was computed rather than loaded.
+  std::vector<offset_t> suffix_array_storage_;
+  SuffixArrayView suffix_array_;
+  std::vector<Element> elements_;
+  // Index of each element of |elements_|.
+  std::vector<ElementIndex> element_indexes_;
+};
+
+}  // namespace zucchini
+
+#endif  // CHROME_INSTALLER_ZUCCHINI_OLD_IMAGE_INDEX_H_
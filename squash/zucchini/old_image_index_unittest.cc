@@ -0,0 +1,324 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "squash/zucchini/old_image_index.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "squash/zucchini/crc32.h"
+#include "squash/zucchini/image_utils.h"
+#include "squash/zucchini/zucchini_gen.h"
+
+namespace zucchini {
+
+namespace {
+
+std::vector<uint8_t> MakeImage(const std::string& str) {
+  return std::vector<uint8_t>(str.begin(), str.end());
+}
+
+std::vector<uint8_t> Serialize(const OldImageIndex& old_index) {
+  std::vector<uint8_t> buffer(old_index.SerializedSize());
+  EXPECT_TRUE(old_index.SerializeInto({buffer.data(), buffer.size()}));
+  return buffer;
+}
+
+// Returns the words of a suffix array of |size| suffixes, preceded by its size.
+// It is the identity, since suffix arrays aren't checked for consistency.
+std::vector<uint32_t> MakeSuffixArrayWords(uint32_t size) {
+  std::vector<uint32_t> words = {size};
+  for (uint32_t i = 0; i < size; ++i)
+    words.push_back(i);
+  return words;
+}
+
+// Returns an index of |image| for an ensemble patch with |element_count|
+// elements, made of a valid header and raw suffix array, followed by |words|.
+std::vector<uint8_t> MakeIndexBuffer(const std::vector<uint8_t>& image,
+                                     uint32_t element_count,
+                                     const std::vector<uint32_t>& words) {
+  std::vector<uint32_t> all_words = {
+      OldImageIndexHeader::kMagic,
+      OldImageIndexHeader::kVersion,
+      static_cast<uint32_t>(image.size()),
+      CalculateCrc32(image.data(), image.data() + image.size()),
+      static_cast<uint32_t>(PatchType::kEnsemblePatch),
+      element_count};
+  std::vector<uint32_t> suffix_array_words =
+      MakeSuffixArrayWords(static_cast<uint32_t>(image.size()));
+  all_words.insert(all_words.end(), suffix_array_words.begin(),
+                   suffix_array_words.end());
+  all_words.insert(all_words.end(), words.begin(), words.end());
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(all_words.data());
+  return std::vector<uint8_t>(bytes, bytes + all_words.size() * 4);
+}
+
+}  // namespace
+
+TEST(OldImageIndexTest, RawRoundTrip) {
+  std::vector<uint8_t> image = MakeImage("banana split with banana");
+  ConstBufferView image_view(image.data(), image.size());
+
+  base::Optional<OldImageIndex> old_index =
+      OldImageIndex::Create(image_view, PatchType::kRawPatch);
+  ASSERT_TRUE(old_index.has_value());
+  EXPECT_EQ(PatchType::kRawPatch, old_index->patch_type());
+  EXPECT_TRUE(old_index->elements().empty());
+  std::vector<offset_t> expected_sa = MakeRawSuffixArray(image_view);
+  EXPECT_EQ(expected_sa,
+            std::vector<offset_t>(old_index->suffix_array().begin(),
+                                  old_index->suffix_array().end()));
+
+  std::vector<uint8_t> buffer = Serialize(*old_index);
+  base::Optional<OldImageIndex> loaded_index =
+      OldImageIndex::Load(image_view, {buffer.data(), buffer.size()});
+  ASSERT_TRUE(loaded_index.has_value());
+  EXPECT_EQ(PatchType::kRawPatch, loaded_index->patch_type());
+  EXPECT_TRUE(loaded_index->elements().empty());
+  EXPECT_EQ(expected_sa,
+            std::vector<offset_t>(loaded_index->suffix_array().begin(),
+                                  loaded_index->suffix_array().end()));
+  // The suffix array is used in place.
+  EXPECT_GE(reinterpret_cast<const uint8_t*>(
+                loaded_index->suffix_array().begin()),
+            buffer.data());
+  EXPECT_LE(
+      reinterpret_cast<const uint8_t*>(loaded_index->suffix_array().end()),
+      buffer.data() + buffer.size());
+}
+
+TEST(OldImageIndexTest, EnsembleWithoutExecutable) {
+  std::vector<uint8_t> image = MakeImage("not an executable");
+  ConstBufferView image_view(image.data(), image.size());
+
+  base::Optional<OldImageIndex> old_index =
+      OldImageIndex::Create(image_view, PatchType::kEnsemblePatch);
+  ASSERT_TRUE(old_index.has_value());
+  EXPECT_EQ(PatchType::kEnsemblePatch, old_index->patch_type());
+  EXPECT_TRUE(old_index->elements().empty());
+  std::vector<offset_t> expected_sa = MakeRawSuffixArray(image_view);
+  EXPECT_EQ(expected_sa,
+            std::vector<offset_t>(old_index->suffix_array().begin(),
+                                  old_index->suffix_array().end()));
+
+  std::vector<uint8_t> buffer = Serialize(*old_index);
+  base::Optional<OldImageIndex> loaded_index =
+      OldImageIndex::Load(image_view, {buffer.data(), buffer.size()});
+  ASSERT_TRUE(loaded_index.has_value());
+  EXPECT_EQ(PatchType::kEnsemblePatch, loaded_index->patch_type());
+  EXPECT_TRUE(loaded_index->elements().empty());
+  EXPECT_EQ(expected_sa,
+            std::vector<offset_t>(loaded_index->suffix_array().begin(),
+                                  loaded_index->suffix_array().end()));
+}
+
+TEST(OldImageIndexTest, Stale) {
+  std::vector<uint8_t> image = MakeImage("banana split with banana");
+  base::Optional<OldImageIndex> old_index = OldImageIndex::Create(
+      {image.data(), image.size()}, PatchType::kRawPatch);
+  ASSERT_TRUE(old_index.has_value());
+  std::vector<uint8_t> buffer = Serialize(*old_index);
+
+  // Same size, different content.
+  std::vector<uint8_t> other_image = MakeImage("banana split with bandana");
+  other_image.pop_back();
+  ASSERT_EQ(image.size(), other_image.size());
+  EXPECT_FALSE(OldImageIndex::Load({other_image.data(), other_image.size()},
+                                   {buffer.data(), buffer.size()})
+                   .has_value());
+  // Different size.
+  EXPECT_FALSE(OldImageIndex::Load({image.data(), image.size() - 1},
+                                   {buffer.data(), buffer.size()})
+                   .has_value());
+}
+
+TEST(OldImageIndexTest, Corrupt) {
+  std::vector<uint8_t> image = MakeImage("banana split with banana");
+  ConstBufferView image_view(image.data(), image.size());
+  base::Optional<OldImageIndex> old_index =
+      OldImageIndex::Create(image_view, PatchType::kRawPatch);
+  ASSERT_TRUE(old_index.has_value());
+  const std::vector<uint8_t> buffer = Serialize(*old_index);
+  ASSERT_TRUE(OldImageIndex::Load(image_view, {buffer.data(), buffer.size()})
+                  .has_value());
+
+  // Truncated.
+  for (size_t size : {size_t(0), sizeof(OldImageIndexHeader) - 1,
+                      sizeof(OldImageIndexHeader), buffer.size() - 1}) {
+    EXPECT_FALSE(OldImageIndex::Load(image_view, {buffer.data(), size})
+                     .has_value());
+  }
+  // Trailing data.
+  std::vector<uint8_t> corrupt = buffer;
+  corrupt.push_back(0);
+  EXPECT_FALSE(OldImageIndex::Load(image_view, {corrupt.data(), corrupt.size()})
+                   .has_value());
+
+  // Invalid magic, version and patch type.
+  for (size_t pos : {size_t(0), size_t(4), size_t(16)}) {
+    corrupt = buffer;
+    corrupt[pos] ^= 0x80;
+    EXPECT_FALSE(
+        OldImageIndex::Load(image_view, {corrupt.data(), corrupt.size()})
+            .has_value());
+  }
+
+  // Suffix array that isn't a permutation.
+  corrupt = buffer;
+  offset_t* suffix_array = reinterpret_cast<offset_t*>(
+      corrupt.data() + sizeof(OldImageIndexHeader) + sizeof(uint32_t));
+  suffix_array[1] = suffix_array[0];
+  EXPECT_FALSE(OldImageIndex::Load(image_view, {corrupt.data(), corrupt.size()})
+                   .has_value());
+}
+
+TEST(OldImageIndexTest, References) {
+  std::vector<uint8_t> image(10, 0);
+  ConstBufferView image_view(image.data(), image.size());
+  // Element: [2, 10) of type Win32X86.
+  // Pools: Pool 0 with types {1, 0} and targets {2, 5}.
+  // Types: Type 0 of width 2 with references {(0, 5), (6, 2)}; Type 1 of
+  // width 1 with references {(3, 2)}.
+  // Suffix array: Identity.
+  // |target| is the target of the reference of type 1, and |pool_count| and
+  // |type_count| are given to the element.
+  auto make_words = [](uint32_t target, uint32_t pool_count,
+                       uint32_t type_count) {
+    std::vector<uint32_t> words = {2, 8, kExeTypeWin32X86, 1, pool_count,
+                                   type_count, 0, 2, 2, 1, 0, 2, 5,
+                                   0, 0, 2, 2, 0, 5, 6, 2,
+                                   1, 0, 1, 1, 3, target};
+    std::vector<uint32_t> suffix_array_words = MakeSuffixArrayWords(8);
+    words.insert(words.end(), suffix_array_words.begin(),
+                 suffix_array_words.end());
+    return words;
+  };
+
+  std::vector<uint8_t> buffer = MakeIndexBuffer(image, 1, make_words(2, 1, 2));
+  base::Optional<OldImageIndex> old_index =
+      OldImageIndex::Load(image_view, {buffer.data(), buffer.size()});
+  ASSERT_TRUE(old_index.has_value());
+  EXPECT_EQ(std::vector<Element>({Element({2, 8}, kExeTypeWin32X86)}),
+            old_index->elements());
+  ASSERT_TRUE(old_index->element_image_index(0));
+  const ImageIndex& image_index = *old_index->element_image_index(0);
+  EXPECT_EQ(8U, image_index.size());
+  EXPECT_EQ(1U, image_index.PoolCount());
+  EXPECT_EQ(2U, image_index.TypeCount());
+  EXPECT_EQ(std::vector<offset_t>({2, 5}),
+            image_index.pool(PoolTag(0)).targets());
+  EXPECT_EQ(std::vector<TypeTag>({TypeTag(1), TypeTag(0)}),
+            image_index.pool(PoolTag(0)).types());
+  EXPECT_EQ(std::vector<Reference>({{0, 5}, {6, 2}}),
+            image_index.refs(TypeTag(0)).GetReferences());
+  EXPECT_EQ(std::vector<Reference>({{3, 2}}),
+            image_index.refs(TypeTag(1)).GetReferences());
+  EXPECT_EQ(TypeTag(0), image_index.LookupType(1));
+  EXPECT_EQ(TypeTag(1), image_index.LookupType(3));
+  EXPECT_EQ(kNoTypeTag, image_index.LookupType(5));
+  EXPECT_EQ(8U, old_index->element_suffix_array(0).size());
+
+  // Round trip.
+  std::vector<uint8_t> serialized = Serialize(*old_index);
+  EXPECT_EQ(buffer, serialized);
+
+  // Target outside of pool.
+  buffer = MakeIndexBuffer(image, 1, make_words(3, 1, 2));
+  EXPECT_FALSE(OldImageIndex::Load(image_view, {buffer.data(), buffer.size()})
+                   .has_value());
+  // Overlap across types.
+  std::vector<uint32_t> words = make_words(2, 1, 2);
+  words[25] = 1;
+  buffer = MakeIndexBuffer(image, 1, words);
+  EXPECT_FALSE(OldImageIndex::Load(image_view, {buffer.data(), buffer.size()})
+                   .has_value());
+  // Missing type.
+  buffer = MakeIndexBuffer(image, 1, make_words(2, 1, 1));
+  EXPECT_FALSE(OldImageIndex::Load(image_view, {buffer.data(), buffer.size()})
+                   .has_value());
+  // Reference outside of element.
+  words = make_words(2, 1, 2);
+  words[1] = 6;
+  buffer = MakeIndexBuffer(image, 1, words);
+  EXPECT_FALSE(OldImageIndex::Load(image_view, {buffer.data(), buffer.size()})
+                   .has_value());
+}
+
+TEST(OldImageIndexTest, Elements) {
+  std::vector<uint8_t> image(10, 0);
+  ConstBufferView image_view(image.data(), image.size());
+  // |offset|, |size| and |exe_type| of an element without pools or types, and
+  // with an identity suffix array if |is_indexed|.
+  auto make_element_words = [](uint32_t offset, uint32_t size,
+                               uint32_t exe_type, uint32_t is_indexed) {
+    std::vector<uint32_t> words = {offset, size, exe_type, is_indexed, 0, 0};
+    std::vector<uint32_t> suffix_array_words =
+        MakeSuffixArrayWords(is_indexed ? size : 0);
+    words.insert(words.end(), suffix_array_words.begin(),
+                 suffix_array_words.end());
+    return words;
+  };
+  auto make_buffer =
+      [&](const std::vector<std::vector<uint32_t>>& element_words) {
+        std::vector<uint32_t> words;
+        for (const std::vector<uint32_t>& element : element_words)
+          words.insert(words.end(), element.begin(), element.end());
+        return MakeIndexBuffer(image, static_cast<uint32_t>(element_words.size()),
+                               words);
+      };
+
+  // An indexed element, followed by an element that could not be indexed.
+  std::vector<uint8_t> buffer =
+      make_buffer({make_element_words(0, 4, kExeTypeWin32X86, 1),
+                   make_element_words(4, 6, kExeTypeWin32X64, 0)});
+  base::Optional<OldImageIndex> old_index =
+      OldImageIndex::Load(image_view, {buffer.data(), buffer.size()});
+  ASSERT_TRUE(old_index.has_value());
+  EXPECT_EQ(std::vector<Element>({Element({0, 4}, kExeTypeWin32X86),
+                                  Element({4, 6}, kExeTypeWin32X64)}),
+            old_index->elements());
+  ASSERT_TRUE(old_index->element_image_index(0));
+  EXPECT_EQ(0U, old_index->element_image_index(0)->TypeCount());
+  EXPECT_EQ(4U, old_index->element_suffix_array(0).size());
+  EXPECT_FALSE(old_index->element_image_index(1));
+  EXPECT_TRUE(old_index->element_suffix_array(1).empty());
+  EXPECT_EQ(buffer, Serialize(*old_index));
+
+  // Overlapping elements, unsorted elements, elements outside of image, raw
+  // elements, elements of invalid types and empty elements.
+  for (const std::vector<std::vector<uint32_t>>& element_words :
+       std::vector<std::vector<std::vector<uint32_t>>>{
+           {make_element_words(0, 4, kExeTypeWin32X86, 0),
+            make_element_words(3, 4, kExeTypeWin32X86, 0)},
+           {make_element_words(4, 4, kExeTypeWin32X86, 0),
+            make_element_words(0, 4, kExeTypeWin32X86, 0)},
+           {make_element_words(8, 4, kExeTypeWin32X86, 0)},
+           {make_element_words(0, 4, kExeTypeNoOp, 0)},
+           {make_element_words(0, 4, kNumExeType, 0)},
+           {make_element_words(0, 0, kExeTypeWin32X86, 0)}}) {
+    buffer = make_buffer(element_words);
+    EXPECT_FALSE(OldImageIndex::Load(image_view, {buffer.data(), buffer.size()})
+                     .has_value());
+  }
+
+  // Element without index, but with a suffix array.
+  std::vector<uint32_t> words = make_element_words(0, 4, kExeTypeWin32X86, 1);
+  words[3] = 0;
+  buffer = MakeIndexBuffer(image, 1, words);
+  EXPECT_FALSE(OldImageIndex::Load(image_view, {buffer.data(), buffer.size()})
+                   .has_value());
+  // Suffix array of the wrong size.
+  words = make_element_words(0, 4, kExeTypeWin32X86, 1);
+  words[1] = 5;
+  buffer = MakeIndexBuffer(image, 1, words);
+  EXPECT_FALSE(OldImageIndex::Load(image_view, {buffer.data(), buffer.size()})
+                   .has_value());
+}
+
+}  // namespace zucchini
@@ -390,6 +390,34 @@ TEST(TargetSourceSinkTest, Normal) {
   TestSerialize(data, target_sink);
 }
 
+TEST(SpilledSinkTest, Normal) {
+  // Sinks that spill serialize the same data as sinks kept in memory.
+  SpillFile spill_file;
+  EquivalenceSink spilled_equivalences(&spill_file);
+  EquivalenceSink equivalences;
+  ExtraDataSink spilled_extra_data(&spill_file);
+  ExtraDataSink extra_data;
+  ByteVector region(100);
+  for (offset_t i = 0; i < 30000; ++i) {
+    Equivalence equivalence = {i * 7 % 1000, i * 10, 5 + i % 3};
+    spilled_equivalences.PutNext(equivalence);
+    equivalences.PutNext(equivalence);
+    region[i % region.size()] = static_cast<uint8_t>(i);
+    spilled_extra_data.PutNext({region.data(), i % region.size()});
+    extra_data.PutNext({region.data(), i % region.size()});
+  }
+
+  ByteVector expected(equivalences.SerializedSize());
+  BufferSink expected_sink(expected.data(), expected.size());
+  EXPECT_TRUE(equivalences.SerializeInto(&expected_sink));
+  TestSerialize(expected, spilled_equivalences);
+
+  expected.resize(extra_data.SerializedSize());
+  expected_sink = BufferSink(expected.data(), expected.size());
+  EXPECT_TRUE(extra_data.SerializeInto(&expected_sink));
+  TestSerialize(expected, spilled_extra_data);
+}
+
 TEST(PatchElementTest, Normal) {
   ByteVector data = {
       0x01, 0, 0, 0,  // old_offset
@@ -52,11 +52,24 @@ size_t SerializedBufferSize(const std::vector<uint8_t>& buffer) {
   return sizeof(uint32_t) + buffer.size();
 }
 
+bool SerializeBuffer(const SpillBuffer& buffer, BufferSink* sink) {
+  base::CheckedNumeric<uint32_t> size = buffer.size();
+  if (!size.IsValid())
+    return false;
+  return sink->PutValue<uint32_t>(size.ValueOrDie()) && buffer.WriteInto(sink);
+}
+
+size_t SerializedBufferSize(const SpillBuffer& buffer) {
+  return sizeof(uint32_t) + buffer.size();
+}
+
 }  // namespace patch
 
 /******** EquivalenceSink ********/
 
 EquivalenceSink::EquivalenceSink() = default;
+EquivalenceSink::EquivalenceSink(SpillFile* spill_file)
+    : src_skip_(spill_file), dst_skip_(spill_file), copy_count_(spill_file) {}
 EquivalenceSink::EquivalenceSink(const std::vector<uint8_t>& src_skip,
                                  const std::vector<uint8_t>& dst_skip,
                                  const std::vector<uint8_t>& copy_count)
@@ -103,6 +116,8 @@ bool EquivalenceSink::SerializeInto(BufferSink* sink) const {
 /******** ExtraDataSink ********/
 
 ExtraDataSink::ExtraDataSink() = default;
+ExtraDataSink::ExtraDataSink(SpillFile* spill_file)
+    : extra_data_(spill_file) {}
 ExtraDataSink::ExtraDataSink(const std::vector<uint8_t>& extra_data)
     : extra_data_(extra_data) {}
 
@@ -110,7 +125,7 @@ ExtraDataSink::ExtraDataSink(ExtraDataSink&&) = default;
 ExtraDataSink::~ExtraDataSink() = default;
 
 void ExtraDataSink::PutNext(ConstBufferView region) {
-  extra_data_.insert(extra_data_.end(), region.begin(), region.end());
+  extra_data_.Append(region);
 }
 
 size_t ExtraDataSink::SerializedSize() const {
@@ -124,6 +139,8 @@ bool ExtraDataSink::SerializeInto(BufferSink* sink) const {
 /******** RawDeltaSink ********/
 
 RawDeltaSink::RawDeltaSink() = default;
+RawDeltaSink::RawDeltaSink(SpillFile* spill_file)
+    : raw_delta_skip_(spill_file), raw_delta_diff_(spill_file) {}
 RawDeltaSink::RawDeltaSink(const std::vector<uint8_t>& raw_delta_skip,
                            const std::vector<uint8_t>& raw_delta_diff)
     : raw_delta_skip_(raw_delta_skip), raw_delta_diff_(raw_delta_diff) {}
@@ -155,6 +172,8 @@ bool RawDeltaSink::SerializeInto(BufferSink* sink) const {
 /******** ReferenceDeltaSink ********/
 
 ReferenceDeltaSink::ReferenceDeltaSink() = default;
+ReferenceDeltaSink::ReferenceDeltaSink(SpillFile* spill_file)
+    : reference_delta_(spill_file) {}
 ReferenceDeltaSink::ReferenceDeltaSink(
     const std::vector<uint8_t>& reference_delta)
     : reference_delta_(reference_delta) {}
@@ -177,6 +196,7 @@ bool ReferenceDeltaSink::SerializeInto(BufferSink* sink) const {
 /******** TargetSink ********/
 
 TargetSink::TargetSink() = default;
+TargetSink::TargetSink(SpillFile* spill_file) : extra_targets_(spill_file) {}
 TargetSink::TargetSink(const std::vector<uint8_t>& extra_targets)
     : extra_targets_(extra_targets) {}
 
@@ -204,8 +224,9 @@ bool TargetSink::SerializeInto(BufferSink* sink) const {
 /******** PatchElementWriter ********/
 
 PatchElementWriter::PatchElementWriter() = default;
-PatchElementWriter::PatchElementWriter(ElementMatch element_match)
-    : element_match_(element_match) {}
+PatchElementWriter::PatchElementWriter(ElementMatch element_match,
+                                       SpillFile* spill_file)
+    : element_match_(element_match), spill_file_(spill_file) {}
 
 PatchElementWriter::PatchElementWriter(PatchElementWriter&&) = default;
 PatchElementWriter::~PatchElementWriter() = default;
@@ -19,6 +19,7 @@
 #include "squash/zucchini/buffer_view.h"
 #include "squash/zucchini/image_utils.h"
 #include "squash/zucchini/patch_utils.h"
+#include "squash/zucchini/spill_buffer.h"
 
 namespace zucchini {
 
@@ -39,6 +40,10 @@ bool SerializeBuffer(const std::vector<uint8_t>& buffer, BufferSink* sink);
 // Returns the size in bytes required to serialize |buffer|.
 size_t SerializedBufferSize(const std::vector<uint8_t>& buffer);
 
+// Same as SerializeBuffer() and SerializedBufferSize() above, for SpillBuffer.
+bool SerializeBuffer(const SpillBuffer& buffer, BufferSink* sink);
+size_t SerializedBufferSize(const SpillBuffer& buffer);
+
 }  // namespace patch
 
 // Each of *Sink classes below has an associated "main type", and performs the
@@ -61,11 +66,16 @@ size_t SerializedBufferSize(const std::vector<uint8_t>& buffer);
 // Usage of *Sink instances don't mix, and PuttNext() have dissimilar
 // interfaces. Therefore we do not use inheritance to relate *Sink classes,
 // simply implement "core functions" with matching names.
+//
+// Internal storage is made of SpillBuffers. *Sink classes constructed with a
+// SpillFile, which is required to outlive them, move most of their data to it,
+// so memory used during patch generation doesn't grow with the patch size.
 
 // Sink for equivalences.
 class EquivalenceSink {
  public:
   EquivalenceSink();
+  explicit EquivalenceSink(SpillFile* spill_file);
   EquivalenceSink(const std::vector<uint8_t>& src_skip,
                   const std::vector<uint8_t>& dst_skip,
                   const std::vector<uint8_t>& copy_count);
@@ -82,13 +92,13 @@ class EquivalenceSink {
  private:
   // Offset in source, delta-encoded starting from end of last equivalence, and
   // stored as signed varint.
-  std::vector<uint8_t> src_skip_;
+  SpillBuffer src_skip_;
   // Offset in destination, delta-encoded starting from end of last equivalence,
   // and stored as unsigned varint.
-  std::vector<uint8_t> dst_skip_;
+  SpillBuffer dst_skip_;
   // Length of equivalence stored as unsigned varint.
   // TODO(etiennep): Investigate on bias.
-  std::vector<uint8_t> copy_count_;
+  SpillBuffer copy_count_;
 
   offset_t src_offset_ = 0;  // Last offset in source.
   offset_t dst_offset_ = 0;  // Last offset in destination.
@@ -98,6 +108,7 @@ class EquivalenceSink {
 class ExtraDataSink {
  public:
   ExtraDataSink();
+  explicit ExtraDataSink(SpillFile* spill_file);
   explicit ExtraDataSink(const std::vector<uint8_t>& extra_data);
   ExtraDataSink(ExtraDataSink&&);
   ~ExtraDataSink();
@@ -108,13 +119,14 @@ class ExtraDataSink {
   bool SerializeInto(BufferSink* sink) const;
 
  private:
-  std::vector<uint8_t> extra_data_;
+  SpillBuffer extra_data_;
 };
 
 // Sink for raw delta.
 class RawDeltaSink {
  public:
   RawDeltaSink();
+  explicit RawDeltaSink(SpillFile* spill_file);
   RawDeltaSink(const std::vector<uint8_t>& raw_delta_skip,
                const std::vector<uint8_t>& raw_delta_diff);
   RawDeltaSink(RawDeltaSink&&);
@@ -127,8 +139,8 @@ class RawDeltaSink {
   bool SerializeInto(BufferSink* sink) const;
 
  private:
-  std::vector<uint8_t> raw_delta_skip_;  // Copy offset stating from last delta.
-  std::vector<uint8_t> raw_delta_diff_;  // Bytewise difference.
+  SpillBuffer raw_delta_skip_;  // Copy offset stating from last delta.
+  SpillBuffer raw_delta_diff_;  // Bytewise difference.
 
   // We keep track of the compensation needed for next copy offset, taking into
   // accound delta encoding and bias of -1. Stored delta are biased by -1, so a
@@ -140,6 +152,7 @@ class RawDeltaSink {
 class ReferenceDeltaSink {
  public:
   ReferenceDeltaSink();
+  explicit ReferenceDeltaSink(SpillFile* spill_file);
   explicit ReferenceDeltaSink(const std::vector<uint8_t>& reference_delta);
   ReferenceDeltaSink(ReferenceDeltaSink&&);
   ~ReferenceDeltaSink();
@@ -150,13 +163,14 @@ class ReferenceDeltaSink {
   bool SerializeInto(BufferSink* sink) const;
 
  private:
-  std::vector<uint8_t> reference_delta_;
+  SpillBuffer reference_delta_;
 };
 
 // Sink for additional targets.
 class TargetSink {
  public:
   TargetSink();
+  explicit TargetSink(SpillFile* spill_file);
   explicit TargetSink(const std::vector<uint8_t>& extra_targets);
   TargetSink(TargetSink&&);
   ~TargetSink();
@@ -169,7 +183,7 @@ class TargetSink {
 
  private:
   // Targets are delta-encoded and biaised by 1, stored as unsigned varint.
-  std::vector<uint8_t> extra_targets_;
+  SpillBuffer extra_targets_;
 
   // We keep track of the compensation needed for next target, taking into
   // accound delta encoding and bias of -1.
@@ -185,7 +199,10 @@ class TargetSink {
 class PatchElementWriter {
  public:
   PatchElementWriter();
-  explicit PatchElementWriter(ElementMatch element_match);
+  // If |spill_file| is not null, sinks created for this element may spill to
+  // it, see spill_file().
+  explicit PatchElementWriter(ElementMatch element_match,
+                              SpillFile* spill_file = nullptr);
   PatchElementWriter(PatchElementWriter&&);
   ~PatchElementWriter();
 
@@ -193,6 +210,10 @@ class PatchElementWriter {
   const Element& old_element() const { return element_match_.old_element; }
   const Element& new_element() const { return element_match_.new_element; }
 
+  // Returns the SpillFile that sinks set for this element should be
+  // constructed with, or null if they should be kept in memory.
+  SpillFile* spill_file() const { return spill_file_; }
+
   // Following methods set individual blocks for this element. Previous
   // corresponding block is replaced. All streams must be set before call to
   // SerializedSize() of SerializeInto().
@@ -224,6 +245,7 @@ class PatchElementWriter {
 
  private:
   ElementMatch element_match_;
+  SpillFile* spill_file_ = nullptr;
   base::Optional<EquivalenceSink> equivalences_;
   base::Optional<ExtraDataSink> extra_data_;
   base::Optional<RawDeltaSink> raw_delta_;
@@ -241,6 +263,10 @@ class EnsemblePatchWriter {
 
   void SetPatchType(PatchType patch_type) { patch_type_ = patch_type; }
 
+  // Returns the SpillFile that patch elements of this patch should be
+  // constructed with. It is only created if data is spilled to it.
+  SpillFile* spill_file() { return &spill_file_; }
+
   // Reserves space for |count| patch elements.
   void ReserveElements(size_t count) { elements_.reserve(count); }
 
@@ -265,6 +291,7 @@ class EnsemblePatchWriter {
  private:
   PatchHeader header_;
   PatchType patch_type_ = PatchType::kUnrecognisedPatch;
+  SpillFile spill_file_;
   std::vector<PatchElementWriter> elements_;
   offset_t current_dst_offset_ = 0;
 
@@ -5,7 +5,6 @@
 #include "squash/zucchini/reference_set.h"
 
 #include <algorithm>
-#include <iterator>
 
 #include "squash/base/logging.h"
 #include "squash/base/macros.h"
@@ -13,19 +12,6 @@
 
 namespace zucchini {
 
-namespace {
-
-// Returns true is |refs| is sorted.
-bool IsReferenceListSorted(const std::vector<Reference>& refs) {
-  return std::is_sorted(
-      refs.begin(), refs.end(),
-      [](const Reference& a, const Reference& b) {
-        return a.location < b.location;
-      });
-}
-
-}  // namespace
-
 ReferenceSet::ReferenceSet(const ReferenceTypeTraits& traits,
                            const TargetPool& target_pool)
     : traits_(traits), target_pool_(target_pool) {}
@@ -33,35 +19,46 @@ ReferenceSet::ReferenceSet(ReferenceSet&&) = default;
 ReferenceSet::~ReferenceSet() = default;
 
 void ReferenceSet::InitReferences(ReferenceReader&& ref_reader) {
-  DCHECK(references_.empty());
+  DCHECK(locations_.empty());
   for (auto ref = ref_reader.GetNext(); ref.has_value();
        ref = ref_reader.GetNext()) {
-    references_.push_back(
-        {ref->location, ref->target});
+    locations_.push_back(ref->location);
+    target_keys_.push_back(target_pool_.KeyForOffset(ref->target));
   }
-  DCHECK(IsReferenceListSorted(references_));
+  DCHECK(std::is_sorted(locations_.begin(), locations_.end()));
 }
 
 void ReferenceSet::InitReferences(const std::vector<Reference>& refs) {
-  DCHECK(references_.empty());
-  references_.reserve(refs.size());
-  std::transform(refs.begin(), refs.end(), std::back_inserter(references_),
-                 [&](const Reference& ref) -> Reference {
-                   return {ref.location, target_pool_.KeyForOffset(ref.target)};
-                 });
-  DCHECK(IsReferenceListSorted(references_));
+  DCHECK(locations_.empty());
+  locations_.reserve(refs.size());
+  target_keys_.reserve(refs.size());
+  for (const Reference& ref : refs) {
+    locations_.push_back(ref.location);
+    target_keys_.push_back(target_pool_.KeyForOffset(ref.target));
+  }
+  DCHECK(std::is_sorted(locations_.begin(), locations_.end()));
+}
+
+Reference ReferenceSet::GetReference(size_t index) const {
+  DCHECK_LT(index, size());
+  return {locations_[index], target_pool_.OffsetForKey(target_keys_[index])};
+}
+
+std::vector<Reference> ReferenceSet::GetReferences() const {
+  std::vector<Reference> references;
+  references.reserve(size());
+  for (size_t i = 0; i < size(); ++i)
+    references.push_back(GetReference(i));
+  return references;
 }
 
 Reference ReferenceSet::at(offset_t offset) const {
-  auto pos = std::upper_bound(references_.begin(), references_.end(), offset,
-                              [](offset_t a, const Reference& ref) {
-                                return a < ref.location;
-                              });
+  auto pos = std::upper_bound(locations_.begin(), locations_.end(), offset);
 
-  DCHECK(pos != references_.begin());  // Iterators.
+  DCHECK(pos != locations_.begin());  // Iterators.
   --pos;
-  DCHECK_LT(offset, pos->location + width());
-  return *pos;
+  DCHECK_LT(offset, *pos + width());
+  return GetReference(pos - locations_.begin());
 }
 
 }  // namespace zucchini
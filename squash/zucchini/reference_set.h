@@ -16,10 +16,10 @@ namespace zucchini {
 class TargetPool;
 
 // Container of distinct indirect references of one type, along with traits.
+// References are stored as parallel arrays of locations and target keys, so
+// that targets can be looked up without searching |target_pool|.
 class ReferenceSet {
  public:
-  using const_iterator = std::vector<Reference>::const_iterator;
-
   // |traits| specifies the reference represented. |target_pool| specifies
   // common targets shared by all reference represented, and mediates target
   // translation between offsets and indexes.
@@ -35,29 +35,38 @@ class ReferenceSet {
   void InitReferences(ReferenceReader&& ref_reader);
   void InitReferences(const std::vector<Reference>& refs);
 
-  const std::vector<Reference>& references() const {
-    return references_;
-  }
+  // Returns the locations of all references, in ascending order.
+  const std::vector<offset_t>& locations() const { return locations_; }
+  // Returns the keys in |target_pool_| of the targets of all references, in
+  // the same order as locations().
+  const std::vector<key_t>& target_keys() const { return target_keys_; }
+
   const TargetPool& target_pool() const { return target_pool_; }
   const ReferenceTypeTraits& traits() const { return traits_; }
   TypeTag type_tag() const { return traits_.type_tag; }
   PoolTag pool_tag() const { return traits_.pool_tag; }
   offset_t width() const { return traits_.width; }
 
-  // Looks up the IndirectReference by an |offset| that it spans. |offset| is
-  // assumed to be valid, i.e., |offset| must be spanned by some
-  // IndirectReference in |references_|.
+  // Returns the reference at |index| in the list of references.
+  Reference GetReference(size_t index) const;
+
+  // Returns all references, sorted by location.
+  std::vector<Reference> GetReferences() const;
+
+  // Looks up the reference by an |offset| that it spans. |offset| is assumed
+  // to be valid, i.e., |offset| must be spanned by some reference.
   Reference at(offset_t offset) const;
 
-  size_t size() const { return references_.size(); }
-  const_iterator begin() const { return references_.begin(); }
-  const_iterator end() const { return references_.end(); }
+  size_t size() const { return locations_.size(); }
+  bool empty() const { return locations_.empty(); }
 
  private:
   ReferenceTypeTraits traits_;
   const TargetPool& target_pool_;
-  // List of distinct IndirectReference instances sorted by location.
-  std::vector<Reference> references_;
+  // Locations of distinct references, sorted in ascending order.
+  std::vector<offset_t> locations_;
+  // Target key of each reference in |locations_|.
+  std::vector<key_t> target_keys_;
 };
 
 }  // namespace zucchini
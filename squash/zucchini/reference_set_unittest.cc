@@ -21,24 +21,34 @@ class ReferenceSetTest : public testing::Test {
 };
 
 TEST_F(ReferenceSetTest, InitReferencesFromReader) {
-  EXPECT_EQ(std::vector<IndirectReference>(), reference_set_.references());
+  EXPECT_EQ(std::vector<offset_t>(), reference_set_.locations());
   EXPECT_EQ(0U, reference_set_.size());
   std::vector<Reference> references = {{0, 0}, {2, 2}, {4, 5}};
   reference_set_.InitReferences(TestReferenceReader(references));
-  EXPECT_EQ(std::vector<IndirectReference>({{0, 0}, {2, 1}, {4, 3}}),
-            reference_set_.references());
+  EXPECT_EQ(std::vector<offset_t>({0, 2, 4}), reference_set_.locations());
+  EXPECT_EQ(std::vector<key_t>({0, 1, 3}), reference_set_.target_keys());
+  EXPECT_EQ(references, reference_set_.GetReferences());
   EXPECT_EQ(3U, reference_set_.size());
 }
 
+TEST_F(ReferenceSetTest, InitReferencesFromVector) {
+  std::vector<Reference> references = {{0, 0}, {2, 2}, {4, 5}};
+  reference_set_.InitReferences(references);
+  EXPECT_EQ(std::vector<offset_t>({0, 2, 4}), reference_set_.locations());
+  EXPECT_EQ(std::vector<key_t>({0, 1, 3}), reference_set_.target_keys());
+  EXPECT_EQ(Reference({2, 2}), reference_set_.GetReference(1));
+  EXPECT_EQ(references, reference_set_.GetReferences());
+}
+
 TEST_F(ReferenceSetTest, At) {
   reference_set_.InitReferences({{0, 0}, {2, 2}, {5, 5}});
   // Each references has width 2, so check all bytes covered.
-  EXPECT_EQ(IndirectReference({0, 0}), reference_set_.at(0));
-  EXPECT_EQ(IndirectReference({0, 0}), reference_set_.at(1));
-  EXPECT_EQ(IndirectReference({2, 1}), reference_set_.at(2));
-  EXPECT_EQ(IndirectReference({2, 1}), reference_set_.at(3));
-  EXPECT_EQ(IndirectReference({5, 3}), reference_set_.at(5));
-  EXPECT_EQ(IndirectReference({5, 3}), reference_set_.at(6));
+  EXPECT_EQ(Reference({0, 0}), reference_set_.at(0));
+  EXPECT_EQ(Reference({0, 0}), reference_set_.at(1));
+  EXPECT_EQ(Reference({2, 2}), reference_set_.at(2));
+  EXPECT_EQ(Reference({2, 2}), reference_set_.at(3));
+  EXPECT_EQ(Reference({5, 5}), reference_set_.at(5));
+  EXPECT_EQ(Reference({5, 5}), reference_set_.at(6));
 }
 
 }  // namespace zucchini
@@ -4,10 +4,152 @@
 
 #include "squash/zucchini/rel32_finder.h"
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include <algorithm>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "squash/zucchini/algorithm.h"
+
 namespace zucchini {
 
+namespace {
+
+#if defined(__AVX2__)
+// Operations on 32 bytes at once, used by FindCandidate().
+struct Avx2Block {
+  using Vector = __m256i;
+  static constexpr size_t kSize = 32;
+  static Vector Load(ConstBufferView::const_iterator p) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+  }
+  static Vector Splat(uint8_t value) {
+    return _mm256_set1_epi8(static_cast<char>(value));
+  }
+  static Vector Equal(Vector a, Vector b) { return _mm256_cmpeq_epi8(a, b); }
+  static Vector And(Vector a, Vector b) { return _mm256_and_si256(a, b); }
+  static Vector Or(Vector a, Vector b) { return _mm256_or_si256(a, b); }
+  static uint32_t MoveMask(Vector a) {
+    return static_cast<uint32_t>(_mm256_movemask_epi8(a));
+  }
+};
+#endif
+
+#if defined(__SSE2__)
+// Operations on 16 bytes at once, used by FindCandidate().
+struct Sse2Block {
+  using Vector = __m128i;
+  static constexpr size_t kSize = 16;
+  static Vector Load(ConstBufferView::const_iterator p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  }
+  static Vector Splat(uint8_t value) {
+    return _mm_set1_epi8(static_cast<char>(value));
+  }
+  static Vector Equal(Vector a, Vector b) { return _mm_cmpeq_epi8(a, b); }
+  static Vector And(Vector a, Vector b) { return _mm_and_si128(a, b); }
+  static Vector Or(Vector a, Vector b) { return _mm_or_si128(a, b); }
+  static uint32_t MoveMask(Vector a) {
+    return static_cast<uint32_t>(_mm_movemask_epi8(a));
+  }
+};
+#endif
+
+// Returns a vector holding 0xFF for each pair of bytes (|b0[i]|, |b1[i]|) that
+// starts an instruction looked for by Rel32FinderX86: CALL, JMP, or Jcc long
+// form.
+template <class Block>
+typename Block::Vector MatchX86(typename Block::Vector b0,
+                                typename Block::Vector b1) {
+  // E8, E9.
+  typename Block::Vector call_jmp = Block::Equal(
+      Block::And(b0, Block::Splat(0xFE)), Block::Splat(0xE8));
+  // 0F 8x.
+  typename Block::Vector jcc =
+      Block::And(Block::Equal(b0, Block::Splat(0x0F)),
+                 Block::Equal(Block::And(b1, Block::Splat(0xF0)),
+                              Block::Splat(0x80)));
+  return Block::Or(call_jmp, jcc);
+}
+
+// Same as MatchX86(), for Rel32FinderX64, which also looks for instructions
+// with a rip-relative operand.
+template <class Block>
+typename Block::Vector MatchX64(typename Block::Vector b0,
+                                typename Block::Vector b1) {
+  // FF 15, FF 25.
+  typename Block::Vector call_jmp_rip =
+      Block::And(Block::Equal(b0, Block::Splat(0xFF)),
+                 Block::Or(Block::Equal(b1, Block::Splat(0x15)),
+                           Block::Equal(b1, Block::Splat(0x25))));
+  // 89, 8B, 8D with ModR/M = 00RRR101.
+  typename Block::Vector mov_lea_rip = Block::And(
+      Block::Or(Block::Equal(b0, Block::Splat(0x89)),
+                Block::Or(Block::Equal(b0, Block::Splat(0x8B)),
+                          Block::Equal(b0, Block::Splat(0x8D)))),
+      Block::Equal(Block::And(b1, Block::Splat(0xC7)), Block::Splat(0x05)));
+  return Block::Or(MatchX86<Block>(b0, b1),
+                   Block::Or(call_jmp_rip, mov_lea_rip));
+}
+
+// Skips blocks of |Block::kSize| bytes in [|first|, |last|) where no position
+// matches |match|, which tests the first 2 bytes of instructions. Returns the
+// first matching position, or the start of the last partial block, which the
+// caller scans one byte at a time.
+template <class Block,
+          typename Block::Vector (*match)(typename Block::Vector,
+                                          typename Block::Vector)>
+ConstBufferView::const_iterator FindCandidate(
+    ConstBufferView::const_iterator first,
+    ConstBufferView::const_iterator last) {
+  // The byte that follows each block is also read.
+  for (; last - first > static_cast<ptrdiff_t>(Block::kSize);
+       first += Block::kSize) {
+    uint32_t mask =
+        Block::MoveMask(match(Block::Load(first), Block::Load(first + 1)));
+    if (mask)
+      return first + CountTrailingZeros(mask);
+  }
+  return first;
+}
+
+// Returns the first position in [|first|, |last|) that may start an
+// instruction looked for by Rel32FinderX86, at a block granularity. Positions
+// skipped are guaranteed to not match.
+ConstBufferView::const_iterator FindCandidateX86(
+    ConstBufferView::const_iterator first,
+    ConstBufferView::const_iterator last) {
+#if defined(__AVX2__)
+  first = FindCandidate<Avx2Block, MatchX86<Avx2Block>>(first, last);
+#endif
+#if defined(__SSE2__)
+  first = FindCandidate<Sse2Block, MatchX86<Sse2Block>>(first, last);
+#endif
+  return first;
+}
+
+// Same as FindCandidateX86(), for Rel32FinderX64.
+ConstBufferView::const_iterator FindCandidateX64(
+    ConstBufferView::const_iterator first,
+    ConstBufferView::const_iterator last) {
+#if defined(__AVX2__)
+  first = FindCandidate<Avx2Block, MatchX64<Avx2Block>>(first, last);
+#endif
+#if defined(__SSE2__)
+  first = FindCandidate<Sse2Block, MatchX64<Sse2Block>>(first, last);
+#endif
+  return first;
+}
+
+}  // namespace
+
 /******** Abs32GapFinder ********/
 
 Abs32GapFinder::Abs32GapFinder(ConstBufferView image,
@@ -71,7 +213,7 @@ Rel32Finder::~Rel32Finder() = default;
 
 ConstBufferView Rel32FinderX86::Scan(ConstBufferView region) {
   ConstBufferView::const_iterator cursor = region.begin();
-  while (cursor < region.end()) {
+  while ((cursor = FindCandidateX86(cursor, region.end())) < region.end()) {
     // Heuristic rel32 detection by looking for opcodes that use them.
     if (cursor + 5 <= region.end()) {
       if (cursor[0] == 0xE8 || cursor[0] == 0xE9) {  // JMP rel32; CALL rel32
@@ -94,7 +236,7 @@ ConstBufferView Rel32FinderX86::Scan(ConstBufferView region) {
 
 ConstBufferView Rel32FinderX64::Scan(ConstBufferView region) {
   ConstBufferView::const_iterator cursor = region.begin();
-  while (cursor < region.end()) {
+  while ((cursor = FindCandidateX64(cursor, region.end())) < region.end()) {
     // Heuristic rel32 detection by looking for opcodes that use them.
     if (cursor + 5 <= region.end()) {
       if (cursor[0] == 0xE8 || cursor[0] == 0xE9) {  // JMP rel32; CALL rel32
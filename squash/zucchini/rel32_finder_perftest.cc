@@ -0,0 +1,72 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "squash/zucchini/rel32_finder.h"
+
+#include <stddef.h>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "boost/filesystem.hpp"
+#include "gtest/gtest.h"
+#include "squash/zucchini/buffer_view.h"
+#include "squash/zucchini/mapped_file.h"
+
+namespace zucchini {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+boost::filesystem::path MakeTestPath(const std::string& filename) {
+  return boost::filesystem::path("squash") / "testdata" / filename;
+}
+
+// Returns the number of rel32 candidates found by |rel_finder|.
+template <class Rel32FinderType>
+size_t CountCandidates(Rel32FinderType* rel_finder) {
+  size_t count = 0;
+  for (auto rel32 = rel_finder->GetNext(); rel32.has_value();
+       rel32 = rel_finder->GetNext()) {
+    ++count;
+  }
+  return count;
+}
+
+// Measures the throughput of |Rel32FinderType| over all bytes of a test file.
+// Candidates are not accepted, so all of them are visited.
+template <class Rel32FinderType>
+void MeasureScan(const std::string& name) {
+  MappedFileReader file(MakeTestPath("chrome64_1.exe"));
+  ASSERT_TRUE(file.IsValid());
+  ConstBufferView image = file.region();
+
+  constexpr int kRepeats = 5;
+  size_t count = 0;
+  auto start = Clock::now();
+  for (int i = 0; i < kRepeats; ++i) {
+    Rel32FinderType rel_finder(image);
+    count += CountCandidates(&rel_finder);
+  }
+  std::chrono::duration<double> time = Clock::now() - start;
+  EXPECT_GT(count, 0U);
+  std::cout << name << ": " << count / kRepeats << " candidates in "
+            << image.size() << " bytes, "
+            << kRepeats * image.size() / time.count() / (1 << 20) << " MB/s"
+            << std::endl;
+}
+
+}  // namespace
+
+TEST(Rel32FinderPerfTest, ScanX86) {
+  MeasureScan<Rel32FinderX86>("Rel32FinderX86");
+}
+
+TEST(Rel32FinderPerfTest, ScanX64) {
+  MeasureScan<Rel32FinderX64>("Rel32FinderX64");
+}
+
+}  // namespace zucchini
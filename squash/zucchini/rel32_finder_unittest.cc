@@ -9,12 +9,14 @@
 
 #include <algorithm>
 #include <iterator>
+#include <random>
 #include <sstream>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "squash/base/logging.h"
+#include "squash/base/macros.h"
 #include "squash/zucchini/buffer_view.h"
 #include "squash/zucchini/image_utils.h"
 #include "gtest/gtest.h"
@@ -347,6 +349,59 @@ TEST(Rel32FinderX64Test, FindNext) {
   EXPECT_EQ(base::nullopt, rel_finder.GetNext());
 }
 
+TEST(Rel32FinderX64Test, ScanBlocks) {
+  // Opcodes are scanned in blocks, so candidates are placed at random
+  // positions with respect to blocks, including near the end of regions.
+  constexpr uint8_t kBytes[] = {0xE8, 0xE9, 0x0F, 0x80, 0x8F, 0xFF, 0x15,
+                                0x25, 0x89, 0x8B, 0x8D, 0x05, 0x3D, 0x00};
+  std::mt19937 rng(0);
+  std::vector<uint8_t> buffer(1000);
+  for (uint8_t& value : buffer)
+    value = (rng() % 4) ? static_cast<uint8_t>(rng())
+                        : kBytes[rng() % arraysize(kBytes)];
+
+  for (size_t size : {0U, 5U, 6U, 17U, 31U, 32U, 33U, 63U, 1000U}) {
+    ConstBufferView image(buffer.data(), size);
+    // Rel32 locations of candidates found by scanning one byte at a time.
+    std::vector<size_t> expected_x86;
+    std::vector<size_t> expected_x64;
+    for (size_t i = 0; i < size; ++i) {
+      const uint8_t* cursor = buffer.data() + i;
+      if (i + 5 <= size && (cursor[0] == 0xE8 || cursor[0] == 0xE9)) {
+        expected_x86.push_back(i + 1);
+        expected_x64.push_back(i + 1);
+      } else if (i + 6 <= size) {
+        if (cursor[0] == 0x0F && (cursor[1] & 0xF0) == 0x80) {
+          expected_x86.push_back(i + 2);
+          expected_x64.push_back(i + 2);
+        } else if ((cursor[0] == 0xFF &&
+                    (cursor[1] == 0x15 || cursor[1] == 0x25)) ||
+                   ((cursor[0] == 0x89 || cursor[0] == 0x8B ||
+                     cursor[0] == 0x8D) &&
+                    (cursor[1] & 0xC7) == 0x05)) {
+          expected_x64.push_back(i + 2);
+        }
+      }
+    }
+
+    std::vector<size_t> locations_x86;
+    Rel32FinderX86 rel_finder_x86(image);
+    for (auto result = rel_finder_x86.GetNext(); result.has_value();
+         result = rel_finder_x86.GetNext()) {
+      locations_x86.push_back(result->location - image.begin());
+    }
+    EXPECT_EQ(expected_x86, locations_x86);
+
+    std::vector<size_t> locations_x64;
+    Rel32FinderX64 rel_finder_x64(image);
+    for (auto result = rel_finder_x64.GetNext(); result.has_value();
+         result = rel_finder_x64.GetNext()) {
+      locations_x64.push_back(result->location - image.begin());
+    }
+    EXPECT_EQ(expected_x64, locations_x64);
+  }
+}
+
 // TODO(huangs): Test that integrates Abs32GapFinder and Rel32Finder.
 
 }  // namespace zucchini
@@ -0,0 +1,122 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "squash/zucchini/seed_index.h"
+
+#include <algorithm>
+
+#include "squash/base/logging.h"
+#include "squash/zucchini/algorithm.h"
+#include "squash/zucchini/encoded_view.h"
+
+namespace zucchini {
+
+namespace {
+
+// Base of the polynomial hash computed by WindowHash.
+constexpr uint64_t kHashBase = 0x100000001B3ULL;
+
+// Returns |kHashBase| to the power |WindowHash::kSize - 1|, the factor of the
+// first projection of a window.
+constexpr uint64_t FirstProjectionFactor() {
+  uint64_t factor = 1;
+  for (offset_t i = 1; i < WindowHash::kSize; ++i)
+    factor *= kHashBase;
+  return factor;
+}
+
+constexpr uint64_t kFirstProjectionFactor = FirstProjectionFactor();
+
+// Mixes bits of |hash|, so that both its high bits, used to pick slots, and its
+// low bits, used as fingerprints, depend on all projections of a window.
+uint64_t MixHash(uint64_t hash) {
+  return MixBits(hash);
+}
+
+}  // namespace
+
+/******** WindowHash ********/
+
+constexpr offset_t WindowHash::kSize;
+
+WindowHash::WindowHash(const EncodedView& view) : view_(view) {}
+
+uint64_t WindowHash::MoveTo(offset_t location) {
+  DCHECK_GE(view_.size(), kSize);
+  DCHECK_LE(location, view_.size() - kSize);
+  if (location_ != kInvalidOffset && location >= location_ &&
+      location - location_ < kSize) {
+    for (; location_ < location; ++location_) {
+      hash_ = (hash_ - view_.Projection(location_) * kFirstProjectionFactor) *
+                  kHashBase +
+              view_.Projection(location_ + kSize);
+    }
+    return hash_;
+  }
+  location_ = location;
+  hash_ = 0;
+  for (offset_t i = 0; i < kSize; ++i)
+    hash_ = hash_ * kHashBase + view_.Projection(location + i);
+  return hash_;
+}
+
+/******** SeedIndex ********/
+
+constexpr offset_t SeedIndex::kStride;
+constexpr size_t SeedIndex::kMaxOffsetsPerWindow;
+
+SeedIndex::SeedIndex(const EncodedView& old_view) {
+  if (old_view.size() < WindowHash::kSize)
+    return;
+  offset_t last_location = old_view.size() - WindowHash::kSize;
+  size_t num_windows = 0;
+  for (offset_t location = 0; location <= last_location; location += kStride) {
+    if (old_view.IsToken(location))
+      ++num_windows;
+  }
+  // At most 3/4 of the slots are used, to keep probe sequences short.
+  slot_bits_ = 1;
+  while ((size_t(1) << slot_bits_) * 3 < num_windows * 4)
+    ++slot_bits_;
+  slots_.assign(size_t(1) << slot_bits_, {0, kInvalidOffset});
+
+  size_t mask = slots_.size() - 1;
+  WindowHash window_hash(old_view);
+  for (offset_t location = 0; location <= last_location; location += kStride) {
+    if (!old_view.IsToken(location))
+      continue;
+    uint64_t hash = window_hash.MoveTo(location);
+    uint32_t fingerprint = static_cast<uint32_t>(MixHash(hash));
+    size_t count = 0;
+    size_t index = SlotIndex(hash);
+    for (; slots_[index].offset != kInvalidOffset; index = (index + 1) & mask) {
+      if (slots_[index].fingerprint == fingerprint)
+        ++count;
+    }
+    if (count < kMaxOffsetsPerWindow)
+      slots_[index] = {fingerprint, location};
+  }
+}
+
+SeedIndex::SeedIndex(SeedIndex&&) = default;
+
+SeedIndex::~SeedIndex() = default;
+
+void SeedIndex::Find(uint64_t hash, std::vector<offset_t>* offsets) const {
+  if (slots_.empty())
+    return;
+  uint32_t fingerprint = static_cast<uint32_t>(MixHash(hash));
+  size_t mask = slots_.size() - 1;
+  for (size_t index = SlotIndex(hash); slots_[index].offset != kInvalidOffset;
+       index = (index + 1) & mask) {
+    if (slots_[index].fingerprint == fingerprint)
+      offsets->push_back(slots_[index].offset);
+  }
+}
+
+size_t SeedIndex::SlotIndex(uint64_t hash) const {
+  return static_cast<size_t>(MixHash(hash) >> (64 - slot_bits_));
+}
+
+}  // namespace zucchini
@@ -0,0 +1,85 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CHROME_INSTALLER_ZUCCHINI_SEED_INDEX_H_
+#define CHROME_INSTALLER_ZUCCHINI_SEED_INDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "squash/zucchini/image_utils.h"
+
+namespace zucchini {
+
+class EncodedView;
+
+// Polynomial hash of the window of |kSize| consecutive projections of an
+// EncodedView starting at some location, which is cheap to move forward.
+class WindowHash {
+ public:
+  // Number of projections in a window.
+  static constexpr offset_t kSize = 12;
+
+  // |view| is required to remain valid for the lifetime of the object.
+  explicit WindowHash(const EncodedView& view);
+
+  // Moves the window to start at |location|, which must be at most
+  // |view.size() - kSize|, and returns the hash of the window.
+  uint64_t MoveTo(offset_t location);
+
+ private:
+  const EncodedView& view_;
+  // Location of the current window, or kInvalidOffset if none.
+  offset_t location_ = kInvalidOffset;
+  uint64_t hash_ = 0;
+};
+
+// Hash table of windows of projections of "old" image, used as a fast
+// alternative to its suffix array to find seeds of equivalences. Windows are
+// indexed every |kStride| locations, so any match at least
+// |WindowHash::kSize + kStride - 1| long contains an indexed window. Windows
+// that occur many times only keep their first |kMaxOffsetsPerWindow| offsets.
+// Slots store a fingerprint of the hash and an offset, in open addressing with
+// linear probing, and at most 3/4 of them are used.
+class SeedIndex {
+ public:
+  // Distance between indexed windows of "old" image.
+  static constexpr offset_t kStride = 4;
+  // Maximum number of offsets kept for the same window.
+  static constexpr size_t kMaxOffsetsPerWindow = 16;
+
+  // Indexes windows of |old_view| that start on tokens.
+  explicit SeedIndex(const EncodedView& old_view);
+  SeedIndex(const SeedIndex&) = delete;
+  SeedIndex(SeedIndex&&);
+  ~SeedIndex();
+
+  // Appends to |offsets| the offsets of indexed windows of "old" image whose
+  // hash is |hash|, in increasing order. Windows with a different content
+  // might also be found if hashes collide.
+  void Find(uint64_t hash, std::vector<offset_t>* offsets) const;
+
+  // Returns the number of bytes used by the table.
+  size_t SizeInBytes() const { return slots_.size() * sizeof(Slot); }
+
+ private:
+  struct Slot {
+    uint32_t fingerprint;
+    // kInvalidOffset for empty slots.
+    offset_t offset;
+  };
+
+  // Returns the index of the first slot probed for |hash|.
+  size_t SlotIndex(uint64_t hash) const;
+
+  std::vector<Slot> slots_;
+  // Number of bits used by SlotIndex().
+  uint32_t slot_bits_ = 0;
+};
+
+}  // namespace zucchini
+
+#endif  // CHROME_INSTALLER_ZUCCHINI_SEED_INDEX_H_
@@ -0,0 +1,119 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "squash/zucchini/seed_index.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "squash/zucchini/buffer_view.h"
+#include "squash/zucchini/encoded_view.h"
+#include "squash/zucchini/image_index.h"
+#include "gtest/gtest.h"
+
+namespace zucchini {
+
+namespace {
+
+// Returns |size| random bytes, with a copy of the first |copy_size| bytes at
+// |copy_offset|.
+std::vector<uint8_t> MakeImage(size_t size,
+                               size_t copy_offset,
+                               size_t copy_size) {
+  std::mt19937 rng(7);
+  std::vector<uint8_t> image(size);
+  for (uint8_t& value : image)
+    value = static_cast<uint8_t>(rng());
+  std::copy(image.begin(), image.begin() + copy_size,
+            image.begin() + copy_offset);
+  return image;
+}
+
+}  // namespace
+
+TEST(WindowHashTest, MoveTo) {
+  std::vector<uint8_t> image = MakeImage(256, 128, 64);
+  ImageIndex image_index({image.data(), image.size()});
+  EncodedView view(image_index);
+
+  WindowHash rolling_hash(view);
+  std::vector<uint64_t> hashes;
+  for (offset_t location = 0; location <= view.size() - WindowHash::kSize;
+       ++location) {
+    // Moving forward gives the same hash as computing it from scratch.
+    hashes.push_back(rolling_hash.MoveTo(location));
+    EXPECT_EQ(hashes.back(), WindowHash(view).MoveTo(location));
+  }
+  // Moving backward or far ahead recomputes the hash.
+  EXPECT_EQ(hashes[3], rolling_hash.MoveTo(3));
+  EXPECT_EQ(hashes[3 + WindowHash::kSize],
+            rolling_hash.MoveTo(3 + WindowHash::kSize));
+
+  // Equal windows have equal hashes.
+  for (offset_t location = 0; location <= 64 - WindowHash::kSize; ++location)
+    EXPECT_EQ(hashes[location], hashes[128 + location]);
+  EXPECT_NE(hashes[0], hashes[1]);
+  EXPECT_NE(hashes[0], hashes[64]);
+}
+
+TEST(SeedIndexTest, Find) {
+  std::vector<uint8_t> image = MakeImage(4096, 1024, 512);
+  ImageIndex image_index({image.data(), image.size()});
+  EncodedView view(image_index);
+  SeedIndex seeds(view);
+
+  WindowHash window_hash(view);
+  for (offset_t location = 0; location <= view.size() - WindowHash::kSize;
+       ++location) {
+    std::vector<offset_t> offsets;
+    seeds.Find(window_hash.MoveTo(location), &offsets);
+    EXPECT_TRUE(std::is_sorted(offsets.begin(), offsets.end()));
+
+    // Only windows at multiples of |kStride| are indexed. The window at
+    // |location| is also found at its copy, if any.
+    std::vector<offset_t> expected;
+    constexpr offset_t kLastCopied = 512 - WindowHash::kSize;
+    if (location % SeedIndex::kStride == 0) {
+      if (location >= 1024 && location - 1024 <= kLastCopied)
+        expected.push_back(location - 1024);
+      expected.push_back(location);
+      if (location <= kLastCopied)
+        expected.push_back(location + 1024);
+    }
+    EXPECT_EQ(expected, offsets);
+  }
+}
+
+TEST(SeedIndexTest, RepeatedWindows) {
+  // All windows are equal, but only the first |kMaxOffsetsPerWindow| are kept.
+  std::vector<uint8_t> image(1024, 0xCC);
+  ImageIndex image_index({image.data(), image.size()});
+  EncodedView view(image_index);
+  SeedIndex seeds(view);
+
+  std::vector<offset_t> offsets;
+  seeds.Find(WindowHash(view).MoveTo(100), &offsets);
+  std::vector<offset_t> expected;
+  for (size_t i = 0; i < SeedIndex::kMaxOffsetsPerWindow; ++i)
+    expected.push_back(static_cast<offset_t>(i * SeedIndex::kStride));
+  EXPECT_EQ(expected, offsets);
+}
+
+TEST(SeedIndexTest, Empty) {
+  std::vector<uint8_t> image(WindowHash::kSize - 1, 0xCC);
+  ImageIndex image_index({image.data(), image.size()});
+  EncodedView view(image_index);
+  SeedIndex seeds(view);
+  EXPECT_EQ(0U, seeds.SizeInBytes());
+
+  std::vector<offset_t> offsets;
+  seeds.Find(0, &offsets);
+  EXPECT_TRUE(offsets.empty());
+}
+
+}  // namespace zucchini
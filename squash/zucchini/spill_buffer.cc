@@ -0,0 +1,119 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "squash/zucchini/spill_buffer.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "squash/base/logging.h"
+
+namespace zucchini {
+
+namespace {
+
+// Moves the position of |file| to |offset|, returns true iff successful. Only
+// offsets that fit in long are supported by fseek().
+bool Seek(FILE* file, uint64_t offset) {
+  if (offset > static_cast<uint64_t>(std::numeric_limits<long>::max()))
+    return false;
+  return fseek(file, static_cast<long>(offset), SEEK_SET) == 0;
+}
+
+}  // namespace
+
+/******** SpillFile ********/
+
+SpillFile::SpillFile() = default;
+
+SpillFile::~SpillFile() {
+  if (file_)
+    fclose(file_);
+}
+
+bool SpillFile::Append(ConstBufferView data, uint64_t* offset) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (failed_)
+    return false;
+  if (!file_) {
+    file_ = tmpfile();
+    if (!file_) {
+      LOG(WARNING) << "Failed to create a temporary file, patch streams are "
+                   << "kept in memory.";
+      failed_ = true;
+      return false;
+    }
+  }
+  if (!Seek(file_, size_) ||
+      fwrite(data.begin(), 1, data.size(), file_) != data.size()) {
+    LOG(WARNING) << "Failed to write to temporary file, patch streams are "
+                 << "kept in memory.";
+    failed_ = true;
+    return false;
+  }
+  *offset = size_;
+  size_ += data.size();
+  return true;
+}
+
+bool SpillFile::Read(uint64_t offset, MutableBufferView data) {
+  std::lock_guard<std::mutex> lock(lock_);
+  DCHECK(file_);
+  DCHECK_LE(offset + data.size(), size_);
+  return Seek(file_, offset) &&
+         fread(data.begin(), 1, data.size(), file_) == data.size();
+}
+
+/******** SpillBuffer ********/
+
+constexpr size_t SpillBuffer::kChunkSize;
+
+SpillBuffer::SpillBuffer(SpillFile* spill_file)
+    : spill_file_(spill_file), in_memory_(!spill_file) {}
+
+SpillBuffer::SpillBuffer(const std::vector<uint8_t>& data) : tail_(data) {}
+
+SpillBuffer::SpillBuffer(SpillBuffer&&) = default;
+
+SpillBuffer::~SpillBuffer() = default;
+
+SpillBuffer& SpillBuffer::operator=(SpillBuffer&&) = default;
+
+void SpillBuffer::Append(ConstBufferView data) {
+  while (!in_memory_ && !data.empty()) {
+    size_t size = std::min(data.size(), kChunkSize - tail_.size());
+    tail_.insert(tail_.end(), data.begin(), data.begin() + size);
+    data.remove_prefix(size);
+    if (tail_.size() == kChunkSize)
+      Spill();
+  }
+  tail_.insert(tail_.end(), data.begin(), data.end());
+}
+
+bool SpillBuffer::WriteInto(BufferSink* sink) const {
+  if (sink->Remaining() < size())
+    return false;
+  for (uint64_t chunk_offset : chunk_offsets_) {
+    if (!spill_file_->Read(chunk_offset, {sink->begin(), kChunkSize}))
+      return false;
+    sink->remove_prefix(kChunkSize);
+  }
+  return sink->PutRange(tail_.begin(), tail_.end());
+}
+
+void SpillBuffer::Spill() {
+  if (in_memory_)
+    return;
+  DCHECK_EQ(kChunkSize, tail_.size());
+  uint64_t chunk_offset = 0;
+  if (!spill_file_->Append({tail_.data(), tail_.size()}, &chunk_offset)) {
+    in_memory_ = true;
+    return;
+  }
+  chunk_offsets_.push_back(chunk_offset);
+  spilled_size_ += kChunkSize;
+  tail_.clear();
+}
+
+}  // namespace zucchini
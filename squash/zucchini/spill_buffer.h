@@ -0,0 +1,103 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CHROME_INSTALLER_ZUCCHINI_SPILL_BUFFER_H_
+#define CHROME_INSTALLER_ZUCCHINI_SPILL_BUFFER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <mutex>
+#include <vector>
+
+#include "squash/base/macros.h"
+#include "squash/zucchini/buffer_sink.h"
+#include "squash/zucchini/buffer_view.h"
+
+namespace zucchini {
+
+// An anonymous temporary file, shared by SpillBuffers to store data they don't
+// keep in memory. The file is created on first use, and deleted on
+// destruction. Methods can be called concurrently.
+class SpillFile {
+ public:
+  SpillFile();
+  ~SpillFile();
+
+  // Appends |data| to the file and writes its offset to |offset|. Returns
+  // false if the file can't be created or written.
+  bool Append(ConstBufferView data, uint64_t* offset);
+
+  // Reads |data.size()| bytes at |offset|, which must have been written by
+  // Append(), into |data|. Returns false on failure.
+  bool Read(uint64_t offset, MutableBufferView data);
+
+ private:
+  std::mutex lock_;
+  // Guarded by |lock_|.
+  FILE* file_ = nullptr;
+  uint64_t size_ = 0;
+  bool failed_ = false;
+
+  DISALLOW_COPY_AND_ASSIGN(SpillFile);
+};
+
+// A growable buffer of bytes, used by patch sinks to accumulate streams. Data
+// is kept in memory up to |kChunkSize| bytes, beyond which full chunks are
+// moved to a SpillFile, if any, so memory doesn't grow with the size of the
+// stream. If the SpillFile fails, data is kept in memory instead. Supports
+// std::back_inserter().
+class SpillBuffer {
+ public:
+  using value_type = uint8_t;
+
+  static constexpr size_t kChunkSize = 1 << 16;
+
+  // Creates a buffer that spills to |spill_file|, which is required to outlive
+  // it, or that is always kept in memory if null.
+  explicit SpillBuffer(SpillFile* spill_file = nullptr);
+  // Creates a buffer that holds |data| in memory.
+  explicit SpillBuffer(const std::vector<uint8_t>& data);
+  SpillBuffer(SpillBuffer&&);
+  ~SpillBuffer();
+
+  SpillBuffer& operator=(SpillBuffer&&);
+
+  void push_back(uint8_t value) {
+    tail_.push_back(value);
+    if (tail_.size() == kChunkSize)
+      Spill();
+  }
+
+  // Appends |data| to the buffer.
+  void Append(ConstBufferView data);
+
+  size_t size() const { return spilled_size_ + tail_.size(); }
+
+  // If sufficient space is available, writes all data into |sink| and returns
+  // true. Otherwise, or if spilled data can't be read back, returns false.
+  bool WriteInto(BufferSink* sink) const;
+
+ private:
+  // Moves |tail_|, which holds a full chunk, to |spill_file_|, unless data is
+  // kept in memory.
+  void Spill();
+
+  SpillFile* spill_file_ = nullptr;
+  // Whether data is kept in memory, i.e., if there is no |spill_file_| or if
+  // it failed.
+  bool in_memory_ = true;
+  // Offsets in |spill_file_| of spilled chunks, in order.
+  std::vector<uint64_t> chunk_offsets_;
+  size_t spilled_size_ = 0;
+  // Data that follows spilled chunks.
+  std::vector<uint8_t> tail_;
+
+  DISALLOW_COPY_AND_ASSIGN(SpillBuffer);
+};
+
+}  // namespace zucchini
+
+#endif  // CHROME_INSTALLER_ZUCCHINI_SPILL_BUFFER_H_
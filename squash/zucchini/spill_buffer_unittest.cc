@@ -0,0 +1,111 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "squash/zucchini/spill_buffer.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <iterator>
+#include <vector>
+
+#include "squash/zucchini/buffer_sink.h"
+#include "gtest/gtest.h"
+
+namespace zucchini {
+
+namespace {
+
+constexpr size_t kChunkSize = SpillBuffer::kChunkSize;
+
+// Returns |size| bytes that depend on |seed|.
+std::vector<uint8_t> MakeTestData(size_t size, uint8_t seed) {
+  std::vector<uint8_t> data(size);
+  for (size_t i = 0; i < size; ++i)
+    data[i] = static_cast<uint8_t>(seed + i * 7 + (i >> 9));
+  return data;
+}
+
+// Appends |data| to |buffer|, alternating between Append() and push_back().
+void AppendTestData(const std::vector<uint8_t>& data, SpillBuffer* buffer) {
+  size_t i = 0;
+  for (size_t step = 1; i + step <= data.size(); step = step * 3 + 1) {
+    buffer->Append({data.data() + i, step});
+    i += step;
+    if (i < data.size())
+      buffer->push_back(data[i++]);
+  }
+  std::copy(data.begin() + i, data.end(), std::back_inserter(*buffer));
+}
+
+// Returns the data of |buffer|, or an empty vector if it can't be read.
+std::vector<uint8_t> ReadAll(const SpillBuffer& buffer) {
+  // BufferSink requires a non-null buffer.
+  std::vector<uint8_t> data(buffer.size() + 1);
+  BufferSink sink(data.data(), buffer.size());
+  if (!buffer.WriteInto(&sink))
+    return {};
+  EXPECT_EQ(0U, sink.Remaining());
+  data.pop_back();
+  return data;
+}
+
+}  // namespace
+
+TEST(SpillBufferTest, InMemory) {
+  SpillBuffer empty;
+  EXPECT_EQ(0U, empty.size());
+  EXPECT_TRUE(ReadAll(empty).empty());
+
+  EXPECT_EQ(std::vector<uint8_t>({1, 2, 3}),
+            ReadAll(SpillBuffer(std::vector<uint8_t>({1, 2, 3}))));
+
+  const std::vector<uint8_t> data = MakeTestData(3 * kChunkSize + 5, 0);
+  SpillBuffer buffer;
+  AppendTestData(data, &buffer);
+  EXPECT_EQ(data.size(), buffer.size());
+  EXPECT_EQ(data, ReadAll(buffer));
+}
+
+TEST(SpillBufferTest, Spilled) {
+  SpillFile spill_file;
+  // Buffers sharing |spill_file| are filled in turns.
+  const std::vector<uint8_t> data1 = MakeTestData(5 * kChunkSize + 17, 1);
+  const std::vector<uint8_t> data2 = MakeTestData(2 * kChunkSize, 2);
+  const std::vector<uint8_t> data3 = MakeTestData(kChunkSize - 1, 3);
+  SpillBuffer buffer1(&spill_file);
+  SpillBuffer buffer2(&spill_file);
+  SpillBuffer buffer3(&spill_file);
+  for (size_t i = 0; i < 2; ++i) {
+    AppendTestData({data1.begin() + i * data1.size() / 2,
+                    data1.begin() + (i + 1) * data1.size() / 2},
+                   &buffer1);
+    AppendTestData({data2.begin() + i * data2.size() / 2,
+                    data2.begin() + (i + 1) * data2.size() / 2},
+                   &buffer2);
+  }
+  AppendTestData(data3, &buffer3);
+
+  EXPECT_EQ(data1.size(), buffer1.size());
+  EXPECT_EQ(data1, ReadAll(buffer1));
+  EXPECT_EQ(data2.size(), buffer2.size());
+  EXPECT_EQ(data2, ReadAll(buffer2));
+  EXPECT_EQ(data3.size(), buffer3.size());
+  EXPECT_EQ(data3, ReadAll(buffer3));
+
+  // Data is unaffected by moves.
+  SpillBuffer moved(std::move(buffer1));
+  EXPECT_EQ(data1, ReadAll(moved));
+}
+
+TEST(SpillBufferTest, WriteIntoTooSmall) {
+  SpillFile spill_file;
+  SpillBuffer buffer(&spill_file);
+  AppendTestData(MakeTestData(kChunkSize + 1, 0), &buffer);
+  std::vector<uint8_t> data(kChunkSize);
+  BufferSink sink(data.data(), data.size());
+  EXPECT_FALSE(buffer.WriteInto(&sink));
+}
+
+}  // namespace zucchini
@@ -6,12 +6,17 @@
 #define CHROME_INSTALLER_ZUCCHINI_SUFFIX_ARRAY_H_
 
 #include <algorithm>
+#include <functional>
 #include <iterator>
+#include <limits>
 #include <numeric>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "squash/base/logging.h"
 #include "squash/base/macros.h"
+#include "squash/zucchini/thread_pool.h"
 
 namespace zucchini {
 
@@ -430,21 +435,625 @@ class InducedSuffixSort {
   };
 };
 
+// A functor class that implements SA-IS like InducedSuffixSort, but spreads
+// the work among multiple threads. Steps that have no ordering constraint
+// (SL-type partition, bucket count, comparison of LMS substrings) are split in
+// chunks processed concurrently. The scans of induced sorting are inherently
+// sequential, but most of their cost lies in fetching characters of |str|
+// (e.g., EncodedView::Projection()). Therefore, |suffix_array| is scanned in
+// blocks: characters needed by a block are first fetched in parallel, then
+// suffixes are placed sequentially. Since the suffix array of a string is
+// unique, results are identical to InducedSuffixSort.
+class ParallelInducedSuffixSort {
+ public:
+  using SLType = InducedSuffixSort::SLType;
+
+  // |num_threads| is the number of threads used, with 0 meaning one thread per
+  // hardware thread. |block_size| is the number of suffixes handled by each
+  // parallel step of induced sorting. Strings no longer than |block_size| are
+  // sorted by InducedSuffixSort.
+  explicit ParallelInducedSuffixSort(size_t num_threads = 0,
+                                     size_t block_size = 1 << 16)
+      : num_threads_(num_threads), block_size_(block_size) {
+    DCHECK_GT(block_size_, 0U);
+  }
+
+  // Type requirements:
+  // |InputRng| is an input random access range, whose elements can be read
+  // concurrently.
+  // |KeyType| is an unsigned integer type.
+  // |SAIt| is a random access iterator with mutable values.
+  template <class InputRng, class KeyType, class SAIt>
+  // |str| is the input string on which suffix sort is applied.
+  // Characters found in |str| must be in the range [0, |key_bound|)
+  // |suffix_array| is the beginning of the destination range, which is at least
+  // as large as |str|.
+  void operator()(const InputRng& str,
+                  KeyType key_bound,
+                  SAIt suffix_array) const {
+    using value_type = typename InputRng::value_type;
+    using size_type = typename SAIt::value_type;
+
+    static_assert(std::is_unsigned<value_type>::value,
+                  "SA-IS only supports input string with unsigned values");
+    static_assert(std::is_unsigned<KeyType>::value, "KeyType must be unsigned");
+
+    size_type n = static_cast<size_type>(std::end(str) - std::begin(str));
+    size_type block_size = static_cast<size_type>(
+        std::min<size_t>(block_size_, std::numeric_limits<size_type>::max()));
+
+    if (num_threads_ == 1 || n <= block_size) {
+      InducedSuffixSort::Implementation<size_type, KeyType>::SuffixSort(
+          std::begin(str), n, key_bound, suffix_array);
+      return;
+    }
+    ThreadPool pool(num_threads_);
+    Implementation<size_type, KeyType>::SuffixSort(
+        std::begin(str), n, key_bound, block_size, &pool, suffix_array);
+  }
+
+  // Parallel counterpart of InducedSuffixSort::Implementation. Definitions
+  // from InducedSuffixSort apply.
+  template <class SizeType, class KeyType>
+  struct Implementation {
+    static_assert(std::is_unsigned<SizeType>::value,
+                  "SizeType must be unsigned");
+    static_assert(std::is_unsigned<KeyType>::value, "KeyType must be unsigned");
+    using size_type = SizeType;
+    using key_type = KeyType;
+    using Serial = InducedSuffixSort::Implementation<size_type, key_type>;
+
+    using iterator = typename std::vector<size_type>::iterator;
+
+    // Returns the size of chunks used to split a range of length |length| among
+    // threads of |pool|. A few chunks per thread are used for load balancing.
+    static size_type ChunkSize(size_type length, const ThreadPool& pool) {
+      size_type num_chunks = static_cast<size_type>(pool.num_threads() * 4);
+      return std::max<size_type>(1, (length + num_chunks - 1) / num_chunks);
+    }
+
+    // Splits [0, |length|) into contiguous chunks of at most |chunk_size|
+    // elements and concurrently calls |fn(chunk_index, lo, hi)| for each chunk
+    // [lo, hi) using |pool|.
+    template <class Fn>
+    static void ForEachChunk(size_type length,
+                             size_type chunk_size,
+                             ThreadPool* pool,
+                             Fn fn) {
+      size_type num_chunks = (length + chunk_size - 1) / chunk_size;
+      pool->ParallelFor(num_chunks, [&](size_t chunk_index) {
+        size_type lo = static_cast<size_type>(chunk_index) * chunk_size;
+        size_type hi = std::min<size_type>(length, lo + chunk_size);
+        fn(static_cast<size_type>(chunk_index), lo, hi);
+      });
+    }
+
+    // Returns true iff suf(S,|index|) is an LMS suffix.
+    static bool IsLms(const std::vector<SLType>& sl_partition,
+                      size_type index) {
+      return index > 0 && sl_partition[index] == SLType::SType &&
+             sl_partition[index - 1] == SLType::LType;
+    }
+
+    // Partition every suffix based on SL-type and writes the result to
+    // |sl_partition|. Returns the number of LMS suffixes. Each chunk is
+    // scanned backward independently, starting from the first character of the
+    // next chunk. The SL-type of a run of equal characters reaching the end of
+    // a chunk is only known once the next chunk is done, so it is fixed after.
+    template <class StrIt>
+    static size_type BuildSLPartition(StrIt str,
+                                      size_type length,
+                                      key_type key_bound,
+                                      size_type chunk_size,
+                                      ThreadPool* pool,
+                                      std::vector<SLType>* sl_partition) {
+      DCHECK_EQ(length, sl_partition->size());
+      size_type num_chunks = (length + chunk_size - 1) / chunk_size;
+      // Length of the unresolved run at the end of each chunk.
+      std::vector<size_type> unresolved_runs(num_chunks);
+      ForEachChunk(length, chunk_size, pool,
+                   [&](size_type chunk_index, size_type lo, size_type hi) {
+        SLType previous_type = SLType::LType;
+        key_type previous_key =
+            hi < length ? static_cast<key_type>(str[hi]) : key_bound;
+        bool resolved = false;
+        size_type unresolved_run = 0;
+        for (size_type i = hi; i-- > lo;) {
+          key_type current_key = str[i];
+          if (current_key > previous_key || previous_key == key_bound) {
+            previous_type = SLType::LType;
+            resolved = true;
+          } else if (current_key < previous_key) {
+            previous_type = SLType::SType;
+            resolved = true;
+          } else if (!resolved) {
+            ++unresolved_run;
+          }
+          (*sl_partition)[i] = previous_type;
+          previous_key = current_key;
+        }
+        unresolved_runs[chunk_index] = unresolved_run;
+      });
+
+      // Unresolved runs take the SL-type of the first character of the next
+      // chunk, which is final when chunks are visited backward.
+      for (size_type chunk_index = num_chunks; chunk_index-- > 0;) {
+        size_type hi =
+            std::min<size_type>(length, (chunk_index + 1) * chunk_size);
+        DCHECK(unresolved_runs[chunk_index] == 0 || hi < length);
+        std::fill(sl_partition->begin() + (hi - unresolved_runs[chunk_index]),
+                  sl_partition->begin() + hi, (*sl_partition)[hi]);
+      }
+
+      std::vector<size_type> lms_counts(num_chunks);
+      ForEachChunk(length, chunk_size, pool,
+                   [&](size_type chunk_index, size_type lo, size_type hi) {
+        for (size_type i = lo; i < hi; ++i)
+          lms_counts[chunk_index] += IsLms(*sl_partition, i);
+      });
+      return std::accumulate(lms_counts.begin(), lms_counts.end(),
+                             size_type(0));
+    }
+
+    // Find indices of LMS suffixes and write result to |lms_indices|, which
+    // must be of the right size.
+    static void FindLmsSuffixes(const std::vector<SLType>& sl_partition,
+                                size_type chunk_size,
+                                ThreadPool* pool,
+                                std::vector<size_type>* lms_indices) {
+      size_type length = static_cast<size_type>(sl_partition.size());
+      size_type num_chunks = (length + chunk_size - 1) / chunk_size;
+      std::vector<size_type> chunk_offsets(num_chunks + 1);
+      ForEachChunk(length, chunk_size, pool,
+                   [&](size_type chunk_index, size_type lo, size_type hi) {
+        for (size_type i = lo; i < hi; ++i)
+          chunk_offsets[chunk_index + 1] += IsLms(sl_partition, i);
+      });
+      std::partial_sum(chunk_offsets.begin(), chunk_offsets.end(),
+                       chunk_offsets.begin());
+      DCHECK_EQ(chunk_offsets.back(), lms_indices->size());
+      ForEachChunk(length, chunk_size, pool,
+                   [&](size_type chunk_index, size_type lo, size_type hi) {
+        auto lms_it = lms_indices->begin() + chunk_offsets[chunk_index];
+        for (size_type i = lo; i < hi; ++i) {
+          if (IsLms(sl_partition, i))
+            *lms_it++ = i;
+        }
+      });
+    }
+
+    template <class StrIt>
+    static std::vector<size_type> MakeBucketCount(StrIt str,
+                                                  size_type length,
+                                                  key_type key_bound,
+                                                  ThreadPool* pool) {
+      // Each chunk gets its own private histogram, which is only worthwhile
+      // if histograms are small compared to chunks.
+      size_type num_threads = static_cast<size_type>(pool->num_threads());
+      size_type chunk_size = (length + num_threads - 1) / num_threads;
+      size_type num_chunks = (length + chunk_size - 1) / chunk_size;
+      if (num_chunks <= 1 || static_cast<size_t>(key_bound) > chunk_size)
+        return Serial::MakeBucketCount(str, length, key_bound);
+
+      std::vector<std::vector<size_type>> chunk_buckets(num_chunks);
+      ForEachChunk(length, chunk_size, pool,
+                   [&](size_type chunk_index, size_type lo, size_type hi) {
+        std::vector<size_type>& buckets = chunk_buckets[chunk_index];
+        buckets.assign(static_cast<size_t>(key_bound), 0);
+        for (size_type i = lo; i < hi; ++i)
+          ++buckets[str[i]];
+      });
+      std::vector<size_type> buckets = std::move(chunk_buckets[0]);
+      for (size_type c = 1; c < num_chunks; ++c) {
+        std::transform(buckets.begin(), buckets.end(),
+                       chunk_buckets[c].begin(), buckets.begin(),
+                       std::plus<size_type>());
+      }
+      return buckets;
+    }
+
+    // Concurrently visits |suffix_array| in [|lo|, |hi|) and for each
+    // suffix_index = |suffix_array[i]| for which suf(S, suffix_index - 1) has
+    // SL-type |type|, writes |str[suffix_index - 1]| to |keys[i - lo]|.
+    // |suffix_array[i]| is also saved to |snapshot[i - lo]|, so that entries
+    // modified afterward can be detected.
+    template <class StrIt, class SAIt>
+    static void FetchInducedKeys(StrIt str,
+                                 size_type length,
+                                 const std::vector<SLType>& sl_partition,
+                                 SLType type,
+                                 SAIt suffix_array,
+                                 size_type lo,
+                                 size_type hi,
+                                 ThreadPool* pool,
+                                 std::vector<size_type>* snapshot,
+                                 std::vector<key_type>* keys) {
+      ForEachChunk(hi - lo, ChunkSize(hi - lo, *pool), pool,
+                   [&](size_type, size_type chunk_lo, size_type chunk_hi) {
+        for (size_type i = chunk_lo; i < chunk_hi; ++i) {
+          size_type suffix_index = suffix_array[lo + i];
+          (*snapshot)[i] = suffix_index;
+          if (suffix_index != length && suffix_index > 0 &&
+              sl_partition[suffix_index - 1] == type) {
+            (*keys)[i] = str[suffix_index - 1];
+          }
+        }
+      });
+    }
+
+    // Apply induced sort from |lms_indices| to |suffix_array| associated with
+    // the string |str|. See InducedSuffixSort::Implementation::InducedSort()
+    // for details on each step.
+    template <class StrIt, class SAIt>
+    static void InducedSort(StrIt str,
+                            size_type length,
+                            const std::vector<SLType>& sl_partition,
+                            const std::vector<size_type>& lms_indices,
+                            const std::vector<size_type>& buckets,
+                            size_type block_size,
+                            ThreadPool* pool,
+                            SAIt suffix_array) {
+      std::fill(suffix_array, suffix_array + length, length);
+
+      DCHECK(!buckets.empty());
+      std::vector<size_type> bucket_bounds(buckets.size());
+
+      // Buffers holding fetched keys for the current block.
+      block_size = std::min(block_size, length);
+      std::vector<size_type> snapshot(block_size);
+      std::vector<key_type> keys(block_size);
+
+      // Step 1: Assign indices for LMS suffixes, populating the end of
+      // respective buckets but keeping relative order.
+      std::partial_sum(buckets.begin(), buckets.end(), bucket_bounds.begin());
+      for (size_type hi = static_cast<size_type>(lms_indices.size()); hi > 0;) {
+        size_type lo = hi > block_size ? hi - block_size : 0;
+        ForEachChunk(hi - lo, ChunkSize(hi - lo, *pool), pool,
+                     [&](size_type, size_type chunk_lo, size_type chunk_hi) {
+          for (size_type i = chunk_lo; i < chunk_hi; ++i)
+            keys[i] = str[lms_indices[lo + i]];
+        });
+        for (size_type i = hi; i-- > lo;)
+          suffix_array[--bucket_bounds[keys[i - lo]]] = lms_indices[i];
+        hi = lo;
+      }
+
+      // Step 2: Scan forward |suffix_array| to induce L-type suffixes. New
+      // suffixes are always placed ahead of the current position, possibly in
+      // the current block. These were not seen when keys were fetched, and
+      // their key is fetched on the spot.
+      bucket_bounds[0] = 0;
+      std::partial_sum(buckets.begin(), buckets.end() - 1,
+                       bucket_bounds.begin() + 1);
+      if (sl_partition[length - 1] == SLType::LType) {
+        key_type key = str[length - 1];
+        suffix_array[bucket_bounds[key]++] = length - 1;
+      }
+      for (size_type lo = 0; lo < length; lo += block_size) {
+        size_type hi = std::min<size_type>(length, lo + block_size);
+        FetchInducedKeys(str, length, sl_partition, SLType::LType,
+                         suffix_array, lo, hi, pool, &snapshot, &keys);
+        for (size_type i = lo; i < hi; ++i) {
+          size_type suffix_index = suffix_array[i];
+          if (suffix_index != length && suffix_index > 0 &&
+              sl_partition[suffix_index - 1] == SLType::LType) {
+            key_type key = suffix_index == snapshot[i - lo]
+                               ? keys[i - lo]
+                               : static_cast<key_type>(str[suffix_index - 1]);
+            suffix_array[bucket_bounds[key]++] = suffix_index - 1;
+          }
+        }
+      }
+
+      // Step 3: Scan backward |suffix_array| to induce S-type suffixes. New
+      // suffixes are always placed behind the current position, possibly
+      // overwriting entries in the current block, which are then detected.
+      std::partial_sum(buckets.begin(), buckets.end(), bucket_bounds.begin());
+      for (size_type hi = length; hi > 0;) {
+        size_type lo = hi > block_size ? hi - block_size : 0;
+        FetchInducedKeys(str, length, sl_partition, SLType::SType,
+                         suffix_array, lo, hi, pool, &snapshot, &keys);
+        for (size_type i = hi; i-- > lo;) {
+          size_type suffix_index = suffix_array[i];
+          if (suffix_index != length && suffix_index > 0 &&
+              sl_partition[suffix_index - 1] == SLType::SType) {
+            key_type key = suffix_index == snapshot[i - lo]
+                               ? keys[i - lo]
+                               : static_cast<key_type>(str[suffix_index - 1]);
+            suffix_array[--bucket_bounds[key]] = suffix_index - 1;
+          }
+        }
+        hi = lo;
+      }
+      // Deals with the last suffix, because of the sentinel.
+      if (sl_partition[length - 1] == SLType::SType) {
+        key_type key = str[length - 1];
+        suffix_array[--bucket_bounds[key]] = length - 1;
+      }
+    }
+
+    // Returns true iff LMS substrings starting at |lms1| and |lms2| are equal.
+    template <class StrIt>
+    static bool LmsSubstringsEqual(StrIt str,
+                                   size_type length,
+                                   const std::vector<SLType>& sl_partition,
+                                   size_type lms1,
+                                   size_type lms2) {
+      SLType lms1_type = SLType::SType;
+      SLType lms2_type = SLType::SType;
+      for (size_type k = 0;; ++k) {
+        bool lms1_end =
+            lms1 + k >= length ||
+            (lms1_type == SLType::LType &&
+             sl_partition[lms1 + k] == SLType::SType);
+        bool lms2_end =
+            lms2 + k >= length ||
+            (lms2_type == SLType::LType &&
+             sl_partition[lms2 + k] == SLType::SType);
+        if (lms1_end && lms2_end)
+          return true;
+        if (lms1_end != lms2_end || str[lms1 + k] != str[lms2 + k])
+          return false;
+        lms1_type = sl_partition[lms1 + k];
+        lms2_type = sl_partition[lms2 + k];
+      }
+    }
+
+    // Same as InducedSuffixSort::Implementation::LabelLmsSubstrings(). LMS
+    // suffixes are first gathered in lexicographical order, then each one is
+    // compared with its predecessor concurrently, and labels are finally
+    // obtained with a prefix sum.
+    template <class StrIt, class SAIt>
+    static size_type LabelLmsSubstrings(StrIt str,
+                                        size_type length,
+                                        const std::vector<SLType>& sl_partition,
+                                        SAIt suffix_array,
+                                        ThreadPool* pool,
+                                        iterator lms_indices,
+                                        iterator lms_str) {
+      size_type lms_count = 0;
+      for (auto it = suffix_array; it != suffix_array + length; ++it) {
+        if (IsLms(sl_partition, *it))
+          lms_indices[lms_count++] = *it;
+      }
+      if (lms_count == 0)
+        return 1;
+
+      // |lms_str[k]| is set to 1 if the k-th LMS substring differs from the
+      // previous one, and to 0 otherwise.
+      lms_str[0] = 0;
+      ForEachChunk(lms_count, ChunkSize(lms_count, *pool), pool,
+                   [&](size_type, size_type lo, size_type hi) {
+        for (size_type k = std::max<size_type>(lo, 1); k < hi; ++k) {
+          lms_str[k] = LmsSubstringsEqual(str, length, sl_partition,
+                                          lms_indices[k - 1], lms_indices[k])
+                           ? 0
+                           : 1;
+        }
+      });
+      std::partial_sum(lms_str, lms_str + lms_count, lms_str);
+      return lms_str[lms_count - 1] + 1;
+    }
+
+    // Implementation of the SA-IS algorithm, using |pool| to run parallel steps
+    // on blocks of |block_size| suffixes. See
+    // InducedSuffixSort::Implementation::SuffixSort() for details.
+    template <class StrIt, class SAIt>
+    static void SuffixSort(StrIt str,
+                           size_type length,
+                           key_type key_bound,
+                           size_type block_size,
+                           ThreadPool* pool,
+                           SAIt suffix_array) {
+      if (length <= block_size || pool->num_threads() <= 1) {
+        Serial::SuffixSort(str, length, key_bound, suffix_array);
+        return;
+      }
+
+      size_type chunk_size = ChunkSize(length, *pool);
+      std::vector<SLType> sl_partition(length);
+      size_type lms_count = BuildSLPartition(str, length, key_bound,
+                                             chunk_size, pool, &sl_partition);
+      std::vector<size_type> lms_indices(lms_count);
+      FindLmsSuffixes(sl_partition, chunk_size, pool, &lms_indices);
+      std::vector<size_type> buckets =
+          MakeBucketCount(str, length, key_bound, pool);
+
+      if (lms_indices.size() > 1) {
+        InducedSort(str, length, sl_partition, lms_indices, buckets,
+                    block_size, pool, suffix_array);
+        std::vector<size_type> lms_str(lms_indices.size());
+
+        size_type label_count = LabelLmsSubstrings(
+            str, length, sl_partition, suffix_array, pool, lms_indices.begin(),
+            lms_str.begin());
+
+        if (label_count < lms_str.size()) {
+          // Reorder |lms_str| to have LMS suffixes in the same order they
+          // appear in |str|, using |suffix_array| as a temporary buffer.
+          for (size_type i = 0; i < lms_indices.size(); ++i)
+            suffix_array[lms_indices[i]] = lms_str[i];
+          FindLmsSuffixes(sl_partition, chunk_size, pool, &lms_indices);
+          for (size_type i = 0; i < lms_indices.size(); ++i)
+            lms_str[i] = suffix_array[lms_indices[i]];
+
+          // Recursively apply SuffixSort on |lms_str|.
+          ParallelInducedSuffixSort::Implementation<size_type, size_type>::
+              SuffixSort(lms_str.begin(),
+                         static_cast<size_type>(lms_str.size()), label_count,
+                         block_size, pool, suffix_array);
+
+          // Map LMS labels back to indices in |str|.
+          for (size_type i = 0; i < lms_indices.size(); ++i)
+            suffix_array[i] = lms_indices[suffix_array[i]];
+          std::copy_n(suffix_array, lms_indices.size(), lms_indices.begin());
+        }
+      }
+      InducedSort(str, length, sl_partition, lms_indices, buckets, block_size,
+                  pool, suffix_array);
+    }
+
+   private:
+    DISALLOW_IMPLICIT_CONSTRUCTORS(Implementation);
+  };
+
+ private:
+  size_t num_threads_;
+  size_t block_size_;
+};
+
 // Generates a sorted suffix array for the input string |str| using the functor
-// |Algorithm| which provides an interface equivalent to NaiveSuffixSort.
+// |sort| of type |Algorithm| which provides an interface equivalent to
+// NaiveSuffixSort.
 /// Characters found in |str| are assumed to be in range [0, |key_bound|).
 // Returns the suffix array as a vector.
 // |StrRng| is an input random access range.
 // |KeyType| is an unsigned integer type.
 template <class Algorithm, class StrRng, class KeyType>
-std::vector<typename StrRng::size_type> MakeSuffixArray(const StrRng& str,
-                                                        KeyType key_bound) {
-  Algorithm sort;
+std::vector<typename StrRng::size_type> MakeSuffixArray(
+    const StrRng& str,
+    KeyType key_bound,
+    const Algorithm& sort = Algorithm()) {
   std::vector<typename StrRng::size_type> suffix_array(str.end() - str.begin());
   sort(str, key_bound, suffix_array.begin());
   return suffix_array;
 }
 
+// Type requirements:
+// |StrRng| is an input random access range.
+// |KeyType| is an unsigned integer type.
+// |SizeType| is an unsigned integer type.
+template <class StrRng, class KeyType, class SizeType>
+// Turns |suffix_array|, the suffix array of a string that only differs from
+// |str| at locations with characters in [|min_relabel_key|, |key_bound|), into
+// the suffix array of |str|. Locations with such "relabeled" characters must
+// be the same in both strings, and characters elsewhere must be equal.
+//
+// Each suffix is made of an unchanged prefix, up to its first relabeled
+// location. Suffixes with different unchanged prefixes keep their order, so
+// only groups of suffixes sharing the same unchanged prefix are reordered,
+// following the order of suffixes at their first relabeled location. These are
+// sorted with InducedSuffixSort on a reduced string that has one character per
+// relabeled location. Besides a pass over |suffix_array|, work is proportional
+// to the number of relabeled locations and of suffixes sharing their group,
+// which makes this much faster than sorting |str| from scratch when relabeled
+// locations are sparse.
+void ResortSuffixArray(const StrRng& str,
+                       KeyType min_relabel_key,
+                       KeyType key_bound,
+                       std::vector<SizeType>* suffix_array) {
+  auto str_first = std::begin(str);
+  SizeType n = static_cast<SizeType>(std::end(str) - str_first);
+  DCHECK_EQ(n, suffix_array->size());
+  std::vector<SizeType>& sa = *suffix_array;
+  auto is_relabeled = [&](SizeType pos) {
+    DCHECK_LT(KeyType(str_first[pos]), key_bound);
+    return KeyType(str_first[pos]) >= min_relabel_key;
+  };
+
+  // Relabeled locations, in increasing order.
+  std::vector<SizeType> relabeled;
+  for (SizeType pos = 0; pos < n; ++pos) {
+    if (is_relabeled(pos))
+      relabeled.push_back(pos);
+  }
+  SizeType m = static_cast<SizeType>(relabeled.size());
+  if (m == 0)
+    return;
+
+  // |rank[pos]| is the rank of the suffix at |pos|, which is replaced by the
+  // first rank of its group if the group has more than one suffix. Relabeled
+  // characters are larger than others, so suffixes at relabeled locations
+  // have the largest ranks, and form a single group.
+  std::vector<SizeType> rank(n);
+  for (SizeType r = 0; r < n; ++r)
+    rank[sa[r]] = r;
+  for (SizeType pos : relabeled)
+    rank[pos] = n - m;
+  // Returns the group of the suffix following |pos|, where the empty suffix
+  // is represented by |n|.
+  auto group_after = [&](SizeType pos) {
+    return pos + 1 < n ? rank[pos + 1] : n;
+  };
+  // Returns whether suffixes at unchanged locations |pos1| and |pos2| share
+  // the same group, given the groups of the following suffixes.
+  auto same_group = [&](SizeType pos1, SizeType pos2) {
+    return str_first[pos1] == str_first[pos2] &&
+           group_after(pos1) == group_after(pos2);
+  };
+
+  // Groups of suffixes with unchanged prefixes of size |prefix_size| are
+  // found from groups with unchanged prefixes of size |prefix_size - 1|,
+  // walking backward from each relabeled location. A suffix that is alone in
+  // its group has a unique unchanged prefix, which ends the walk.
+  // |depth[k]| is the number of suffixes before |relabeled[k]| that are not
+  // alone in their group, and |cursor[r]| is the next rank to fill in the
+  // group starting at |r|.
+  std::vector<SizeType> depth(m, 0);
+  std::vector<SizeType> cursor(n);
+  // Pairs of (index in |relabeled|, rank of the suffix being visited).
+  std::vector<std::pair<SizeType, SizeType>> visits;
+  std::vector<std::pair<SizeType, SizeType>> next_visits;
+  for (SizeType k = 0; k < m; ++k) {
+    if (relabeled[k] > 0 && !is_relabeled(relabeled[k] - 1))
+      visits.emplace_back(k, rank[relabeled[k] - 1]);
+  }
+  for (SizeType prefix_size = 1; !visits.empty(); ++prefix_size) {
+    next_visits.clear();
+    for (const auto& visit : visits) {
+      SizeType r = visit.second;
+      bool same_as_prev = r > 0 && same_group(sa[r], sa[r - 1]);
+      bool same_as_next = r + 1 < n && same_group(sa[r + 1], sa[r]);
+      if (!same_as_prev && !same_as_next)
+        continue;
+      depth[visit.first] = prefix_size;
+      SizeType pos = sa[r];
+      if (pos > 0 && !is_relabeled(pos - 1))
+        next_visits.emplace_back(visit.first, rank[pos - 1]);
+      if (same_as_prev)
+        continue;
+      // |r| is the first rank of its group.
+      cursor[r] = r;
+      rank[pos] = r;
+      for (SizeType q = r + 1; q < n && same_group(sa[q], sa[q - 1]); ++q)
+        rank[sa[q]] = r;
+    }
+    visits.swap(next_visits);
+  }
+
+  // Relabeled locations are named after their character and the group of the
+  // following suffix.
+  auto name_key = [&](SizeType k) {
+    SizeType pos = relabeled[k];
+    return std::make_pair(KeyType(str_first[pos]),
+                          pos + 1 < n ? group_after(pos) + 1 : 0);
+  };
+  std::vector<SizeType> by_name(m);
+  std::iota(by_name.begin(), by_name.end(), 0);
+  std::sort(by_name.begin(), by_name.end(), [&](SizeType k1, SizeType k2) {
+    return name_key(k1) < name_key(k2);
+  });
+  std::vector<SizeType> reduced(m);
+  SizeType name = 0;
+  for (SizeType i = 0; i < m; ++i) {
+    if (i > 0 && name_key(by_name[i - 1]) != name_key(by_name[i]))
+      ++name;
+    reduced[by_name[i]] = name;
+  }
+  std::vector<SizeType> reduced_sa(m);
+  InducedSuffixSort()(reduced, name + 1, reduced_sa.begin());
+
+  // Suffixes at relabeled locations take the largest ranks. Other suffixes
+  // that are not alone in their group are appended to it, in order of their
+  // first relabeled location.
+  for (SizeType i = 0; i < m; ++i) {
+    SizeType k = reduced_sa[i];
+    sa[n - m + i] = relabeled[k];
+    for (SizeType pos = relabeled[k] - depth[k]; pos < relabeled[k]; ++pos)
+      sa[cursor[rank[pos]]++] = pos;
+  }
+}
+
 // Type requirements:
 // |SARng| is an input random access range.
 // |StrIt1| is a random access iterator.
@@ -470,6 +1079,131 @@ auto SuffixLowerBound(const SARng& suffix_array,
   return it;
 }
 
+// Type requirements:
+// |StrRng| is an input random access range.
+// |SARng| is an input random access range.
+template <class StrRng, class SARng>
+// Computes the longest common prefix (LCP) array of |str| in linear time using
+// Kasai's algorithm, given its suffix array |suffix_array|. Returns |lcp| where
+// |lcp[0] == 0| and |lcp[i]| is the length of the longest common prefix of the
+// suffixes at |suffix_array[i - 1]| and |suffix_array[i]| for i > 0.
+std::vector<typename std::remove_cv<typename SARng::value_type>::type>
+MakeLcpArray(const StrRng& str, const SARng& suffix_array) {
+  using size_type =
+      typename std::remove_cv<typename SARng::value_type>::type;
+
+  size_t n = std::end(str) - std::begin(str);
+  DCHECK_EQ(n, size_t(std::end(suffix_array) - std::begin(suffix_array)));
+  auto str_first = std::begin(str);
+  auto sa_first = std::begin(suffix_array);
+
+  // Rank of each suffix of |str| in |suffix_array|.
+  std::vector<size_type> rank(n);
+  for (size_t i = 0; i < n; ++i)
+    rank[sa_first[i]] = static_cast<size_type>(i);
+
+  std::vector<size_type> lcp(n);
+  // The LCP of a suffix with its predecessor in |suffix_array| is at least the
+  // LCP of the previous suffix in |str| with its own predecessor, minus 1.
+  size_t h = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (rank[i] == 0) {
+      h = 0;
+      continue;
+    }
+    size_t j = sa_first[rank[i] - 1];
+    while (i + h < n && j + h < n && str_first[i + h] == str_first[j + h])
+      ++h;
+    lcp[rank[i]] = static_cast<size_type>(h);
+    if (h > 0)
+      --h;
+  }
+  return lcp;
+}
+
+// Type requirements:
+// |StrIt1| is a random access iterator.
+// |StrIt2| is a random access iterator.
+// |SizeType| is an unsigned integer type.
+template <class StrIt1, class StrIt2, class SizeType>
+// Searches suffixes of a string str2 = [|str2_first|, |str2_last|) in the
+// suffix array of a string str1 starting at |str1_first|. Each search returns
+// the same rank as SuffixLowerBound(), but keeps track of the longest common
+// prefix (LCP) of the query with both bounds of the binary search, so that
+// comparisons skip the prefix shared by all suffixes in between. This avoids
+// comparing the same characters again at each step, which dominates the search
+// time in repetitive content such as zero padding.
+class SuffixSearch {
+ public:
+  // |suffix_array| points to the suffix array of str1 = [|str1_first|,
+  // |str1_last|), and is required to remain valid for the lifetime of the
+  // object.
+  SuffixSearch(const SizeType* suffix_array,
+               StrIt1 str1_first,
+               StrIt1 str1_last,
+               StrIt2 str2_first,
+               StrIt2 str2_last)
+      : suffix_array_(suffix_array),
+        str1_first_(str1_first),
+        str1_size_(static_cast<SizeType>(str1_last - str1_first)),
+        str2_first_(str2_first),
+        str2_size_(static_cast<SizeType>(str2_last - str2_first)) {}
+
+  // Returns the rank in the suffix array of the lexicographical lower bound of
+  // the suffix of str2 at |offset|.
+  SizeType LowerBound(SizeType offset) {
+    DCHECK_LE(offset, str2_size_);
+    StrIt2 query = str2_first_ + offset;
+    SizeType query_size = str2_size_ - offset;
+
+    // Invariant: ranks in [0, |lo|) are smaller than the query, and ranks in
+    // [|hi|, str1 size) are not. |lo_lcp_| and |hi_lcp_| are the LCP of the
+    // query with ranks |lo - 1| and |hi|, or 0 if they don't exist.
+    SizeType lo = 0;
+    SizeType hi = str1_size_;
+    lo_lcp_ = 0;
+    hi_lcp_ = 0;
+    while (lo < hi) {
+      SizeType mid = lo + (hi - lo) / 2;
+      SizeType suffix = suffix_array_[mid];
+      SizeType common_size = std::min(str1_size_ - suffix, query_size);
+      SizeType lcp = std::min(lo_lcp_, hi_lcp_);
+      while (lcp < common_size && str1_first_[suffix + lcp] == query[lcp])
+        ++lcp;
+      // The suffix is smaller if it's a proper prefix of the query, or if its
+      // first mismatching character is smaller.
+      bool is_less =
+          lcp < query_size && (lcp == str1_size_ - suffix ||
+                               str1_first_[suffix + lcp] < query[lcp]);
+      if (is_less) {
+        lo = mid + 1;
+        lo_lcp_ = lcp;
+      } else {
+        hi = mid;
+        hi_lcp_ = lcp;
+      }
+    }
+    return lo;
+  }
+
+  // Returns the length of the longest common prefix of the last query with
+  // the suffix ranked right before the returned rank, or 0 if it's the first.
+  SizeType lower_lcp() const { return lo_lcp_; }
+  // Returns the length of the longest common prefix of the last query with
+  // the suffix at the returned rank, or 0 if it's past the end.
+  SizeType upper_lcp() const { return hi_lcp_; }
+
+ private:
+  const SizeType* suffix_array_;
+  StrIt1 str1_first_;
+  SizeType str1_size_;
+  StrIt2 str2_first_;
+  SizeType str2_size_;
+
+  SizeType lo_lcp_ = 0;
+  SizeType hi_lcp_ = 0;
+};
+
 }  // namespace zucchini
 
 #endif  // CHROME_INSTALLER_ZUCCHINI_SUFFIX_ARRAY_H_
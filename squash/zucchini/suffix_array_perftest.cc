@@ -0,0 +1,145 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "squash/zucchini/suffix_array.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "gtest/gtest.h"
+#include "squash/zucchini/disassembler.h"
+#include "squash/zucchini/element_detection.h"
+#include "squash/zucchini/encoded_view.h"
+#include "squash/zucchini/image_index.h"
+#include "squash/zucchini/mapped_file.h"
+
+namespace zucchini {
+
+namespace {
+
+constexpr size_t kThreadCounts[] = {1, 2, 4, 8, 16};
+
+boost::filesystem::path MakeTestPath(const std::string& filename) {
+  return boost::filesystem::path("squash") / "testdata" / filename;
+}
+
+// Sets labels of the first iteration of CreateEquivalenceMap(), where no
+// target is labeled, for each pool of |view|.
+void SetNoLabels(EncodedView* view) {
+  const ImageIndex& image_index = view->image_index();
+  for (size_t i = 0; i < image_index.PoolCount(); ++i) {
+    PoolTag pool_tag(static_cast<uint8_t>(i));
+    view->SetLabels(
+        pool_tag, std::vector<uint32_t>(image_index.pool(pool_tag).size()), 1);
+  }
+}
+
+// Sorts |view| with InducedSuffixSort, then with ParallelInducedSuffixSort
+// for every entry of |kThreadCounts|, and prints the time taken by each.
+void RunSuffixSortScaling(const std::string& name, const EncodedView& view) {
+  using Clock = std::chrono::steady_clock;
+
+  auto start = Clock::now();
+  std::vector<offset_t> expected =
+      MakeSuffixArray<InducedSuffixSort>(view, view.Cardinality());
+  std::chrono::duration<double> serial_time = Clock::now() - start;
+  std::cout << name << ": size " << view.size() << ", InducedSuffixSort "
+            << serial_time.count() << " s" << std::endl;
+
+  for (size_t num_threads : kThreadCounts) {
+    start = Clock::now();
+    std::vector<offset_t> suffix_array =
+        MakeSuffixArray<ParallelInducedSuffixSort>(
+            view, view.Cardinality(), ParallelInducedSuffixSort(num_threads));
+    std::chrono::duration<double> time = Clock::now() - start;
+    std::cout << name << ": ParallelInducedSuffixSort, " << num_threads
+              << " threads " << time.count() << " s, speedup "
+              << serial_time.count() / time.count() << std::endl;
+    EXPECT_EQ(expected, suffix_array);
+  }
+}
+
+}  // namespace
+
+// Suffix sort on raw bytes, as done by GenerateRaw().
+TEST(SuffixArrayPerfTest, RawScaling) {
+  MappedFileReader file(MakeTestPath("chrome64_1.exe"));
+  ASSERT_TRUE(file.IsValid());
+
+  ImageIndex image_index(file.region());
+  EncodedView view(image_index);
+  RunSuffixSortScaling("chrome64_1.exe raw", view);
+}
+
+// Suffix sort on the encoded view of the first iteration of
+// CreateEquivalenceMap(), where references have no label.
+TEST(SuffixArrayPerfTest, EncodedScaling) {
+  MappedFileReader file(MakeTestPath("chrome64_1.exe"));
+  ASSERT_TRUE(file.IsValid());
+
+  std::unique_ptr<Disassembler> disasm =
+      MakeDisassemblerWithoutFallback(file.region());
+  ASSERT_TRUE(disasm);
+  ImageIndex image_index(file.region());
+  ASSERT_TRUE(image_index.Initialize(disasm.get()));
+
+  EncodedView view(image_index);
+  SetNoLabels(&view);
+  RunSuffixSortScaling("chrome64_1.exe encoded", view);
+}
+
+// Suffix sort on the encoded view of the second iteration of
+// CreateEquivalenceMap(), compared with ResortSuffixArray() on the suffix
+// array of the first iteration, where references had no label.
+TEST(SuffixArrayPerfTest, Resort) {
+  using Clock = std::chrono::steady_clock;
+
+  MappedFileReader file(MakeTestPath("chrome64_1.exe"));
+  ASSERT_TRUE(file.IsValid());
+
+  std::unique_ptr<Disassembler> disasm =
+      MakeDisassemblerWithoutFallback(file.region());
+  ASSERT_TRUE(disasm);
+  ImageIndex image_index(file.region());
+  ASSERT_TRUE(image_index.Initialize(disasm.get()));
+
+  EncodedView view(image_index, EncodedView::Mode::kMaterialized);
+  SetNoLabels(&view);
+  std::vector<offset_t> suffix_array = MakeSuffixArray<InducedSuffixSort>(
+      view.projections(), view.Cardinality());
+
+  // Every other target is associated, and gets its own label.
+  for (size_t pool_index = 0; pool_index < image_index.PoolCount();
+       ++pool_index) {
+    PoolTag pool_tag(static_cast<uint8_t>(pool_index));
+    std::vector<uint32_t> labels(image_index.pool(pool_tag).size(), 0);
+    uint32_t label_bound = 1;
+    for (size_t i = 0; i < labels.size(); i += 2)
+      labels[i] = label_bound++;
+    view.SetLabels(pool_tag, std::move(labels), label_bound);
+  }
+
+  auto start = Clock::now();
+  std::vector<offset_t> expected = MakeSuffixArray<InducedSuffixSort>(
+      view.projections(), view.Cardinality());
+  std::chrono::duration<double> sort_time = Clock::now() - start;
+
+  start = Clock::now();
+  ResortSuffixArray(view.projections(), kBaseReferenceProjection,
+                    view.Cardinality(), &suffix_array);
+  std::chrono::duration<double> resort_time = Clock::now() - start;
+  std::cout << "chrome64_1.exe encoded: InducedSuffixSort "
+            << sort_time.count() << " s, ResortSuffixArray "
+            << resort_time.count() << " s" << std::endl;
+  EXPECT_EQ(expected, suffix_array);
+}
+
+}  // namespace zucchini
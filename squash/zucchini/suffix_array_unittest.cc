@@ -9,6 +9,7 @@
 
 #include <algorithm>
 #include <initializer_list>
+#include <random>
 #include <string>
 #include <vector>
 
@@ -182,7 +183,7 @@ void TestSuffixSort(ustring test_str) {
   }
 }
 
-constexpr const char* test_strs[] = {
+const std::vector<std::string> test_strs = {
     "",
     "a",
     "aa",
@@ -217,6 +218,42 @@ TEST(SuffixSortTest, InducedSuffixSortSort) {
   }
 }
 
+TEST(SuffixSortTest, ParallelInducedSuffixSort) {
+  // Small blocks are used so that short strings go through the parallel path.
+  for (size_t num_threads : {1U, 2U, 3U, 8U}) {
+    ParallelInducedSuffixSort sort(num_threads, 2);
+    for (const std::string& test_str : test_strs) {
+      ustring test_ustr = MakeUnsignedString(test_str);
+      EXPECT_EQ(MakeSuffixArray<InducedSuffixSort>(test_ustr, kNumChar),
+                MakeSuffixArray<ParallelInducedSuffixSort>(test_ustr, kNumChar,
+                                                           sort));
+    }
+  }
+}
+
+// Test on long repetitive sequences, which require many levels of recursion.
+TEST(SuffixSortTest, ParallelInducedSuffixSortRepetitive) {
+  std::vector<uint8_t> str;
+  uint32_t seed = 1;
+  for (size_t i = 0; i < 20000; ++i) {
+    seed = seed * 1103515245U + 12345U;
+    // Mix runs of zeros, periodic patterns and pseudo-random bytes.
+    if (i % 4096 < 1024)
+      str.push_back(0);
+    else if (i % 4096 < 2048)
+      str.push_back(static_cast<uint8_t>("zucchini"[i % 8]));
+    else
+      str.push_back(static_cast<uint8_t>((seed >> 16) % 4));
+  }
+  std::vector<size_t> expected =
+      MakeSuffixArray<InducedSuffixSort>(str, kNumChar);
+  for (size_t block_size : {7U, 256U, 4096U}) {
+    ParallelInducedSuffixSort sort(4, block_size);
+    EXPECT_EQ(expected, MakeSuffixArray<ParallelInducedSuffixSort>(
+                            str, kNumChar, sort));
+  }
+}
+
 // Test with sequence that has every character.
 TEST(SuffixSortTest, AllChar) {
   std::vector<unsigned char> all_char(kNumChar);
@@ -328,4 +365,128 @@ TEST(SuffixArrayTest, LowerBoundExact) {
   }
 }
 
+// Returns the length of the longest common prefix of [|first1|, |last1|) and
+// [|first2|, |last2|).
+template <class It1, class It2>
+size_t NaiveLcp(It1 first1, It1 last1, It2 first2, It2 last2) {
+  size_t lcp = 0;
+  while (first1 + lcp != last1 && first2 + lcp != last2 &&
+         first1[lcp] == first2[lcp]) {
+    ++lcp;
+  }
+  return lcp;
+}
+
+TEST(SuffixArrayTest, LcpArray) {
+  for (const std::string& test_str : test_strs) {
+    ustring test_ustr = MakeUnsignedString(test_str);
+
+    std::vector<size_t> suffix_array =
+        MakeSuffixArray<InducedSuffixSort>(test_ustr, kNumChar);
+    std::vector<size_t> lcp = MakeLcpArray(test_ustr, suffix_array);
+    ASSERT_EQ(test_ustr.size(), lcp.size());
+
+    for (size_t i = 1; i < lcp.size(); ++i) {
+      EXPECT_EQ(NaiveLcp(test_ustr.begin() + suffix_array[i - 1],
+                         test_ustr.end(),
+                         test_ustr.begin() + suffix_array[i], test_ustr.end()),
+                lcp[i]);
+    }
+    if (!lcp.empty()) {
+      EXPECT_EQ(0U, lcp[0]);
+    }
+  }
+}
+
+TEST(SuffixArrayTest, SuffixSearch) {
+  for (const std::string& base_str : test_strs) {
+    ustring base_ustr = MakeUnsignedString(base_str);
+    std::vector<size_t> suffix_array =
+        MakeSuffixArray<InducedSuffixSort>(base_ustr, kNumChar);
+
+    for (const std::string& search_str : test_strs) {
+      ustring search_ustr = MakeUnsignedString(search_str);
+      SuffixSearch<ustring::const_iterator, ustring::const_iterator, size_t>
+          search(suffix_array.data(), base_ustr.begin(), base_ustr.end(),
+                 search_ustr.begin(), search_ustr.end());
+
+      for (size_t offset = 0; offset <= search_ustr.size(); ++offset) {
+        auto expected =
+            SuffixLowerBound(suffix_array, base_ustr.begin(),
+                             search_ustr.begin() + offset, search_ustr.end());
+        size_t rank = search.LowerBound(offset);
+        EXPECT_EQ(size_t(expected - suffix_array.begin()), rank);
+
+        size_t lower_lcp = 0;
+        if (rank > 0) {
+          lower_lcp = NaiveLcp(base_ustr.begin() + suffix_array[rank - 1],
+                               base_ustr.end(), search_ustr.begin() + offset,
+                               search_ustr.end());
+        }
+        EXPECT_EQ(lower_lcp, search.lower_lcp());
+        size_t upper_lcp = 0;
+        if (rank < suffix_array.size()) {
+          upper_lcp = NaiveLcp(base_ustr.begin() + suffix_array[rank],
+                               base_ustr.end(), search_ustr.begin() + offset,
+                               search_ustr.end());
+        }
+        EXPECT_EQ(upper_lcp, search.upper_lcp());
+      }
+    }
+  }
+}
+
+void TestResortSuffixArray(ustring old_str,
+                           ustring new_str,
+                           unsigned char min_relabel_key) {
+  std::vector<size_t> suffix_array =
+      MakeSuffixArray<InducedSuffixSort>(old_str, kNumChar);
+  ResortSuffixArray(new_str, size_t(min_relabel_key), size_t(kNumChar),
+                    &suffix_array);
+  EXPECT_EQ(MakeSuffixArray<NaiveSuffixSort>(new_str, kNumChar), suffix_array);
+}
+
+TEST(SuffixArrayTest, ResortSuffixArray) {
+  constexpr unsigned char kMinRelabelKey = 'a';
+  for (const std::string& test_str : test_strs) {
+    ustring new_ustr = MakeUnsignedString(test_str);
+    // Relabeled characters are all merged.
+    ustring merged_ustr = new_ustr;
+    // Relabeled characters are reversed.
+    ustring reversed_ustr = new_ustr;
+    for (size_t i = 0; i < new_ustr.size(); ++i) {
+      if (new_ustr[i] >= kMinRelabelKey) {
+        merged_ustr[i] = kMinRelabelKey;
+        reversed_ustr[i] = kNumChar - 1 - (new_ustr[i] - kMinRelabelKey);
+      }
+    }
+    TestResortSuffixArray(merged_ustr, new_ustr, kMinRelabelKey);
+    TestResortSuffixArray(new_ustr, merged_ustr, kMinRelabelKey);
+    TestResortSuffixArray(reversed_ustr, new_ustr, kMinRelabelKey);
+    TestResortSuffixArray(new_ustr, new_ustr, kMinRelabelKey);
+  }
+}
+
+TEST(SuffixArrayTest, ResortSuffixArrayRepetitive) {
+  // Repetitive strings with few relabeled characters, like references in
+  // executables, where relabeling breaks ties between long common prefixes.
+  std::mt19937 generator(42);
+  for (size_t num_relabeled : {1, 2, 5, 20}) {
+    for (size_t period : {1, 3, 16}) {
+      ustring new_str;
+      for (size_t i = 0; i < 400; ++i) {
+        new_str.push_back(static_cast<unsigned char>(
+            generator() % 8 == 0 ? 'a' + generator() % num_relabeled
+                                 : '0' + (i % period)));
+      }
+      ustring old_str = new_str;
+      for (unsigned char& c : old_str) {
+        if (c >= 'a')
+          c = static_cast<unsigned char>('a' + generator() % 3);
+      }
+      TestResortSuffixArray(old_str, new_str, 'a');
+    }
+  }
+}
+
 }  // namespace zucchini
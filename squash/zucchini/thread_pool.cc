@@ -0,0 +1,92 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "squash/zucchini/thread_pool.h"
+
+#include <algorithm>
+
+#include "squash/base/logging.h"
+
+namespace zucchini {
+
+ThreadPool::ThreadPool(size_t num_threads) {
+  if (num_threads == 0)
+    num_threads = HardwareConcurrency();
+  workers_.reserve(num_threads - 1);
+  for (size_t i = 1; i < num_threads; ++i)
+    workers_.emplace_back(&ThreadPool::WorkerMain, this);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    shutdown_ = true;
+  }
+  job_available_.notify_all();
+  for (std::thread& worker : workers_)
+    worker.join();
+}
+
+// static
+size_t ThreadPool::HardwareConcurrency() {
+  return std::max<size_t>(1U, std::thread::hardware_concurrency());
+}
+
+void ThreadPool::ParallelFor(size_t count,
+                             const std::function<void(size_t)>& fn) {
+  // Small jobs and reentrant calls are run inline. Note that |busy_| is only
+  // set if the exchange is reached.
+  if (workers_.empty() || count <= 1 || busy_.exchange(true)) {
+    for (size_t i = 0; i < count; ++i)
+      fn(i);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    DCHECK_EQ(0U, num_active_workers_);
+    fn_ = &fn;
+    count_ = count;
+    next_index_ = 0;
+    num_active_workers_ = workers_.size();
+    ++generation_;
+  }
+  job_available_.notify_all();
+  RunJob();
+
+  {
+    std::unique_lock<std::mutex> lock(lock_);
+    job_done_.wait(lock, [this] { return num_active_workers_ == 0; });
+    fn_ = nullptr;
+  }
+  busy_ = false;
+}
+
+void ThreadPool::WorkerMain() {
+  size_t last_generation = 0;
+  std::unique_lock<std::mutex> lock(lock_);
+  for (;;) {
+    job_available_.wait(lock, [this, last_generation] {
+      return shutdown_ || generation_ != last_generation;
+    });
+    if (shutdown_)
+      return;
+    last_generation = generation_;
+
+    lock.unlock();
+    RunJob();
+    lock.lock();
+
+    DCHECK_GT(num_active_workers_, 0U);
+    if (--num_active_workers_ == 0)
+      job_done_.notify_one();
+  }
+}
+
+void ThreadPool::RunJob() {
+  for (size_t i = next_index_++; i < count_; i = next_index_++)
+    (*fn_)(i);
+}
+
+}  // namespace zucchini
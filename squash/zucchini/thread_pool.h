@@ -0,0 +1,71 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CHROME_INSTALLER_ZUCCHINI_THREAD_POOL_H_
+#define CHROME_INSTALLER_ZUCCHINI_THREAD_POOL_H_
+
+#include <stddef.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "squash/base/macros.h"
+
+namespace zucchini {
+
+// A fixed set of worker threads used to run data-parallel loops during patch
+// generation. The calling thread participates in the work, so a pool with
+// |num_threads() == 1| spawns no thread and runs everything inline.
+class ThreadPool {
+ public:
+  // Creates a pool that uses |num_threads| threads in total, including the
+  // calling thread. If |num_threads == 0|, HardwareConcurrency() is used.
+  explicit ThreadPool(size_t num_threads);
+  ~ThreadPool();
+
+  // Returns the number of hardware threads available, which is at least 1.
+  static size_t HardwareConcurrency();
+
+  size_t num_threads() const { return workers_.size() + 1; }
+
+  // Calls |fn(i)| for each i in [0, |count|), distributing calls among threads,
+  // and returns once all calls have completed. Calls with different |i| may run
+  // concurrently and in any order. If a job is already running on this pool
+  // (e.g., if called from within |fn|), all calls are made inline instead.
+  void ParallelFor(size_t count, const std::function<void(size_t)>& fn);
+
+ private:
+  // Main loop of worker threads.
+  void WorkerMain();
+
+  // Claims and runs indices of the current job until it is exhausted.
+  void RunJob();
+
+  std::vector<std::thread> workers_;
+
+  std::mutex lock_;
+  std::condition_variable job_available_;
+  std::condition_variable job_done_;
+
+  // Set while a job is running, to detect reentrant calls.
+  std::atomic<bool> busy_{false};
+
+  // State of the current job, guarded by |lock_|, except for |next_index_|.
+  const std::function<void(size_t)>* fn_ = nullptr;
+  size_t count_ = 0;
+  std::atomic<size_t> next_index_{0};
+  size_t generation_ = 0;
+  size_t num_active_workers_ = 0;
+  bool shutdown_ = false;
+
+  DISALLOW_COPY_AND_ASSIGN(ThreadPool);
+};
+
+}  // namespace zucchini
+
+#endif  // CHROME_INSTALLER_ZUCCHINI_THREAD_POOL_H_
@@ -0,0 +1,43 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "squash/zucchini/thread_pool.h"
+
+#include <stddef.h>
+
+#include <atomic>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace zucchini {
+
+TEST(ThreadPoolTest, ParallelFor) {
+  for (size_t num_threads : {0U, 1U, 2U, 5U}) {
+    ThreadPool pool(num_threads);
+    EXPECT_GE(pool.num_threads(), 1U);
+
+    // Empty job.
+    pool.ParallelFor(0, [](size_t) { FAIL(); });
+
+    // Every index is visited exactly once, and jobs can be run many times.
+    for (size_t count : {1U, 2U, 7U, 1000U}) {
+      std::vector<int> visits(count);
+      pool.ParallelFor(count, [&](size_t i) { ++visits[i]; });
+      EXPECT_EQ(std::vector<int>(count, 1), visits);
+    }
+  }
+}
+
+TEST(ThreadPoolTest, Reentrant) {
+  ThreadPool pool(4);
+  std::atomic<size_t> total(0);
+  pool.ParallelFor(8, [&](size_t) {
+    // Nested calls run inline.
+    pool.ParallelFor(8, [&](size_t) { ++total; });
+  });
+  EXPECT_EQ(64U, total.load());
+}
+
+}  // namespace zucchini
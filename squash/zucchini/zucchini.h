@@ -5,6 +5,11 @@
 #ifndef CHROME_INSTALLER_ZUCCHINI_ZUCCHINI_H_
 #define CHROME_INSTALLER_ZUCCHINI_ZUCCHINI_H_
 
+#include <stddef.h>
+
+#include <functional>
+#include <vector>
+
 #include "squash/zucchini/buffer_view.h"
 #include "squash/zucchini/patch_reader.h"
 #include "squash/zucchini/patch_writer.h"
@@ -13,6 +18,8 @@
 
 namespace zucchini {
 
+class OldImageIndex;
+
 namespace status {
 
 // Zucchini status code, which can also be used as process exit code. Therefore
@@ -27,21 +34,114 @@ enum Code {
   kStatusInvalidOldImage = 6,
   kStatusInvalidNewImage = 7,
   kStatusFatal = 8,
+  kStatusInvalidIndex = 9,
 };
 
 }  // namespace status
 
-// Generates ensemble patch from |old_image| to |new_image|, and writes it to
-// |patch_writer|.
-status::Code GenerateEnsemble(ConstBufferView old_image,
-                              ConstBufferView new_image,
-                              EnsemblePatchWriter* patch_writer);
+// Method used to find seeds of equivalences between "old" and "new" images
+// during patch generation.
+enum class SeedMatcher {
+  // Binary search of each location of "new" image in the suffix array of "old"
+  // image. Finds the longest matches, which gives the smallest patches.
+  kSuffixArray,
+  // Lookup of fixed-length windows of "new" image in a hash table of windows of
+  // "old" image. Faster and uses less memory, but misses short matches, which
+  // gives slightly larger patches.
+  kHash,
+};
+
+// Presets of options for patch generation, from fastest to smallest patches.
+enum class GenerateLevel {
+  kFast,
+  kDefault,
+  kMax,
+};
+
+// Options for patch generation, which trade speed for patch size.
+struct GenerateOptions {
+  // Options of GenerateLevel::kDefault.
+  GenerateOptions() = default;
+  explicit GenerateOptions(GenerateLevel level);
 
-// Generates raw patch from |old_image| to |new_image|, and writes it to
-// |patch_writer|.
+  // Method used to find seeds of equivalences.
+  SeedMatcher matcher = SeedMatcher::kSuffixArray;
+  // Maximal number of iterations alternating association of targets between
+  // "old" and "new" images, and search of equivalences. Must be at least 1.
+  // The first iteration uses no label. Label refinement is off by default:
+  // On all executables tried, equivalences of the first labeled iteration
+  // cover less of "new" image, so they are discarded, and patches are smaller
+  // without them.
+  size_t max_iterations = 1;
+  // Iterations stop early once at most this fraction of labels given to
+  // associated targets changes, or once equivalences stop covering more of
+  // "new" image. Only used with |max_iterations| > 2.
+  double min_label_change = 0.01;
+  // With SeedMatcher::kSuffixArray, number of suffixes visited in a row around
+  // each seed without improving the best candidate, before giving up. Must be
+  // at least 1.
+  size_t seed_neighbor_budget = 1;
+  // Number of threads used to search equivalences, or one per hardware thread
+  // if 0. This doesn't affect the patch.
+  size_t num_threads = 0;
+};
+
+// Generates ensemble patch from |old_image| to |new_image| using |options|,
+// and writes it to |patch_writer|. Each executable found in |new_image| is
+// patched against the most similar executable of |old_image|, concurrently,
+// and the rest of |new_image| is patched in raw mode, against all of
+// |old_image|. So is each executable that fails to be patched, e.g., because
+// of overlapping references.
+status::Code GenerateEnsemble(
+    ConstBufferView old_image,
+    ConstBufferView new_image,
+    EnsemblePatchWriter* patch_writer,
+    const GenerateOptions& options = GenerateOptions());
+
+// Same as GenerateEnsemble() above, but reuses the elements, ImageIndexes and
+// suffix arrays of |old_index| instead of computing them, which gives the same
+// patch. |old_index| must have been created for PatchType::kEnsemblePatch. Its
+// suffix arrays are only used with SeedMatcher::kSuffixArray.
+status::Code GenerateEnsemble(
+    const OldImageIndex& old_index,
+    ConstBufferView new_image,
+    EnsemblePatchWriter* patch_writer,
+    const GenerateOptions& options = GenerateOptions());
+
+// Generates raw patch from |old_image| to |new_image| using |options|, and
+// writes it to |patch_writer|. |options.max_iterations| is ignored.
 status::Code GenerateRaw(ConstBufferView old_image,
                          ConstBufferView new_image,
-                         EnsemblePatchWriter* patch_writer);
+                         EnsemblePatchWriter* patch_writer,
+                         const GenerateOptions& options = GenerateOptions());
+
+// Same as GenerateRaw() above, but reuses |old_index| instead of indexing old
+// image. |old_index| must have been created for PatchType::kRawPatch. Its
+// suffix array is only used with SeedMatcher::kSuffixArray.
+status::Code GenerateRaw(const OldImageIndex& old_index,
+                         ConstBufferView new_image,
+                         EnsemblePatchWriter* patch_writer,
+                         const GenerateOptions& options = GenerateOptions());
+
+// Receives the patch generated for the new image at |index| by
+// GenerateBatch(), and returns a status code, e.g., after writing it to a file.
+using BatchPatchHandler =
+    std::function<status::Code(size_t index,
+                               const EnsemblePatchWriter& patch_writer)>;
+
+// Generates patches from the old image indexed by |old_index| to each image in
+// |new_images| using |options|, the same way GenerateEnsemble() or
+// GenerateRaw() would depending on |old_index.patch_type()|, and passes each
+// patch to |handler|. |options.num_threads| threads are shared among patches:
+// Up to that many patches are generated concurrently, each using an equal share
+// of threads, in which case |handler| may also be called concurrently. Only
+// patches being generated are held in memory. Returns kStatusSuccess if all
+// patches are generated and handled, and the first error in order of
+// |new_images| otherwise.
+status::Code GenerateBatch(const OldImageIndex& old_index,
+                           const std::vector<ConstBufferView>& new_images,
+                           const GenerateOptions& options,
+                           const BatchPatchHandler& handler);
 
 // Applies |patch_reader| to |old_image| to build |new_image|, which refers to
 // preallocated memory of sufficient size.
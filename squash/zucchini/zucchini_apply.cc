@@ -100,6 +100,8 @@ bool ApplyReferencesCorrection(ExecutableType exe_type,
     LOG(ERROR) << "Failed to create Disassembler";
     return false;
   }
+  // References of "old" image are parsed on all hardware threads.
+  old_disasm->set_num_threads(0);
 
   ReferenceDeltaSource ref_delta_source = patch.GetReferenceDeltaSource();
   std::map<PoolTag, std::vector<ReferenceGroup>> pool_groups;
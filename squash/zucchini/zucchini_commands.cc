@@ -6,19 +6,25 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 
 #include <iostream>
+#include <memory>
 #include <ostream>
+#include <vector>
 
 #include "boost/filesystem.hpp"
 
 #include "squash/base/command_line.h"
 #include "squash/base/logging.h"
 #include "squash/base/macros.h"
+#include "squash/base/memory/ptr_util.h"
+#include "squash/base/optional.h"
 #include "squash/zucchini/buffer_view.h"
 #include "squash/zucchini/crc32.h"
 #include "squash/zucchini/io_utils.h"
 #include "squash/zucchini/mapped_file.h"
+#include "squash/zucchini/old_image_index.h"
 #include "squash/zucchini/patch_writer.h"
 #include "squash/zucchini/zucchini_integration.h"
 #include "squash/zucchini/zucchini_tools.h"
@@ -28,7 +34,72 @@ namespace {
 /******** Command-line Switches ********/
 
 constexpr char kSwitchDump[] = "dump";
+constexpr char kSwitchLevel[] = "level";
+constexpr char kSwitchMatcher[] = "matcher";
+constexpr char kSwitchOldIndex[] = "old-index";
 constexpr char kSwitchRaw[] = "raw";
+constexpr char kSwitchThreads[] = "threads";
+
+// Serializes |patch_writer| into a new file at |patch_path|.
+zucchini::status::Code WritePatch(
+    const zucchini::EnsemblePatchWriter& patch_writer,
+    const boost::filesystem::path& patch_path) {
+  // By default, delete patch on destruction, to avoid having lingering files in
+  // case of a failure. On Windows deletion can be done by the OS.
+  zucchini::MappedFileWriter patch(patch_path, patch_writer.SerializedSize());
+  if (!patch.IsValid())
+    return zucchini::status::kStatusFileWriteError;
+
+  if (!patch_writer.SerializeInto(patch.region()))
+    return zucchini::status::kStatusPatchWriteError;
+
+  // Successfully created patch. Explicitly request file to be kept.
+  if (!patch.Keep())
+    return zucchini::status::kStatusFileWriteError;
+  return zucchini::status::kStatusSuccess;
+}
+
+// Parses options for patch generation from |command_line| into |options|.
+// Returns false and writes a message to |err| on invalid values.
+bool ParseGenerateOptions(const base::CommandLine& command_line,
+                          std::ostream& err,
+                          zucchini::GenerateOptions* options) {
+  base::CommandLine::StringType level =
+      command_line.GetSwitchValueNative(kSwitchLevel);
+  if (level == "fast") {
+    *options = zucchini::GenerateOptions(zucchini::GenerateLevel::kFast);
+  } else if (level == "max") {
+    *options = zucchini::GenerateOptions(zucchini::GenerateLevel::kMax);
+  } else if (level.empty() || level == "default") {
+    *options = zucchini::GenerateOptions(zucchini::GenerateLevel::kDefault);
+  } else {
+    err << "Invalid -level value: " << level << std::endl;
+    return false;
+  }
+
+  // Explicit switches override the preset.
+  base::CommandLine::StringType matcher =
+      command_line.GetSwitchValueNative(kSwitchMatcher);
+  if (matcher == "sa") {
+    options->matcher = zucchini::SeedMatcher::kSuffixArray;
+  } else if (matcher == "hash") {
+    options->matcher = zucchini::SeedMatcher::kHash;
+  } else if (!matcher.empty()) {
+    err << "Invalid -matcher value: " << matcher << std::endl;
+    return false;
+  }
+  base::CommandLine::StringType threads =
+      command_line.GetSwitchValueNative(kSwitchThreads);
+  if (!threads.empty()) {
+    char* end = nullptr;
+    options->num_threads = strtoul(threads.c_str(), &end, 10);
+    if (*end != '\0') {
+      err << "Invalid -threads value: " << threads << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
 
 }  // namespace
 
@@ -46,28 +117,132 @@ zucchini::status::Code MainGen(MainParams params) {
   zucchini::EnsemblePatchWriter patch_writer(old_image.region(),
                                              new_image.region());
 
-  auto generate = params.command_line.HasSwitch(kSwitchRaw)
-                      ? zucchini::GenerateRaw
-                      : zucchini::GenerateEnsemble;
-  zucchini::status::Code result =
-      generate(old_image.region(), new_image.region(), &patch_writer);
+  bool raw = params.command_line.HasSwitch(kSwitchRaw);
+  base::CommandLine::StringType index_file =
+      params.command_line.GetSwitchValueNative(kSwitchOldIndex);
+  zucchini::GenerateOptions options;
+  if (!ParseGenerateOptions(params.command_line, params.err, &options))
+    return zucchini::status::kStatusInvalidParam;
+  zucchini::status::Code result = zucchini::status::kStatusSuccess;
+  if (index_file.empty()) {
+    result = raw ? zucchini::GenerateRaw(old_image.region(), new_image.region(),
+                                         &patch_writer, options)
+                 : zucchini::GenerateEnsemble(old_image.region(),
+                                              new_image.region(), &patch_writer,
+                                              options);
+  } else {
+    // Reuse the index created by MainIndex(), as long as it matches
+    // |old_image|.
+    zucchini::MappedFileReader index(index_file);
+    if (!index.IsValid())
+      return zucchini::status::kStatusFileReadError;
+    base::Optional<zucchini::OldImageIndex> old_index =
+        zucchini::OldImageIndex::Load(old_image.region(), index.region());
+    if (!old_index.has_value()) {
+      params.err << "Invalid or stale index, which must be recreated with "
+                 << "-index." << std::endl;
+      return zucchini::status::kStatusInvalidIndex;
+    }
+    result = raw ? zucchini::GenerateRaw(*old_index, new_image.region(),
+                                         &patch_writer, options)
+                 : zucchini::GenerateEnsemble(*old_index, new_image.region(),
+                                              &patch_writer, options);
+  }
   if (result != zucchini::status::kStatusSuccess) {
     params.out << "Fatal error encountered when generating patch." << std::endl;
     return result;
   }
+  return WritePatch(patch_writer, params.file_paths[2]);
+}
 
-  // By default, delete patch on destruction, to avoid having lingering files in
-  // case of a failure. On Windows deletion can be done by the OS.
-  zucchini::MappedFileWriter patch(params.file_paths[2],
-                                   patch_writer.SerializedSize());
-  if (!patch.IsValid())
-    return zucchini::status::kStatusFileWriteError;
+zucchini::status::Code MainGenBatch(MainParams params) {
+  CHECK_EQ(1U, params.file_paths.size() % 2);
+  zucchini::MappedFileReader old_image(params.file_paths[0]);
+  if (!old_image.IsValid())
+    return zucchini::status::kStatusFileReadError;
 
-  if (!patch_writer.SerializeInto(patch.region()))
-    return zucchini::status::kStatusPatchWriteError;
+  // Arguments after "old" file alternate between "new" file and patch file.
+  std::vector<std::unique_ptr<zucchini::MappedFileReader>> new_files;
+  std::vector<zucchini::ConstBufferView> new_images;
+  for (size_t i = 1; i < params.file_paths.size(); i += 2) {
+    new_files.push_back(
+        base::MakeUnique<zucchini::MappedFileReader>(params.file_paths[i]));
+    if (!new_files.back()->IsValid())
+      return zucchini::status::kStatusFileReadError;
+    new_images.push_back(new_files.back()->region());
+  }
 
-  // Successfully created patch. Explicitly request file to be kept.
-  if (!patch.Keep())
+  zucchini::GenerateOptions options;
+  if (!ParseGenerateOptions(params.command_line, params.err, &options))
+    return zucchini::status::kStatusInvalidParam;
+
+  // Index "old" image once for all patches, unless an index is provided.
+  base::CommandLine::StringType index_file =
+      params.command_line.GetSwitchValueNative(kSwitchOldIndex);
+  std::unique_ptr<zucchini::MappedFileReader> index;
+  if (!index_file.empty()) {
+    index = base::MakeUnique<zucchini::MappedFileReader>(index_file);
+    if (!index->IsValid())
+      return zucchini::status::kStatusFileReadError;
+  }
+  base::Optional<zucchini::OldImageIndex> old_index =
+      index ? zucchini::OldImageIndex::Load(old_image.region(), index->region())
+            : zucchini::OldImageIndex::Create(
+                  old_image.region(),
+                  params.command_line.HasSwitch(kSwitchRaw)
+                      ? zucchini::PatchType::kRawPatch
+                      : zucchini::PatchType::kEnsemblePatch);
+  if (!old_index.has_value()) {
+    if (index) {
+      params.err << "Invalid or stale index, which must be recreated with "
+                 << "-index." << std::endl;
+      return zucchini::status::kStatusInvalidIndex;
+    }
+    params.err << "Fatal error encountered when indexing old image."
+               << std::endl;
+    return zucchini::status::kStatusInvalidOldImage;
+  }
+  if (params.command_line.HasSwitch(kSwitchRaw) !=
+      (old_index->patch_type() == zucchini::PatchType::kRawPatch)) {
+    params.err << "Index was created for another patch type." << std::endl;
+    return zucchini::status::kStatusInvalidParam;
+  }
+
+  zucchini::status::Code result = zucchini::GenerateBatch(
+      *old_index, new_images, options,
+      [&params](size_t index,
+                const zucchini::EnsemblePatchWriter& patch_writer) {
+        return WritePatch(patch_writer, params.file_paths[2 + 2 * index]);
+      });
+  if (result != zucchini::status::kStatusSuccess)
+    params.out << "Fatal error encountered when generating patches."
+               << std::endl;
+  return result;
+}
+
+zucchini::status::Code MainIndex(MainParams params) {
+  CHECK_EQ(2U, params.file_paths.size());
+  zucchini::MappedFileReader old_image(params.file_paths[0]);
+  if (!old_image.IsValid())
+    return zucchini::status::kStatusFileReadError;
+
+  base::Optional<zucchini::OldImageIndex> old_index =
+      zucchini::OldImageIndex::Create(
+          old_image.region(), params.command_line.HasSwitch(kSwitchRaw)
+                                  ? zucchini::PatchType::kRawPatch
+                                  : zucchini::PatchType::kEnsemblePatch);
+  if (!old_index.has_value()) {
+    params.err << "Fatal error encountered when indexing old image."
+               << std::endl;
+    return zucchini::status::kStatusInvalidOldImage;
+  }
+
+  // As for patches, delete the index on destruction unless it's complete.
+  zucchini::MappedFileWriter index(params.file_paths[1],
+                                   old_index->SerializedSize());
+  if (!index.IsValid())
+    return zucchini::status::kStatusFileWriteError;
+  if (!old_index->SerializeInto(index.region()) || !index.Keep())
     return zucchini::status::kStatusFileWriteError;
   return zucchini::status::kStatusSuccess;
 }
@@ -34,6 +34,13 @@ using CommandFunction = zucchini::status::Code (*)(MainParams);
 // Command Function: Patch generation.
 zucchini::status::Code MainGen(MainParams params);
 
+// Command Function: Generation of patches from one old image to many new
+// images.
+zucchini::status::Code MainGenBatch(MainParams params);
+
+// Command Function: Index an old image for patch generation.
+zucchini::status::Code MainIndex(MainParams params);
+
 // Command Function: Patch application.
 zucchini::status::Code MainApply(MainParams params);
 
@@ -4,18 +4,25 @@
 
 #include "squash/zucchini/zucchini_gen.h"
 
+#include <algorithm>
+#include <chrono>
 #include <memory>
 #include <utility>
+#include <vector>
 
 #include "squash/base/logging.h"
 #include "squash/zucchini/disassembler.h"
 #include "squash/zucchini/element_detection.h"
 #include "squash/zucchini/encoded_view.h"
+#include "squash/zucchini/ensemble_matcher.h"
 #include "squash/zucchini/equivalence_map.h"
 #include "squash/zucchini/image_index.h"
+#include "squash/zucchini/old_image_index.h"
 #include "squash/zucchini/patch_writer.h"
+#include "squash/zucchini/seed_index.h"
 #include "squash/zucchini/suffix_array.h"
 #include "squash/zucchini/targets_affinity.h"
+#include "squash/zucchini/thread_pool.h"
 
 namespace zucchini {
 
@@ -24,10 +31,304 @@ namespace {
 // Parameters for patch generation.
 constexpr double kMinEquivalenceSimilarity = 12.0;
 constexpr double kLargeEquivalenceSimilarity = 64.0;
-constexpr size_t kNumIterations = 2;
+
+// Marks targets without association in GetLabelAssociations().
+constexpr key_t kNoAssociation = static_cast<key_t>(-1);
+
+// Returns, for each old target, the key of the new target that has the same
+// label in |old_labels| and |new_labels|, or kNoAssociation if it has no label.
+// Labels are below |label_bound|, and 0 is used for targets without label.
+std::vector<key_t> GetLabelAssociations(const std::vector<uint32_t>& old_labels,
+                                        const std::vector<uint32_t>& new_labels,
+                                        size_t label_bound) {
+  std::vector<key_t> new_keys(label_bound, kNoAssociation);
+  for (key_t new_key = 0; new_key < new_labels.size(); ++new_key)
+    new_keys[new_labels[new_key]] = new_key;
+  new_keys[0] = kNoAssociation;
+  std::vector<key_t> associations(old_labels.size());
+  for (key_t old_key = 0; old_key < old_labels.size(); ++old_key)
+    associations[old_key] = new_keys[old_labels[old_key]];
+  return associations;
+}
+
+// Returns the number of old targets whose association differs between
+// |associations1| and |associations2|, given by GetLabelAssociations().
+size_t CountChangedAssociations(const std::vector<key_t>& associations1,
+                                const std::vector<key_t>& associations2) {
+  DCHECK_EQ(associations1.size(), associations2.size());
+  size_t count = 0;
+  for (size_t i = 0; i < associations1.size(); ++i)
+    count += associations1[i] != associations2[i];
+  return count;
+}
+
+// Labels of the targets of a pool, on an iteration of CreateEquivalenceMap().
+struct PoolLabels {
+  std::vector<uint32_t> old_labels;
+  std::vector<uint32_t> new_labels;
+  // Upper bound on |old_labels| and |new_labels|.
+  size_t bound = 0;
+  // Associations given by labels of the previous iteration, and of the current
+  // one, see GetLabelAssociations().
+  std::vector<key_t> associations;
+  std::vector<key_t> next_associations;
+  // Number of old targets whose association changed.
+  size_t num_changed = 0;
+};
+
+// Generates raw patch from |old_image| to |new_image| like GenerateRaw(), where
+// |old_sa| is the suffix array of |old_image|, which may be empty unless
+// |options.matcher| is SeedMatcher::kSuffixArray.
+status::Code GenerateRawWithSuffixArray(SuffixArrayView old_sa,
+                                        ConstBufferView old_image,
+                                        ConstBufferView new_image,
+                                        EnsemblePatchWriter* patch_writer,
+                                        const GenerateOptions& options) {
+  patch_writer->SetPatchType(PatchType::kRawPatch);
+
+  PatchElementWriter patch_element(
+      {Element(old_image.region()), Element(new_image.region())},
+      patch_writer->spill_file());
+  if (!GenerateRawElement(old_sa, old_image, new_image, &patch_element,
+                          options))
+    return status::kStatusFatal;
+  patch_writer->AddElement(std::move(patch_element));
+  return status::kStatusSuccess;
+}
+
+// Initializes |image_index| with references found by a Disassembler of type
+// |exe_type|, on |num_threads| threads (see ImageIndex::Initialize()).
+// Returns true on success.
+bool InitializeImageIndex(ExecutableType exe_type,
+                          size_t num_threads,
+                          ImageIndex* image_index) {
+  std::unique_ptr<Disassembler> disasm =
+      MakeDisassemblerOfType(image_index->image(), exe_type);
+  if (!disasm) {
+    LOG(ERROR) << "Failed to create Disassembler.";
+    return false;
+  }
+  DCHECK_EQ(exe_type, disasm->GetExeType());
+  disasm->set_num_threads(num_threads);
+  if (!image_index->Initialize(disasm.get(), num_threads)) {
+    LOG(ERROR) << "Failed to create ImageIndex: Overlapping references found?";
+    return false;
+  }
+  return true;
+}
+
+// Same as GenerateExecutableElement(), with |new_image_index| initialized.
+bool GenerateExecutableElementWithIndexes(const ImageIndex& old_image_index,
+                                          SuffixArrayView old_sa,
+                                          const ImageIndex& new_image_index,
+                                          PatchElementWriter* patch_writer,
+                                          const GenerateOptions& options) {
+  ConstBufferView old_image = old_image_index.image();
+  ConstBufferView new_image = new_image_index.image();
+  DCHECK_EQ(old_image_index.PoolCount(), new_image_index.PoolCount());
+
+  EquivalenceMap equivalence_map =
+      CreateEquivalenceMap(old_image_index, new_image_index, old_sa, options);
+  OffsetMapper offset_mapper(equivalence_map);
+
+  ReferenceDeltaSink reference_delta_sink(patch_writer->spill_file());
+  for (size_t pool_index = 0; pool_index < old_image_index.PoolCount();
+       ++pool_index) {
+    PoolTag pool_tag(static_cast<uint8_t>(pool_index));
+    const TargetPool& old_targets = old_image_index.pool(pool_tag);
+    TargetPool projected_old_targets = old_targets;
+    projected_old_targets.Project(offset_mapper);
+    std::vector<offset_t> extra_target =
+        FindExtraTargets(projected_old_targets, new_image_index.pool(pool_tag));
+    projected_old_targets.InsertTargets(extra_target);
+
+    if (!GenerateExtraTargets(extra_target, pool_tag, patch_writer))
+      return false;
+    for (TypeTag type_tag : old_targets.types()) {
+      if (!GenerateReferencesDelta(old_image_index.refs(type_tag),
+                                   new_image_index.refs(type_tag),
+                                   projected_old_targets, offset_mapper,
+                                   equivalence_map, &reference_delta_sink))
+        return false;
+    }
+  }
+  patch_writer->SetReferenceDeltaSink(std::move(reference_delta_sink));
+
+  return GenerateEquivalencesAndExtraData(new_image, equivalence_map,
+                                          patch_writer) &&
+         GenerateRawDelta(old_image, new_image, equivalence_map,
+                          new_image_index, patch_writer);
+}
+
+// Generates ensemble patch from |old_image| to |new_image| like
+// GenerateEnsemble(). If |old_index| is not null, it indexes |old_image|, and
+// its elements, ImageIndexes and suffix arrays are used instead of being
+// computed, which gives the same patch.
+status::Code GenerateEnsembleWithOptionalIndex(
+    ConstBufferView old_image,
+    const OldImageIndex* old_index,
+    ConstBufferView new_image,
+    EnsemblePatchWriter* patch_writer,
+    const GenerateOptions& options) {
+  patch_writer->SetPatchType(PatchType::kEnsemblePatch);
+
+  const std::vector<Element> old_elements =
+      old_index ? old_index->elements() : FindElements(old_image);
+  std::vector<ElementMatch> matches =
+      MatchElements(old_image, old_elements, new_image,
+                    FindElements(new_image), options.num_threads);
+
+  // If no executable of "new" image matches an executable of "old" image, fall
+  // back to generating a raw patch.
+  if (matches.empty()) {
+    LOG(WARNING) << "Fall back to raw mode.";
+    if (old_index) {
+      return GenerateRawWithSuffixArray(old_index->suffix_array(), old_image,
+                                        new_image, patch_writer, options);
+    }
+    return GenerateRaw(old_image, new_image, patch_writer, options);
+  }
+
+  // Patch elements cover "new" image: Each match gives an element, and each gap
+  // between matched elements of "new" image gives a raw element, patched
+  // against all of "old" image.
+  std::vector<ElementMatch> element_matches;
+  bool has_raw_elements = false;
+  offset_t new_offset = 0;
+  for (size_t i = 0; i <= matches.size(); ++i) {
+    offset_t gap_end = i < matches.size() ? matches[i].new_element.offset
+                                          : offset_t(new_image.size());
+    if (gap_end > new_offset) {
+      element_matches.push_back({Element(old_image.region()),
+                                 Element({new_offset, gap_end - new_offset})});
+      has_raw_elements = true;
+    }
+    if (i < matches.size()) {
+      element_matches.push_back(matches[i]);
+      new_offset = matches[i].new_element.EndOffset();
+    }
+  }
+  // Raw suffix array of "old" image, computed only if needed.
+  SuffixArrayView old_sa;
+  std::vector<offset_t> old_sa_storage;
+  if (old_index) {
+    old_sa = old_index->suffix_array();
+  } else if (has_raw_elements &&
+             options.matcher == SeedMatcher::kSuffixArray) {
+    old_sa_storage = MakeRawSuffixArray(old_image);
+    old_sa = {old_sa_storage.data(), old_sa_storage.size()};
+  }
+
+  // Elements are generated concurrently, and threads are shared among them.
+  size_t num_threads = options.num_threads ? options.num_threads
+                                           : ThreadPool::HardwareConcurrency();
+  ThreadPool thread_pool(std::min(num_threads, element_matches.size()));
+  GenerateOptions element_options = options;
+  element_options.num_threads =
+      std::max<size_t>(1, num_threads / thread_pool.num_threads());
+  std::vector<PatchElementWriter> patch_elements;
+  patch_elements.reserve(element_matches.size());
+  for (const ElementMatch& element_match : element_matches)
+    patch_elements.emplace_back(element_match, patch_writer->spill_file());
+  std::vector<status::Code> results(element_matches.size(),
+                                    status::kStatusSuccess);
+  thread_pool.ParallelFor(element_matches.size(), [&](size_t i) {
+    const ElementMatch& element_match = element_matches[i];
+    ExecutableType exe_type = element_match.new_element.exe_type;
+    ConstBufferView old_sub_image = old_image[element_match.old_element];
+    ConstBufferView new_sub_image = new_image[element_match.new_element];
+    bool generated = false;
+    if (exe_type == kExeTypeNoOp) {
+      generated = GenerateRawElement(old_sa, old_sub_image, new_sub_image,
+                                     &patch_elements[i], element_options);
+    } else if (!old_index) {
+      generated = GenerateExecutableElement(exe_type, old_sub_image,
+                                            new_sub_image, &patch_elements[i],
+                                            element_options);
+    } else {
+      // Elements of |old_index| are sorted by offsets, and don't overlap.
+      const std::vector<Element>& indexed_elements = old_index->elements();
+      size_t k = std::lower_bound(indexed_elements.begin(),
+                                  indexed_elements.end(),
+                                  element_match.old_element,
+                                  [](const Element& a, const Element& b) {
+                                    return a.offset < b.offset;
+                                  }) -
+                 indexed_elements.begin();
+      DCHECK(k < indexed_elements.size() &&
+             indexed_elements[k] == element_match.old_element);
+      const ImageIndex* old_image_index = old_index->element_image_index(k);
+      generated = old_image_index &&
+                  GenerateExecutableElement(
+                      exe_type, *old_image_index,
+                      old_index->element_suffix_array(k), new_sub_image,
+                      &patch_elements[i], element_options);
+    }
+    if (!generated)
+      results[i] = status::kStatusFatal;
+  });
+
+  // An executable element that fails, e.g., because of overlapping references,
+  // is replaced by a raw element patched against all of "old" image, like gaps.
+  std::vector<size_t> failed_indexes;
+  std::vector<PatchElementWriter> raw_patch_elements;
+  for (size_t i = 0; i < element_matches.size(); ++i) {
+    if (results[i] == status::kStatusSuccess)
+      continue;
+    const Element& new_element = element_matches[i].new_element;
+    if (new_element.exe_type == kExeTypeNoOp)
+      return results[i];
+    LOG(WARNING) << "Failed to generate element at " << new_element.offset
+                 << " of new image, fall back to raw mode for it.";
+    failed_indexes.push_back(i);
+    raw_patch_elements.emplace_back(
+        ElementMatch{Element(old_image.region()),
+                     Element(new_element.region())},
+        patch_writer->spill_file());
+  }
+  if (!failed_indexes.empty() && old_sa.empty() &&
+      options.matcher == SeedMatcher::kSuffixArray) {
+    old_sa_storage = MakeRawSuffixArray(old_image);
+    old_sa = {old_sa_storage.data(), old_sa_storage.size()};
+  }
+  thread_pool.ParallelFor(failed_indexes.size(), [&](size_t j) {
+    size_t i = failed_indexes[j];
+    if (GenerateRawElement(old_sa, old_image,
+                           new_image[element_matches[i].new_element],
+                           &raw_patch_elements[j], element_options)) {
+      results[i] = status::kStatusSuccess;
+    }
+  });
+
+  size_t num_failed = 0;
+  for (size_t i = 0; i < patch_elements.size(); ++i) {
+    if (results[i] != status::kStatusSuccess)
+      return results[i];
+    if (num_failed < failed_indexes.size() && failed_indexes[num_failed] == i)
+      patch_writer->AddElement(std::move(raw_patch_elements[num_failed++]));
+    else
+      patch_writer->AddElement(std::move(patch_elements[i]));
+  }
+  return status::kStatusSuccess;
+}
 
 }  // namespace
 
+GenerateOptions::GenerateOptions(GenerateLevel level) {
+  switch (level) {
+    case GenerateLevel::kFast:
+      matcher = SeedMatcher::kHash;
+      break;
+    case GenerateLevel::kDefault:
+      break;
+    case GenerateLevel::kMax:
+      // Try one labeled iteration, which is kept only if it covers more.
+      max_iterations = 2;
+      seed_neighbor_budget = 8;
+      break;
+  }
+}
+
 std::vector<offset_t> FindExtraTargets(const TargetPool& projected_old_targets,
                                        const TargetPool& new_targets) {
   std::vector<offset_t> extra_targets;
@@ -39,6 +340,14 @@ std::vector<offset_t> FindExtraTargets(const TargetPool& projected_old_targets,
 
 EquivalenceMap CreateEquivalenceMap(const ImageIndex& old_image_index,
                                     const ImageIndex& new_image_index) {
+  return CreateEquivalenceMap(old_image_index, new_image_index, {});
+}
+
+EquivalenceMap CreateEquivalenceMap(const ImageIndex& old_image_index,
+                                    const ImageIndex& new_image_index,
+                                    SuffixArrayView old_sa,
+                                    const GenerateOptions& options) {
+  DCHECK_GE(options.max_iterations, 1U);
   // Label matching (between "old" and "new") can guide EquivalenceMap
   // construction; but EquivalenceMap induces Label matching. This apparent
   // "chick and egg" problem is solved by multiple iterations alternating 2
@@ -46,56 +355,159 @@ EquivalenceMap CreateEquivalenceMap(const ImageIndex& old_image_index,
   // - Association of targets based on previous EquivalenceMap. Note that the
   //   EquivalenceMap is empty on first iteration, so this is a no-op.
   // - Construction of refined EquivalenceMap based on new targets associations.
-  TargetPool old_targets;
-  TargetPool new_targets;
-  for (const auto& old_target_pool : old_image_index.target_pools())
-    old_targets.InsertTargets(old_target_pool.second.targets());
-  for (const auto& new_target_pool : new_image_index.target_pools())
-    new_targets.InsertTargets(new_target_pool.second.targets());
-
-  TargetsAffinity targets_affinity(&old_targets, &new_targets);
+  // Iterations stop once labels barely change, since the EquivalenceMap would
+  // barely change either, or once coverage of "new" image stops improving.
+  // Each target pool has its own TargetsAffinity. Pools are independent, so
+  // they are processed concurrently.
+  DCHECK_EQ(old_image_index.PoolCount(), new_image_index.PoolCount());
+  size_t num_pools = old_image_index.PoolCount();
+  std::vector<TargetsAffinity> targets_affinities(num_pools);
+  size_t num_threads = options.num_threads ? options.num_threads
+                                           : ThreadPool::HardwareConcurrency();
+  ThreadPool thread_pool(std::max<size_t>(1, std::min(num_threads, num_pools)));
 
   EquivalenceMap equivalence_map;
-  for (size_t i = 0; i < kNumIterations; ++i) {
-    EncodedView old_view(old_image_index, &old_targets);
-    EncodedView new_view(new_image_index, &new_targets);
+  // EquivalenceMap of the previous iteration, restored if the last one covers
+  // less of "new" image.
+  EquivalenceMap previous_equivalence_map;
+  offset_t previous_coverage = 0;
+  // Labels of each pool, and associations of targets they give, on the current
+  // and previous iterations.
+  std::vector<PoolLabels> pool_labels(num_pools);
+  for (size_t pool_index = 0; pool_index < num_pools; ++pool_index) {
+    PoolTag pool_tag(static_cast<uint8_t>(pool_index));
+    pool_labels[pool_index].associations.assign(
+        old_image_index.pool(pool_tag).size(), kNoAssociation);
+  }
+  // Suffix array of the old view, which only needs to be reordered where
+  // references are relabeled after the first iteration. |old_sa| is copied
+  // into it at that point if it was provided.
+  std::vector<offset_t> old_sa_storage;
+  for (size_t i = 0; i < options.max_iterations; ++i) {
+    auto start_time = std::chrono::steady_clock::now();
+    EncodedView old_view(old_image_index, EncodedView::Mode::kMaterialized);
+    EncodedView new_view(new_image_index, EncodedView::Mode::kMaterialized);
 
     // Associate targets from "old" to "new" image based on |equivalence_map|
-    // for each reference pool.
-    targets_affinity.InferFromSimilarities(equivalence_map);
-
-    // Creates labels for strongly associated targets.
-    std::vector<uint32_t> old_labels;
-    std::vector<uint32_t> new_labels;
-    size_t label_bound = targets_affinity.AssignLabels(
-        kLargeEquivalenceSimilarity, &old_labels, &new_labels);
-    old_view.SetLabels(std::move(old_labels), label_bound);
-    new_view.SetLabels(std::move(new_labels), label_bound);
+    // for each reference pool, and create labels for strongly associated
+    // targets.
+    thread_pool.ParallelFor(num_pools, [&](size_t pool_index) {
+      PoolTag pool_tag(static_cast<uint8_t>(pool_index));
+      TargetsAffinity& targets_affinity = targets_affinities[pool_index];
+      targets_affinity.InferFromSimilarities(
+          equivalence_map, old_image_index.pool(pool_tag).targets(),
+          new_image_index.pool(pool_tag).targets());
+      PoolLabels& labels = pool_labels[pool_index];
+      labels.bound = targets_affinity.AssignLabels(
+          kLargeEquivalenceSimilarity, &labels.old_labels, &labels.new_labels);
+      std::vector<key_t> associations = GetLabelAssociations(
+          labels.old_labels, labels.new_labels, labels.bound);
+      labels.num_changed =
+          CountChangedAssociations(labels.associations, associations);
+      labels.next_associations = std::move(associations);
+    });
+
+    size_t num_labels = 0;
+    size_t num_changed_labels = 0;
+    for (const PoolLabels& labels : pool_labels) {
+      num_labels += labels.bound - 1;
+      num_changed_labels += labels.num_changed;
+    }
+    if (i > 0 &&
+        num_changed_labels <= options.min_label_change * num_labels) {
+      LOG(INFO) << "Iteration " << i << ": " << num_labels << " labels ("
+                << num_changed_labels << " changed), stop";
+      break;
+    }
+    for (size_t pool_index = 0; pool_index < num_pools; ++pool_index) {
+      PoolTag pool_tag(static_cast<uint8_t>(pool_index));
+      PoolLabels& labels = pool_labels[pool_index];
+      labels.associations = std::move(labels.next_associations);
+      old_view.SetLabels(pool_tag, std::move(labels.old_labels), labels.bound);
+      new_view.SetLabels(pool_tag, std::move(labels.new_labels), labels.bound);
+    }
 
     // Build equivalence map, where references in "old" and "new" that
     // share common semantics (i.e., their respective targets were associated
     // earlier on) are considered equivalent.
-    equivalence_map.Build(
-        MakeSuffixArray<InducedSuffixSort>(old_view, old_view.Cardinality()),
-        old_view, new_view, targets_affinity, kMinEquivalenceSimilarity);
+    previous_equivalence_map = std::move(equivalence_map);
+    equivalence_map = EquivalenceMap();
+    if (options.matcher == SeedMatcher::kHash) {
+      // Hashes of windows depend on labels, so the table is rebuilt on each
+      // iteration. This is cheap compared to sorting suffixes.
+      equivalence_map.Build(SeedIndex(old_view), old_view, new_view,
+                            targets_affinities, kMinEquivalenceSimilarity,
+                            options.num_threads);
+    } else {
+      if (i == 0) {
+        if (old_sa.empty()) {
+          old_sa_storage = MakeSuffixArray<ParallelInducedSuffixSort>(
+              old_view.projections(), old_view.Cardinality());
+        }
+      } else {
+        if (old_sa.begin() != old_sa_storage.data())
+          old_sa_storage.assign(old_sa.begin(), old_sa.end());
+        ResortSuffixArray(old_view.projections(), kBaseReferenceProjection,
+                          old_view.Cardinality(), &old_sa_storage);
+      }
+      if (!old_sa_storage.empty())
+        old_sa = {old_sa_storage.data(), old_sa_storage.size()};
+      equivalence_map.Build(old_sa, old_view, new_view, targets_affinities,
+                            kMinEquivalenceSimilarity, options.num_threads,
+                            options.seed_neighbor_budget);
+    }
+
+    offset_t coverage = equivalence_map.GetCoverage();
+    std::chrono::duration<double> time =
+        std::chrono::steady_clock::now() - start_time;
+    LOG(INFO) << "Iteration " << i << ": " << num_labels << " labels ("
+              << num_changed_labels << " changed), coverage " << coverage
+              << " / " << new_view.size() << ", " << time.count() << " s";
+    if (i > 0 && coverage <= previous_coverage) {
+      if (coverage < previous_coverage)
+        equivalence_map = std::move(previous_equivalence_map);
+      break;
+    }
+    previous_coverage = coverage;
   }
 
   return equivalence_map;
 }
 
+std::vector<offset_t> MakeInitialSuffixArray(
+    const ImageIndex& old_image_index) {
+  EncodedView old_view(old_image_index, EncodedView::Mode::kMaterialized);
+  // No target is labeled on the first iteration of CreateEquivalenceMap().
+  for (size_t pool_index = 0; pool_index < old_image_index.PoolCount();
+       ++pool_index) {
+    PoolTag pool_tag(static_cast<uint8_t>(pool_index));
+    old_view.SetLabels(
+        pool_tag,
+        std::vector<uint32_t>(old_image_index.pool(pool_tag).size(), 0), 1);
+  }
+  return MakeSuffixArray<ParallelInducedSuffixSort>(old_view.projections(),
+                                                    old_view.Cardinality());
+}
+
+std::vector<offset_t> MakeRawSuffixArray(ConstBufferView image) {
+  ImageIndex image_index(image);
+  EncodedView view(image_index);
+  return MakeSuffixArray<ParallelInducedSuffixSort>(view, view.Cardinality());
+}
+
 bool GenerateEquivalencesAndExtraData(ConstBufferView new_image,
                                       const EquivalenceMap& equivalence_map,
                                       PatchElementWriter* patch_writer) {
   // Make 2 passes through |equivalence_map| to reduce write churn.
   // Pass 1: Write all equivalences.
-  EquivalenceSink equivalences_sink;
+  EquivalenceSink equivalences_sink(patch_writer->spill_file());
   for (const EquivalenceCandidate& candidate : equivalence_map)
     equivalences_sink.PutNext(candidate.eq);
   patch_writer->SetEquivalenceSink(std::move(equivalences_sink));
 
   // Pass 2: Write data in gaps in |new_image| before / between  after
   // |equivalence_map| as "extra data".
-  ExtraDataSink extra_data_sink;
+  ExtraDataSink extra_data_sink(patch_writer->spill_file());
   offset_t dst_offset = 0;
   for (const EquivalenceCandidate& candidate : equivalence_map) {
     extra_data_sink.PutNext(
@@ -114,7 +526,7 @@ bool GenerateRawDelta(ConstBufferView old_image,
                       const EquivalenceMap& equivalence_map,
                       const ImageIndex& new_image_index,
                       PatchElementWriter* patch_writer) {
-  RawDeltaSink raw_delta_sink;
+  RawDeltaSink raw_delta_sink(patch_writer->spill_file());
 
   // Visit |equivalence_map| blocks in |new_image| order. Find and emit all
   // bytewise differences.
@@ -145,7 +557,9 @@ bool GenerateReferencesDelta(const ReferenceSet& src_refs,
                              const EquivalenceMap& equivalence_map,
                              ReferenceDeltaSink* reference_delta_sink) {
   size_t ref_width = src_refs.width();
-  auto dst_ref = dst_refs.begin();
+  const std::vector<offset_t>& src_locations = src_refs.locations();
+  const std::vector<offset_t>& dst_locations = dst_refs.locations();
+  size_t dst_index = 0;
 
   // For each equivalence, for each covered |dst_ref| and the matching
   // |src_ref|, emit the delta between the respective target labels. Note: By
@@ -154,42 +568,43 @@ bool GenerateReferencesDelta(const ReferenceSet& src_refs,
   // "straddle checks" throughout to verify this assertion.
   for (const auto& candidate : equivalence_map) {
     const Equivalence equiv = candidate.eq;
-    // Increment |dst_ref| until it catches up to |equiv|.
-    while (dst_ref != dst_refs.end() && dst_ref->location < equiv.dst_offset)
-      ++dst_ref;
-    if (dst_ref == dst_refs.end())
+    // Increment |dst_index| until it catches up to |equiv|.
+    while (dst_index < dst_locations.size() &&
+           dst_locations[dst_index] < equiv.dst_offset) {
+      ++dst_index;
+    }
+    if (dst_index == dst_locations.size())
       break;
-    if (dst_ref->location >= equiv.dst_end())
+    if (dst_locations[dst_index] >= equiv.dst_end())
       continue;
     // Straddle check.
-    DCHECK_LE(dst_ref->location + ref_width, equiv.dst_end());
+    DCHECK_LE(dst_locations[dst_index] + ref_width, equiv.dst_end());
 
     offset_t src_loc =
-        equiv.src_offset + (dst_ref->location - equiv.dst_offset);
-    auto src_ref = std::lower_bound(
-        src_refs.begin(), src_refs.end(), src_loc,
-        [](const Reference& a, offset_t b) { return a.location < b; });
-    for (; dst_ref != dst_refs.end() &&
-           dst_ref->location + ref_width <= equiv.dst_end();
-         ++dst_ref, ++src_ref) {
+        equiv.src_offset + (dst_locations[dst_index] - equiv.dst_offset);
+    size_t src_index =
+        std::lower_bound(src_locations.begin(), src_locations.end(), src_loc) -
+        src_locations.begin();
+    for (; dst_index < dst_locations.size() &&
+           dst_locations[dst_index] + ref_width <= equiv.dst_end();
+         ++dst_index, ++src_index) {
       // Local offset of |src_ref| should match that of |dst_ref|.
-      DCHECK_EQ(src_ref->location - equiv.src_offset,
-                dst_ref->location - equiv.dst_offset);
-      //key_t src_target_key = sr
-      offset_t old_offset = src_ref->target;
+      DCHECK_EQ(src_locations[src_index] - equiv.src_offset,
+                dst_locations[dst_index] - equiv.dst_offset);
+      offset_t old_offset = src_refs.GetReference(src_index).target;
       offset_t new_expected_offset = offset_mapper.ProjectOffset(old_offset);
       offset_t new_expected_key =
           projected_target_pool.KeyForOffset(new_expected_offset);
-      offset_t new_offset = dst_ref->target;
+      offset_t new_offset = dst_refs.GetReference(dst_index).target;
       offset_t new_key = projected_target_pool.KeyForOffset(new_offset);
 
       reference_delta_sink->PutNext(
           static_cast<int32_t>(new_key - new_expected_key));
     }
-    if (dst_ref == dst_refs.end())
+    if (dst_index == dst_locations.size())
       break;  // Done.
     // Straddle check.
-    DCHECK_GE(dst_ref->location, equiv.dst_end());
+    DCHECK_GE(dst_locations[dst_index], equiv.dst_end());
   }
   return true;
 }
@@ -197,24 +612,32 @@ bool GenerateReferencesDelta(const ReferenceSet& src_refs,
 bool GenerateExtraTargets(const std::vector<offset_t>& extra_targets,
                           PoolTag pool_tag,
                           PatchElementWriter* patch_writer) {
-  TargetSink target_sink;
+  TargetSink target_sink(patch_writer->spill_file());
   for (offset_t target : extra_targets)
     target_sink.PutNext(target);
   patch_writer->SetTargetSink(pool_tag, std::move(target_sink));
   return true;
 }
 
-bool GenerateRawElement(const std::vector<offset_t>& old_sa,
+bool GenerateRawElement(SuffixArrayView old_sa,
                         ConstBufferView old_image,
                         ConstBufferView new_image,
-                        PatchElementWriter* patch_writer) {
+                        PatchElementWriter* patch_writer,
+                        const GenerateOptions& options) {
   ImageIndex old_image_index(old_image);
   ImageIndex new_image_index(new_image);
+  EncodedView old_view(old_image_index);
+  EncodedView new_view(new_image_index);
 
   EquivalenceMap equivalences;
-  equivalences.Build(old_sa, EncodedView(old_image_index, nullptr),
-                     EncodedView(new_image_index, nullptr), {},
-                     kMinEquivalenceSimilarity);
+  if (options.matcher == SeedMatcher::kHash) {
+    equivalences.Build(SeedIndex(old_view), old_view, new_view, {},
+                       kMinEquivalenceSimilarity, options.num_threads);
+  } else {
+    equivalences.Build(old_sa, old_view, new_view, {},
+                       kMinEquivalenceSimilarity, options.num_threads,
+                       options.seed_neighbor_budget);
+  }
 
   patch_writer->SetReferenceDeltaSink({});
   return GenerateEquivalencesAndExtraData(new_image, equivalences,
@@ -226,111 +649,122 @@ bool GenerateRawElement(const std::vector<offset_t>& old_sa,
 bool GenerateExecutableElement(ExecutableType exe_type,
                                ConstBufferView old_image,
                                ConstBufferView new_image,
-                               PatchElementWriter* patch_writer) {
-  // Initialize Disassemblers.
-  std::unique_ptr<Disassembler> old_disasm =
-      MakeDisassemblerOfType(old_image, exe_type);
-  std::unique_ptr<Disassembler> new_disasm =
-      MakeDisassemblerOfType(new_image, exe_type);
-  if (!old_disasm || !new_disasm) {
-    LOG(ERROR) << "Failed to create Disassembler.";
-    return false;
-  }
-  DCHECK_EQ(old_disasm->GetExeType(), new_disasm->GetExeType());
-
-  // Initialize ImageIndexes.
+                               PatchElementWriter* patch_writer,
+                               const GenerateOptions& options) {
+  // "Old" and "new" images are indexed concurrently, each on half of the
+  // threads.
   ImageIndex old_image_index(old_image);
   ImageIndex new_image_index(new_image);
-  if (!old_image_index.Initialize(old_disasm.get()) ||
-      !new_image_index.Initialize(new_disasm.get())) {
-    LOG(ERROR) << "Failed to create ImageIndex: Overlapping references found?";
-    return false;
-  }
-
-  DCHECK_EQ(old_image_index.PoolCount(), new_image_index.PoolCount());
-
-  EquivalenceMap equivalence_map =
-      CreateEquivalenceMap(old_image_index, new_image_index);
-  OffsetMapper offset_mapper(equivalence_map);
-
-  ReferenceDeltaSink reference_delta_sink;
-  for (const auto& old_targets : old_image_index.target_pools()) {
-    PoolTag pool_tag = old_targets.first;
-    TargetPool projected_old_targets = old_targets.second;
-    projected_old_targets.Project(offset_mapper);
-    std::vector<offset_t> extra_target =
-        FindExtraTargets(projected_old_targets, new_image_index.pool(pool_tag));
-    projected_old_targets.InsertTargets(extra_target);
-
-    if (!GenerateExtraTargets(extra_target, pool_tag, patch_writer))
-      return false;
-    for (TypeTag type_tag : old_targets.second.types()) {
-      if (!GenerateReferencesDelta(old_image_index.refs(type_tag),
-                                   new_image_index.refs(type_tag),
-                                   projected_old_targets, offset_mapper,
-                                   equivalence_map, &reference_delta_sink))
-        return false;
-    }
-  }
-  patch_writer->SetReferenceDeltaSink(std::move(reference_delta_sink));
+  ImageIndex* image_indexes[] = {&old_image_index, &new_image_index};
+  bool initialized[] = {false, false};
+  size_t num_threads = options.num_threads ? options.num_threads
+                                           : ThreadPool::HardwareConcurrency();
+  ThreadPool thread_pool(std::min<size_t>(2, num_threads));
+  thread_pool.ParallelFor(2, [&](size_t i) {
+    initialized[i] =
+        InitializeImageIndex(exe_type, std::max<size_t>(1, num_threads / 2),
+                             image_indexes[i]);
+  });
+  return initialized[0] && initialized[1] &&
+         GenerateExecutableElementWithIndexes(old_image_index, {},
+                                              new_image_index, patch_writer,
+                                              options);
+}
 
-  return GenerateEquivalencesAndExtraData(new_image, equivalence_map,
-                                          patch_writer) &&
-         GenerateRawDelta(old_image, new_image, equivalence_map,
-                          new_image_index, patch_writer);
+bool GenerateExecutableElement(ExecutableType exe_type,
+                               const ImageIndex& old_image_index,
+                               SuffixArrayView old_sa,
+                               ConstBufferView new_image,
+                               PatchElementWriter* patch_writer,
+                               const GenerateOptions& options) {
+  ImageIndex new_image_index(new_image);
+  return InitializeImageIndex(exe_type, options.num_threads,
+                              &new_image_index) &&
+         GenerateExecutableElementWithIndexes(old_image_index, old_sa,
+                                              new_image_index, patch_writer,
+                                              options);
 }
 
 /******** Exported Functions ********/
 
 status::Code GenerateEnsemble(ConstBufferView old_image,
                               ConstBufferView new_image,
-                              EnsemblePatchWriter* patch_writer) {
-  patch_writer->SetPatchType(PatchType::kEnsemblePatch);
-
-  base::Optional<Element> old_element =
-      DetectElementFromDisassembler(old_image);
-  base::Optional<Element> new_element =
-      DetectElementFromDisassembler(new_image);
-
-  // If images do not match known executable formats, or if detected formats
-  // don't match, fall back to generating a raw patch.
-  if (!old_element.has_value() || !new_element.has_value() ||
-      old_element->exe_type != new_element->exe_type) {
-    LOG(WARNING) << "Fall back to raw mode.";
-    return GenerateRaw(old_image, new_image, patch_writer);
-  }
+                              EnsemblePatchWriter* patch_writer,
+                              const GenerateOptions& options) {
+  return GenerateEnsembleWithOptionalIndex(old_image, nullptr, new_image,
+                                           patch_writer, options);
+}
 
-  if (old_element->region() != old_image.region() ||
-      new_element->region() != new_image.region()) {
-    LOG(ERROR) << "Ensemble patching is currently unsupported.";
-    return status::kStatusFatal;
+status::Code GenerateEnsemble(const OldImageIndex& old_index,
+                              ConstBufferView new_image,
+                              EnsemblePatchWriter* patch_writer,
+                              const GenerateOptions& options) {
+  if (old_index.patch_type() != PatchType::kEnsemblePatch) {
+    LOG(ERROR) << "Index of old image was not created for ensemble patching.";
+    return status::kStatusInvalidParam;
   }
-
-  PatchElementWriter patch_element(ElementMatch{*old_element, *new_element});
-
-  // TODO(etiennep): Fallback to raw mode with proper logging.
-  if (!GenerateExecutableElement(old_element->exe_type, old_image, new_image,
-                                 &patch_element))
-    return status::kStatusFatal;
-  patch_writer->AddElement(std::move(patch_element));
-  return status::kStatusSuccess;
+  return GenerateEnsembleWithOptionalIndex(old_index.image(), &old_index,
+                                           new_image, patch_writer, options);
 }
 
 status::Code GenerateRaw(ConstBufferView old_image,
                          ConstBufferView new_image,
-                         EnsemblePatchWriter* patch_writer) {
-  patch_writer->SetPatchType(PatchType::kRawPatch);
+                         EnsemblePatchWriter* patch_writer,
+                         const GenerateOptions& options) {
+  if (options.matcher == SeedMatcher::kHash) {
+    return GenerateRawWithSuffixArray({}, old_image, new_image, patch_writer,
+                                      options);
+  }
+  std::vector<offset_t> old_sa = MakeRawSuffixArray(old_image);
+  return GenerateRawWithSuffixArray({old_sa.data(), old_sa.size()}, old_image,
+                                    new_image, patch_writer, options);
+}
 
-  ImageIndex old_image_index(old_image);
-  EncodedView old_view(old_image_index, nullptr);
-  std::vector<offset_t> old_sa =
-      MakeSuffixArray<InducedSuffixSort>(old_view, old_view.Cardinality());
+status::Code GenerateRaw(const OldImageIndex& old_index,
+                         ConstBufferView new_image,
+                         EnsemblePatchWriter* patch_writer,
+                         const GenerateOptions& options) {
+  if (old_index.patch_type() != PatchType::kRawPatch) {
+    LOG(ERROR) << "Index of old image was not created for raw patching.";
+    return status::kStatusInvalidParam;
+  }
+  return GenerateRawWithSuffixArray(old_index.suffix_array(), old_index.image(),
+                                    new_image, patch_writer, options);
+}
 
-  PatchElementWriter patch_element(
-      {Element(old_image.region()), Element(new_image.region())});
-  if (!GenerateRawElement(old_sa, old_image, new_image, &patch_element))
-    return status::kStatusFatal;
-  patch_writer->AddElement(std::move(patch_element));
+status::Code GenerateBatch(const OldImageIndex& old_index,
+                           const std::vector<ConstBufferView>& new_images,
+                           const GenerateOptions& options,
+                           const BatchPatchHandler& handler) {
+  if (new_images.empty())
+    return status::kStatusSuccess;
+
+  // As for elements in GenerateEnsemble(), patches are generated concurrently
+  // and threads are shared among them.
+  size_t num_threads = options.num_threads ? options.num_threads
+                                           : ThreadPool::HardwareConcurrency();
+  ThreadPool pool(std::min(num_threads, new_images.size()));
+  GenerateOptions patch_options = options;
+  patch_options.num_threads =
+      std::max<size_t>(1, num_threads / pool.num_threads());
+  std::vector<status::Code> results(new_images.size(),
+                                    status::kStatusSuccess);
+  pool.ParallelFor(new_images.size(), [&](size_t i) {
+    EnsemblePatchWriter patch_writer(old_index.image(), new_images[i]);
+    status::Code result =
+        old_index.patch_type() == PatchType::kRawPatch
+            ? GenerateRaw(old_index, new_images[i], &patch_writer,
+                          patch_options)
+            : GenerateEnsemble(old_index, new_images[i], &patch_writer,
+                               patch_options);
+    if (result == status::kStatusSuccess)
+      result = handler(i, patch_writer);
+    results[i] = result;
+  });
+  for (status::Code result : results) {
+    if (result != status::kStatusSuccess)
+      return result;
+  }
   return status::kStatusSuccess;
 }
 
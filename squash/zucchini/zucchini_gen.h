@@ -5,6 +5,8 @@
 #ifndef CHROME_INSTALLER_ZUCCHINI_ZUCCHINI_GEN_H_
 #define CHROME_INSTALLER_ZUCCHINI_ZUCCHINI_GEN_H_
 
+#include <stddef.h>
+
 #include <vector>
 
 #include "squash/base/optional.h"
@@ -35,6 +37,24 @@ std::vector<offset_t> FindExtraTargets(const TargetPool& projected_old_targets,
 EquivalenceMap CreateEquivalenceMap(const ImageIndex& old_image_index,
                                     const ImageIndex& new_image_index);
 
+// Same as above, but starts from |old_sa|, which is either empty, or the result
+// of MakeInitialSuffixArray() on |old_image_index|, e.g., loaded from an index.
+// Equivalences are searched as specified by |options|. |old_sa| is ignored
+// unless |options.matcher| is SeedMatcher::kSuffixArray.
+EquivalenceMap CreateEquivalenceMap(
+    const ImageIndex& old_image_index,
+    const ImageIndex& new_image_index,
+    SuffixArrayView old_sa,
+    const GenerateOptions& options = GenerateOptions());
+
+// Returns the suffix array that CreateEquivalenceMap() computes on its first
+// iteration, before any target is labeled. It only depends on "old" image, so
+// it can be computed once for many "new" images.
+std::vector<offset_t> MakeInitialSuffixArray(const ImageIndex& old_image_index);
+
+// Returns the suffix array of raw |image|, used to generate raw patches.
+std::vector<offset_t> MakeRawSuffixArray(ConstBufferView image);
+
 // Writes equivalences from |equivalence_map|, and extra data from |new_image|
 // found in gaps between equivalences to |patch_writer|.
 bool GenerateEquivalencesAndExtraData(ConstBufferView new_image,
@@ -65,19 +85,34 @@ bool GenerateExtraTargets(const std::vector<offset_t>& extra_targets,
                           PoolTag pool_tag,
                           PatchElementWriter* patch_writer);
 
-// Generates raw patch element data between |old_image| and |new_image|, and
-// writes them to |patch_writer|. |old_sa| is the suffix array for |old_image|.
-bool GenerateRawElement(const std::vector<offset_t>& old_sa,
+// Generates raw patch element data between |old_image| and |new_image| using
+// |options|, and writes them to |patch_writer|. |old_sa| is the suffix array
+// for |old_image|, and may be empty unless |options.matcher| is
+// SeedMatcher::kSuffixArray.
+bool GenerateRawElement(SuffixArrayView old_sa,
                         ConstBufferView old_image,
                         ConstBufferView new_image,
-                        PatchElementWriter* patch_writer);
-
-// Generates patch element of type |exe_type| from |old_image| to |new_image|,
-// and writes it to |patch_writer|.
-bool GenerateExecutableElement(ExecutableType exe_type,
-                               ConstBufferView old_image,
-                               ConstBufferView new_image,
-                               PatchElementWriter* patch_writer);
+                        PatchElementWriter* patch_writer,
+                        const GenerateOptions& options = GenerateOptions());
+
+// Generates patch element of type |exe_type| from |old_image| to |new_image|
+// using |options|, and writes it to |patch_writer|.
+bool GenerateExecutableElement(
+    ExecutableType exe_type,
+    ConstBufferView old_image,
+    ConstBufferView new_image,
+    PatchElementWriter* patch_writer,
+    const GenerateOptions& options = GenerateOptions());
+
+// Same as above, but uses |old_image_index|, which is already initialized, and
+// its initial suffix array |old_sa| (see CreateEquivalenceMap()).
+bool GenerateExecutableElement(
+    ExecutableType exe_type,
+    const ImageIndex& old_image_index,
+    SuffixArrayView old_sa,
+    ConstBufferView new_image,
+    PatchElementWriter* patch_writer,
+    const GenerateOptions& options = GenerateOptions());
 
 }  // namespace zucchini
 
@@ -6,6 +6,7 @@
 
 #include <stdint.h>
 
+#include <random>
 #include <utility>
 #include <vector>
 
@@ -170,6 +171,49 @@ TEST(ZucchiniGenTest, GenerateReferencesDelta) {
                                                   {{10, 14, 2}, kDummySim}})));
 }
 
+TEST(ZucchiniGenTest, CreateEquivalenceMapThreads) {
+  // "New" image made of pieces of "old" image, some of them altered, and of
+  // zero padding. A small alphabet yields many competing alignments, so that
+  // scans of shards started at different offsets find different candidates.
+  std::mt19937 rng(2);
+  std::vector<uint8_t> old_image(1 << 14);
+  for (uint8_t& value : old_image)
+    value = static_cast<uint8_t>(rng() % 4);
+  std::vector<uint8_t> new_image;
+  while (new_image.size() < old_image.size()) {
+    size_t length = 16 + rng() % 512;
+    size_t offset = rng() % (old_image.size() - length);
+    new_image.insert(new_image.end(), old_image.begin() + offset,
+                     old_image.begin() + offset + length);
+    if (rng() % 2)
+      new_image[new_image.size() - 1 - rng() % length] ^= 0xFF;
+    new_image.resize(new_image.size() + rng() % 64, 0);
+  }
+  ImageIndex old_image_index({old_image.data(), old_image.size()});
+  ImageIndex new_image_index({new_image.data(), new_image.size()});
+
+  for (GenerateLevel level : {GenerateLevel::kFast, GenerateLevel::kDefault,
+                              GenerateLevel::kMax}) {
+    GenerateOptions options(level);
+    options.num_threads = 1;
+    EquivalenceMap expected =
+        CreateEquivalenceMap(old_image_index, new_image_index, {}, options);
+    EXPECT_LT(16U, expected.size());
+    for (size_t num_threads : {2U, 3U, 8U}) {
+      options.num_threads = num_threads;
+      EquivalenceMap equivalence_map =
+          CreateEquivalenceMap(old_image_index, new_image_index, {}, options);
+      ASSERT_EQ(expected.size(), equivalence_map.size());
+      auto candidate = equivalence_map.begin();
+      for (const EquivalenceCandidate& expected_candidate : expected) {
+        EXPECT_EQ(expected_candidate.eq, candidate->eq);
+        EXPECT_EQ(expected_candidate.similarity, candidate->similarity);
+        ++candidate;
+      }
+    }
+  }
+}
+
 // TODO(huangs): Add more tests.
 
 }  // namespace zucchini
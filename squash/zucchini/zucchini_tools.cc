@@ -86,7 +86,8 @@ status::Code DetectAll(ConstBufferView image,
         << ": " << msg << std::endl;
   };
 
-  ElementFinder finder(image, DetectElementFromDisassembler);
+  ElementFinder finder(image, DetectElementFromDisassembler,
+                       FindExecutableSignature);
   for (auto element = finder.GetNext(); element.has_value();
        element = finder.GetNext()) {
     ConstBufferView sub_image = image[element->region()];